@@ -0,0 +1,76 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "arena.h"
+#include "utils.h"
+
+struct arenaBlock_t {
+  arenaBlock_t *next;
+  size_t size;
+  size_t used;
+  u1 data[] __attribute__((aligned(8)));
+};
+
+void arena_init(arena_t *pArena, size_t blockSz) {
+  pArena->head = NULL;
+  pArena->blockSz = blockSz;
+}
+
+void arena_destroy(arena_t *pArena) {
+  arenaBlock_t *pBlock = pArena->head;
+  while (pBlock) {
+    arenaBlock_t *pNext = pBlock->next;
+    free(pBlock);
+    pBlock = pNext;
+  }
+  pArena->head = NULL;
+}
+
+void *arena_alloc(arena_t *pArena, size_t size) {
+  size = (size + 7) & ~(size_t)7;
+  arenaBlock_t *pBlock = pArena->head;
+  if (pBlock == NULL || pBlock->size - pBlock->used < size) {
+    size_t blockSz = size > pArena->blockSz ? size : pArena->blockSz;
+    pBlock = utils_malloc(sizeof(arenaBlock_t) + blockSz);
+    pBlock->next = pArena->head;
+    pBlock->size = blockSz;
+    pBlock->used = 0;
+    pArena->head = pBlock;
+  }
+  void *ptr = pBlock->data + pBlock->used;
+  pBlock->used += size;
+  return ptr;
+}
+
+void arena_reset(arena_t *pArena) {
+  arenaBlock_t *pBlock = pArena->head;
+  if (pBlock == NULL) return;
+
+  arenaBlock_t *pNext = pBlock->next;
+  while (pNext) {
+    arenaBlock_t *pTmp = pNext->next;
+    free(pNext);
+    pNext = pTmp;
+  }
+  pBlock->next = NULL;
+  pBlock->used = 0;
+}
@@ -0,0 +1,47 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include "common.h"
+
+typedef struct arenaBlock_t arenaBlock_t;
+
+// Bump allocator for short lived objects that are released all at once. Not thread safe, each
+// thread owns its arenas.
+typedef struct {
+  arenaBlock_t *head;
+  size_t blockSz;
+} arena_t;
+
+// Takes the default size of the blocks backing the arena
+void arena_init(arena_t *, size_t);
+void arena_destroy(arena_t *);
+
+// Allocates 8 bytes aligned memory that stays valid until the arena is reset or destroyed
+void *arena_alloc(arena_t *, size_t);
+
+// Releases all allocations, keeping the most recent block around for reuse
+void arena_reset(arena_t *);
+
+#endif
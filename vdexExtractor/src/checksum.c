@@ -0,0 +1,418 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <pthread.h>
+#include <zlib.h>
+
+#include "checksum.h"
+#include "cpu_features.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#if VDEX_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Ranges below this size are hashed serially, since splitting them costs more than it saves
+#define kMinParallelBytes (8 * 1024 * 1024)
+
+// Smallest chunk hashed by a task, chunks are aligned to it
+#define kMinChunkBytes (2 * 1024 * 1024)
+
+// Largest prime below 2^16 & largest n such that 255n(n+1)/2 + (n+1)(kAdlerBase-1) <= 2^32-1
+#define kAdlerBase 65521U
+#define kAdlerNMax 5552
+
+// Bytes consumed per SIMD loop iteration
+#define kAdlerBlock 32
+
+// Buffers shorter than these are left to zlib, the vector setup isn't worth it
+#define kAdlerMinSimd 64
+#define kCrcMinSimd 64
+
+// Pieces at least this long bypass the staging block of the fused digests
+#define kMultiMinDirect 4096
+
+typedef u4 (*adler32Fn)(u4, const u1 *, size_t);
+typedef u4 (*crc32Fn)(u4, const u1 *, size_t);
+
+#if VDEX_HAVE_X86_SIMD
+static inline u4 adler32Tail(u4 adler, const u1 *buf, size_t len) {
+  u4 s1 = adler & 0xffff;
+  u4 s2 = adler >> 16;
+  while (len--) {
+    s1 += *buf++;
+    s2 += s1;
+  }
+  return (s2 % kAdlerBase) << 16 | (s1 % kAdlerBase);
+}
+
+static inline u4 hsumSSE(__m128i v) {
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return (u4)_mm_cvtsi128_si32(v);
+}
+
+// Per 32 byte block s1 grows by the byte sum (psadbw) & s2 by 32 * s1 plus the bytes weighted
+// 32..1 (pmaddubsw + pmaddwd). The 32 * s1 term is deferred in v_ps & applied once per NMAX run.
+__attribute__((target("ssse3"))) static u4 adler32SSSE3(u4 adler, const u1 *buf, size_t len) {
+  u4 s1 = adler & 0xffff;
+  u4 s2 = adler >> 16;
+  size_t blocks = len / kAdlerBlock;
+  len -= blocks * kAdlerBlock;
+
+  const __m128i tap1 =
+      _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+  const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+
+  while (blocks) {
+    size_t n = kAdlerNMax / kAdlerBlock;
+    if (n > blocks) n = blocks;
+    blocks -= n;
+
+    __m128i v_ps = _mm_set_epi32(0, 0, 0, (int)(s1 * n));
+    __m128i v_s2 = _mm_set_epi32(0, 0, 0, (int)s2);
+    __m128i v_s1 = zero;
+    do {
+      const __m128i bytes1 = _mm_loadu_si128((const __m128i *)buf);
+      const __m128i bytes2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+      v_ps = _mm_add_epi32(v_ps, v_s1);
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+      buf += kAdlerBlock;
+    } while (--n);
+    v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+    s1 = (s1 + hsumSSE(v_s1)) % kAdlerBase;
+    s2 = hsumSSE(v_s2) % kAdlerBase;
+  }
+  return adler32Tail(s2 << 16 | s1, buf, len);
+}
+
+__attribute__((target("avx2"))) static u4 adler32AVX2(u4 adler, const u1 *buf, size_t len) {
+  u4 s1 = adler & 0xffff;
+  u4 s2 = adler >> 16;
+  size_t blocks = len / kAdlerBlock;
+  len -= blocks * kAdlerBlock;
+
+  const __m256i tap = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18,
+                                       17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+
+  while (blocks) {
+    size_t n = kAdlerNMax / kAdlerBlock;
+    if (n > blocks) n = blocks;
+    blocks -= n;
+
+    __m256i v_ps = _mm256_setr_epi32((int)(s1 * n), 0, 0, 0, 0, 0, 0, 0);
+    __m256i v_s2 = _mm256_setr_epi32((int)s2, 0, 0, 0, 0, 0, 0, 0);
+    __m256i v_s1 = zero;
+    do {
+      const __m256i bytes = _mm256_loadu_si256((const __m256i *)buf);
+      v_ps = _mm256_add_epi32(v_ps, v_s1);
+      v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes, zero));
+      v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, tap), ones));
+      buf += kAdlerBlock;
+    } while (--n);
+    v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 5));
+
+    __m128i s1x = _mm_add_epi32(_mm256_castsi256_si128(v_s1), _mm256_extracti128_si256(v_s1, 1));
+    __m128i s2x = _mm_add_epi32(_mm256_castsi256_si128(v_s2), _mm256_extracti128_si256(v_s2, 1));
+    s1 = (s1 + hsumSSE(s1x)) % kAdlerBase;
+    s2 = hsumSSE(s2x) % kAdlerBase;
+  }
+  return adler32Tail(s2 << 16 | s1, buf, len);
+}
+// Folds 4 x 128 bits per 64 byte block with carry-less multiplies by x^(512+-32) mod P, then
+// down to 128 & 64 bits and Barrett reduces the remainder (Intel's "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ", bit reflected constants of the zip polynomial). Takes the
+// pre-inverted CRC & a length that's a multiple of 16 & at least 64.
+__attribute__((target("pclmul,sse4.1"))) static u4 crc32FoldPCLMUL(u4 crc,
+                                                                   const u1 *buf,
+                                                                   size_t len) {
+  static const u8 __attribute__((aligned(16))) k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+  static const u8 __attribute__((aligned(16))) k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+  static const u8 __attribute__((aligned(16))) k5k0[] = { 0x0163cd6124, 0x0000000000 };
+  static const u8 __attribute__((aligned(16))) poly[] = { 0x01db710641, 0x01f7011641 };
+
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+  x1 = _mm_loadu_si128((const __m128i *)buf);
+  x2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+  x3 = _mm_loadu_si128((const __m128i *)(buf + 32));
+  x4 = _mm_loadu_si128((const __m128i *)(buf + 48));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+  x0 = _mm_load_si128((const __m128i *)k1k2);
+  buf += 64;
+  len -= 64;
+
+  while (len >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)buf));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(buf + 16)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(buf + 32)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(buf + 48)));
+    buf += 64;
+    len -= 64;
+  }
+
+  // Fold the 4 lanes into one, then any remaining 16 byte blocks
+  x0 = _mm_load_si128((const __m128i *)k3k4);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x4), x5);
+  while (len >= 16) {
+    x2 = _mm_loadu_si128((const __m128i *)buf);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x2), x5);
+    buf += 16;
+    len -= 16;
+  }
+
+  // 128 to 64 bits
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, x3);
+  x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x00), x2);
+
+  // Barrett reduction to 32 bits
+  x0 = _mm_load_si128((const __m128i *)poly);
+  x2 = _mm_and_si128(x1, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, x3);
+  x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return (u4)_mm_extract_epi32(x1, 1);
+}
+
+static u4 crc32PCLMUL(u4 crc, const u1 *buf, size_t len) {
+  size_t folded = len & ~(size_t)15;
+  crc = ~crc32FoldPCLMUL(~crc, buf, folded);
+  return (u4)crc32(crc, buf + folded, (uInt)(len - folded));
+}
+#endif
+
+static u4 adler32Zlib(u4 adler, const u1 *buf, size_t len) { return adler32(adler, buf, len); }
+
+static u4 crc32Zlib(u4 crc, const u1 *buf, size_t len) { return (u4)crc32_z(crc, buf, len); }
+
+static adler32Fn adler32Kernel = adler32Zlib;
+static crc32Fn crc32Kernel = crc32Zlib;
+static pthread_once_t kernelsOnce = PTHREAD_ONCE_INIT;
+
+// Picks the widest kernels the CPU supports, cross-checked against zlib on a buffer spanning
+// several NMAX runs, unaligned starts & ragged tails before being trusted
+static void selectKernels(void) {
+  const char *name = "zlib";
+#if VDEX_HAVE_X86_SIMD
+  static u1 probe[3 * kAdlerNMax + 77];
+  u4 seed = 0x9e3779b9;
+  for (size_t i = 0; i < sizeof(probe); ++i) {
+    seed = seed * 1103515245 + 12345;
+    probe[i] = i % 7 == 0 ? 0xff : (u1)(seed >> 24);
+  }
+
+  adler32Fn candidate = NULL;
+  if (cpu_hasAVX2()) {
+    candidate = adler32AVX2;
+    name = "avx2";
+  } else if (cpu_hasSSSE3()) {
+    candidate = adler32SSSE3;
+    name = "ssse3";
+  }
+
+  if (candidate) {
+    bool match = true;
+    for (size_t off = 0; off < 4 && match; ++off) {
+      size_t len = sizeof(probe) - off * 13;
+      match = candidate(1, probe + off, len) == adler32Zlib(1, probe + off, len) &&
+              candidate(0xfff0fff0, probe + off, len) == adler32Zlib(0xfff0fff0, probe + off, len);
+    }
+    if (match) {
+      adler32Kernel = candidate;
+    } else {
+      LOGMSG(l_WARN, "%s adler32 kernel disagrees with zlib - falling back to zlib", name);
+      name = "zlib";
+    }
+  }
+#endif
+  LOGMSG(l_DEBUG, "Using %s adler32 kernel", name);
+
+#if VDEX_HAVE_X86_SIMD
+  if (cpu_hasPCLMUL() && cpu_hasSSE42()) {
+    bool match = true;
+    for (size_t off = 0; off < 4 && match; ++off) {
+      size_t len = sizeof(probe) - off * 13;
+      match = crc32PCLMUL(0, probe + off, len) == crc32Zlib(0, probe + off, len) &&
+              crc32PCLMUL(0xdeadbeef, probe + off, 80) == crc32Zlib(0xdeadbeef, probe + off, 80);
+    }
+    if (match) {
+      crc32Kernel = crc32PCLMUL;
+      LOGMSG(l_DEBUG, "Using pclmul crc32 kernel");
+    } else {
+      LOGMSG(l_WARN, "pclmul crc32 kernel disagrees with zlib - falling back to zlib");
+    }
+  }
+#endif
+}
+
+size_t checksum_getAdler32Kernels(checksum_kernel_t kernels[kChecksumMaxKernels]) {
+  size_t cnt = 0;
+  kernels[cnt++] = (checksum_kernel_t){ "zlib", adler32Zlib, 0 };
+#if VDEX_HAVE_X86_SIMD
+  if (cpu_hasSSSE3()) kernels[cnt++] = (checksum_kernel_t){ "ssse3", adler32SSSE3, 0 };
+  if (cpu_hasAVX2()) kernels[cnt++] = (checksum_kernel_t){ "avx2", adler32AVX2, 0 };
+#endif
+  return cnt;
+}
+
+u4 checksum_adler32Update(u4 adler, const u1 *buf, size_t len) {
+  pthread_once(&kernelsOnce, selectKernels);
+  if (len < kAdlerMinSimd) return adler32Zlib(adler, buf, len);
+  return adler32Kernel(adler, buf, len);
+}
+
+size_t checksum_getCrc32Kernels(checksum_kernel_t kernels[kChecksumMaxKernels]) {
+  size_t cnt = 0;
+  kernels[cnt++] = (checksum_kernel_t){ "zlib", crc32Zlib, 0 };
+#if VDEX_HAVE_X86_SIMD
+  if (cpu_hasPCLMUL() && cpu_hasSSE42()) {
+    kernels[cnt++] = (checksum_kernel_t){ "pclmul", crc32PCLMUL, kCrcMinSimd };
+  }
+#endif
+  return cnt;
+}
+
+u4 checksum_crc32Update(u4 crc, const u1 *buf, size_t len) {
+  pthread_once(&kernelsOnce, selectKernels);
+  if (len < kCrcMinSimd) return crc32Zlib(crc, buf, len);
+  return crc32Kernel(crc, buf, len);
+}
+
+void checksum_multiInit(checksum_multi_t *pMulti) {
+  pMulti->adler = adler32(0L, Z_NULL, 0);
+  sha1_init(&pMulti->sha1);
+  pMulti->crc = crc32(0L, Z_NULL, 0);
+  pMulti->stagedLen = 0;
+}
+
+static void multiBlocks(checksum_multi_t *pMulti, const u1 *buf, size_t len) {
+  while (len > 0) {
+    size_t blockLen = len < kChecksumMultiBlock ? len : kChecksumMultiBlock;
+    pMulti->adler = checksum_adler32Update(pMulti->adler, buf, blockLen);
+    sha1_update(&pMulti->sha1, buf, blockLen);
+    pMulti->crc = checksum_crc32Update(pMulti->crc, buf, blockLen);
+    buf += blockLen;
+    len -= blockLen;
+  }
+}
+
+static void multiFlush(checksum_multi_t *pMulti) {
+  multiBlocks(pMulti, pMulti->staged, pMulti->stagedLen);
+  pMulti->stagedLen = 0;
+}
+
+void checksum_multiUpdate(checksum_multi_t *pMulti, const u1 *buf, size_t len) {
+  if (len >= kMultiMinDirect) {
+    multiFlush(pMulti);
+    multiBlocks(pMulti, buf, len);
+    return;
+  }
+  if (pMulti->stagedLen + len > kChecksumMultiBlock) {
+    multiFlush(pMulti);
+  }
+  memcpy(pMulti->staged + pMulti->stagedLen, buf, len);
+  pMulti->stagedLen += len;
+}
+
+void checksum_multiFinal(checksum_multi_t *pMulti, u1 digest[kSHA1DigestLen]) {
+  multiFlush(pMulti);
+  sha1_final(&pMulti->sha1, digest);
+}
+
+typedef struct {
+  checksum_rangeFn fn;
+  const void *arg;
+  size_t off;
+  size_t len;
+  u4 adler;
+} checksumChunk_t;
+
+static void checksumChunkTask(void *arg) {
+  checksumChunk_t *pChunk = (checksumChunk_t *)arg;
+  pChunk->adler = pChunk->fn(pChunk->arg, pChunk->off, pChunk->len, adler32(0L, Z_NULL, 0));
+}
+
+u4 checksum_adler32Range(checksum_rangeFn fn, const void *arg, size_t off, size_t len) {
+  u4 nThreads = threadPool_getThreadsNum();
+  if (nThreads <= 1 || len < kMinParallelBytes) {
+    return fn(arg, off, len, adler32(0L, Z_NULL, 0));
+  }
+
+  size_t nChunks = len / kMinChunkBytes;
+  if (nChunks > nThreads) nChunks = nThreads;
+  size_t chunkLen = (len / nChunks + kMinChunkBytes - 1) / kMinChunkBytes * kMinChunkBytes;
+  nChunks = (len + chunkLen - 1) / chunkLen;
+
+  checksumChunk_t *chunks = utils_calloc(nChunks * sizeof(checksumChunk_t));
+  threadPool_group_t group = { .pending = 0 };
+  for (size_t i = 0; i < nChunks; ++i) {
+    chunks[i].fn = fn;
+    chunks[i].arg = arg;
+    chunks[i].off = off + i * chunkLen;
+    chunks[i].len = i + 1 < nChunks ? chunkLen : len - i * chunkLen;
+    threadPool_submitNested(&group, checksumChunkTask, &chunks[i]);
+  }
+  threadPool_wait(&group);
+
+  u4 adler = chunks[0].adler;
+  for (size_t i = 1; i < nChunks; ++i) {
+    adler = adler32_combine(adler, chunks[i].adler, (z_off_t)chunks[i].len);
+  }
+  free(chunks);
+  return adler;
+}
+
+static u4 bufferRange(const void *arg, size_t off, size_t len, u4 adler) {
+  return checksum_adler32Update(adler, (const u1 *)arg + off, len);
+}
+
+u4 checksum_adler32(const u1 *buf, size_t len) {
+  return checksum_adler32Range(bufferRange, buf, 0, len);
+}
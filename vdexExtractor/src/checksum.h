@@ -0,0 +1,80 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _CHECKSUM_H_
+#define _CHECKSUM_H_
+
+#include "common.h"
+#include "sha1.h"
+
+// Continues an Adler32 over a buffer with the fastest kernel of the running CPU (AVX2, SSSE3),
+// falling back to zlib's adler32() which remains the reference implementation
+u4 checksum_adler32Update(u4, const u1 *, size_t);
+
+// CRC32 (zip polynomial) continuing from the given value, folded with carry-less multiplies when
+// the CPU supports PCLMULQDQ, otherwise computed by zlib's crc32()
+u4 checksum_crc32Update(u4, const u1 *, size_t);
+
+// Adler32 & CRC32 kernels usable on the running CPU, zlib's reference one first, so that the
+// vector ones can be cross-checked & benchmarked against it. Returns the number of kernels stored.
+typedef struct {
+  const char *name;
+  u4 (*update)(u4, const u1 *, size_t);
+  size_t minLen;  // shortest buffer the kernel accepts
+} checksum_kernel_t;
+
+#define kChecksumMaxKernels 3
+size_t checksum_getAdler32Kernels(checksum_kernel_t[kChecksumMaxKernels]);
+size_t checksum_getCrc32Kernels(checksum_kernel_t[kChecksumMaxKernels]);
+
+// Fused hashing block, small enough to stay in L1 while each digest consumes it
+#define kChecksumMultiBlock (16 * 1024)
+
+// Adler32, SHA-1 & CRC32 of a stream computed in a single sweep. Input is consumed in blocks that
+// stay in L1 while all three digests run over them, instead of three passes over the whole input.
+// Short pieces (e.g. ranges between patches) are staged until a whole block is gathered, so that
+// the vector kernels aren't starved.
+typedef struct {
+  u4 adler;
+  sha1_ctx_t sha1;
+  u4 crc;
+  size_t stagedLen;
+  u1 staged[kChecksumMultiBlock];
+} checksum_multi_t;
+
+void checksum_multiInit(checksum_multi_t *);
+void checksum_multiUpdate(checksum_multi_t *, const u1 *, size_t);
+
+// Hashes any staged input & completes the SHA-1 digest. Adler32 & CRC32 are read from the state.
+void checksum_multiFinal(checksum_multi_t *, u1[kSHA1DigestLen]);
+
+// Hashes a range (offset & length) of an input, continuing from the given Adler32 value
+typedef u4 (*checksum_rangeFn)(const void *, size_t, size_t, u4);
+
+// Adler32 of a range of an input. Large ranges are split in chunks hashed concurrently on the
+// thread pool & merged with adler32_combine(), small ones are hashed by the calling thread.
+u4 checksum_adler32Range(checksum_rangeFn, const void *, size_t, size_t);
+
+// Adler32 of a contiguous buffer
+u4 checksum_adler32(const u1 *, size_t);
+
+#endif
@@ -124,6 +124,7 @@ typedef struct {
   char *inputFile;
   char **files;
   size_t fileCnt;
+  bool recursive;
 } infiles_t;
 
 typedef struct {
@@ -133,6 +134,14 @@ typedef struct {
   bool enableDisassembler;
   bool dumpDeps;
   char *newCrcFile;
+  bool splitDex;
+  char *inputDir;
+  bool patchList;
+  bool digests;
+  bool repairSignature;
+  char *classQuery;
+  char *methodQuery;  // Name of a method of the queried class, with its signature below
+  char *methodSignature;
 } runArgs_t;
 
 extern void exitWrapper(int);
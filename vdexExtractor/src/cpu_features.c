@@ -0,0 +1,51 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "cpu_features.h"
+
+static bool cpu_ssse3;
+static bool cpu_sse42;
+static bool cpu_avx2;
+static bool cpu_pclmul;
+static bool cpu_sha;
+
+__attribute__((constructor)) void cpu_init(void) {
+#if VDEX_HAVE_X86_SIMD
+  // Required since constructors may run before the ones of the compiler runtime
+  __builtin_cpu_init();
+  cpu_ssse3 = __builtin_cpu_supports("ssse3");
+  cpu_sse42 = __builtin_cpu_supports("sse4.2");
+  cpu_avx2 = __builtin_cpu_supports("avx2");
+  cpu_pclmul = __builtin_cpu_supports("pclmul");
+  cpu_sha = __builtin_cpu_supports("sha");
+#endif
+}
+
+bool cpu_hasSSSE3(void) { return cpu_ssse3; }
+
+bool cpu_hasSSE42(void) { return cpu_sse42; }
+
+bool cpu_hasAVX2(void) { return cpu_avx2; }
+
+bool cpu_hasPCLMUL(void) { return cpu_pclmul; }
+
+bool cpu_hasSHA(void) { return cpu_sha; }
@@ -0,0 +1,43 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _CPU_FEATURES_H_
+#define _CPU_FEATURES_H_
+
+#include "common.h"
+
+// x86 SIMD kernels are compiled with per function target attributes & selected at runtime, so
+// the binary still runs on CPUs lacking the extensions
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define VDEX_HAVE_X86_SIMD 1
+#else
+#define VDEX_HAVE_X86_SIMD 0
+#endif
+
+// Instruction set extensions of the running CPU, detected once at startup
+bool cpu_hasSSSE3(void);
+bool cpu_hasSSE42(void);
+bool cpu_hasAVX2(void);
+bool cpu_hasPCLMUL(void);
+bool cpu_hasSHA(void);
+
+#endif
@@ -20,16 +20,26 @@
 
 */
 
+#include "arena.h"
+#include "checksum.h"
 #include "dex.h"
 #include "utils.h"
 
+#define kSignatureArenaBlockSz (16 * 1024)
+
 static bool enableDisassembler = false;
 
+// Signatures are only built when disassembling or dumping the verifier dependencies, which happens
+// on the thread owning the Vdex file. A thread caches the proto signatures of a single Dex file.
+static _Thread_local const u1 *sigCacheDexFileBuf;
+static _Thread_local const char **sigCacheProtos;
+static _Thread_local arena_t sigCacheArena;
+
 static inline u2 get2LE(unsigned char const *pSrc) { return pSrc[0] | (pSrc[1] << 8); }
 
 // Helper for dex_dumpInstruction(), which builds the string representation
 // for the index in the given instruction.
-static char *indexString(const u1 *dexFileBuf, u2 *codePtr, u4 bufSize) {
+static char *indexString(const u1 *dexFileBuf, const dexIrInsn *pInsn, u4 bufSize) {
   char *buf = utils_calloc(bufSize);
 
   const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
@@ -39,7 +49,7 @@ static char *indexString(const u1 *dexFileBuf, u2 *codePtr, u4 bufSize) {
   u4 index = 0;
   u4 secondary_index = kInvalidIndex;
   u4 width = 4;
-  switch (kInstructionDescriptors[dexInstr_getOpcode(codePtr)].format) {
+  switch (pInsn->format) {
     // SOME NOT SUPPORTED:
     // case k20bc:
     case k21c:
@@ -49,22 +59,22 @@ static char *indexString(const u1 *dexFileBuf, u2 *codePtr, u4 bufSize) {
       // case k3rms:
       // case k35mi:
       // case k3rmi:
-      index = dexInstr_getVRegB(codePtr);
+      index = pInsn->index;
       width = 4;
       break;
     case k31c:
-      index = dexInstr_getVRegB(codePtr);
+      index = pInsn->index;
       width = 8;
       break;
     case k22c:
       // case k22cs:
-      index = dexInstr_getVRegC(codePtr);
+      index = pInsn->index;
       width = 4;
       break;
     case k45cc:
     case k4rcc:
-      index = dexInstr_getVRegB(codePtr);
-      secondary_index = dexInstr_getVRegH(codePtr);
+      index = pInsn->index;
+      secondary_index = pInsn->vH;
       width = 4;
       break;
     default:
@@ -73,7 +83,7 @@ static char *indexString(const u1 *dexFileBuf, u2 *codePtr, u4 bufSize) {
 
   // Determine index type.
   size_t outSize = 0;
-  switch (kInstructionDescriptors[dexInstr_getOpcode(codePtr)].index_type) {
+  switch (kInstructionDescriptors[pInsn->opcode].index_type) {
     case kIndexUnknown:
       // This function should never get called for this type, but do
       // something sensible here, just to help with debugging.
@@ -108,7 +118,6 @@ static char *indexString(const u1 *dexFileBuf, u2 *codePtr, u4 bufSize) {
         const char *backDescriptor = dex_getStringByTypeIdx(dexFileBuf, pDexMethodId->classIdx);
         outSize = snprintf(buf, bufSize, "%s.%s:%s // method@%0*x", backDescriptor, name, signature,
                            width, index);
-        free((void *)signature);
       } else {
         outSize = snprintf(buf, bufSize, "<method?> // method@%0*x", width, index);
       }
@@ -132,40 +141,23 @@ static char *indexString(const u1 *dexFileBuf, u2 *codePtr, u4 bufSize) {
       outSize = snprintf(buf, bufSize, "[obj+%0*x]", width, index);
       break;
     case kIndexMethodAndProtoRef: {
-      const char *kDefaultMethodStr = "<method?>";
-      const char *kDefaultProtoStr = "<proto?>";
-      const char *methodStr = utils_calloc(32);
-      const char *protoStr = utils_calloc(32);
-      strncpy((void *)methodStr, kDefaultMethodStr, strlen(kDefaultMethodStr));
-      strncpy((void *)protoStr, kDefaultProtoStr, strlen(kDefaultProtoStr));
+      const char *protoStr = "<proto?>";
+      if (secondary_index < pDexHeader->protoIdsSize) {
+        protoStr = dex_getProtoSignature(dexFileBuf, secondary_index);
+      }
 
       if (index < pDexHeader->methodIdsSize) {
         const dexMethodId *pDexMethodId = dex_getMethodId(dexFileBuf, index);
         const char *name = dex_getStringDataByIdx(dexFileBuf, pDexMethodId->nameIdx);
         const char *signature = dex_getMethodSignature(dexFileBuf, pDexMethodId);
         const char *backDescriptor = dex_getStringByTypeIdx(dexFileBuf, pDexMethodId->classIdx);
-
-        // Free the default and allocate a new one
-        free((void *)methodStr);
-        size_t newMethodStrSz = strlen(backDescriptor) + strlen(name) + strlen(signature) + 3;
-        methodStr = utils_calloc(newMethodStrSz);
-        snprintf((char *)methodStr, newMethodStrSz, "%s.%s:%s", backDescriptor, name, signature);
-
-        // Clean-up intermediates
-        free((void *)signature);
-      }
-      if (secondary_index < pDexHeader->protoIdsSize) {
-        const dexProtoId *pDexProtoId = dex_getProtoId(dexFileBuf, secondary_index);
-
-        // Free the default since a new one is allocated
-        free((void *)protoStr);
-        protoStr = dex_getProtoSignature(dexFileBuf, pDexProtoId);
+        outSize = snprintf(buf, bufSize, "%s.%s:%s, %s // method@%0*x, proto@%0*x",
+                           backDescriptor, name, signature, protoStr, width, index, width,
+                           secondary_index);
+      } else {
+        outSize = snprintf(buf, bufSize, "<method?>, %s // method@%0*x, proto@%0*x", protoStr,
+                           width, index, width, secondary_index);
       }
-
-      outSize = snprintf(buf, bufSize, "%s, %s // method@%0*x, proto@%0*x", methodStr, protoStr,
-                         width, index, width, secondary_index);
-      free((void *)methodStr);
-      free((void *)protoStr);
       break;
     }
     case kIndexCallSiteRef:
@@ -185,7 +177,7 @@ static char *indexString(const u1 *dexFileBuf, u2 *codePtr, u4 bufSize) {
     // The buffer wasn't big enough, try with new size + null termination
     free(buf);
     size_t newBufSz = outSize + 1;
-    return indexString(dexFileBuf, codePtr, newBufSz);
+    return indexString(dexFileBuf, pInsn, newBufSz);
   }
   return buf;
 }
@@ -378,11 +370,9 @@ void dex_dumpHeaderInfo(const dexHeader *pDexHeader) {
 }
 
 u4 dex_computeDexCRC(const u1 *buf, off_t fileSz) {
-  u4 adler_checksum = adler32(0L, Z_NULL, 0);
   const u1 non_sum = sizeof(dexMagic) + sizeof(u4);
   const u1 *non_sum_ptr = buf + non_sum;
-  adler_checksum = adler32(adler_checksum, non_sum_ptr, fileSz - non_sum);
-  return adler_checksum;
+  return checksum_adler32(non_sum_ptr, fileSz - non_sum);
 }
 
 void dex_repairDexCRC(const u1 *buf, off_t fileSz) {
@@ -390,6 +380,54 @@ void dex_repairDexCRC(const u1 *buf, off_t fileSz) {
   memcpy((void *)buf + sizeof(dexMagic), &adler_checksum, sizeof(u4));
 }
 
+// Signature covers everything past the signature field itself
+#define kDexSignedOff (sizeof(dexMagic) + sizeof(u4) + kSHA1Len)
+
+void dex_computeStreamDigests(const u1 *buf,
+                              size_t fileSz,
+                              dex_streamFn streamFn,
+                              const void *arg,
+                              bool repairSignature,
+                              dexDigests *pDigests) {
+  const dexHeader *pDexHeader = (const dexHeader *)buf;
+  size_t signedSz = fileSz - kDexSignedOff;
+  checksum_multi_t multi;
+  checksum_multiInit(&multi);
+  streamFn(arg, kDexSignedOff, signedSz, &multi);
+
+  checksum_multiFinal(&multi, pDigests->signature);
+  pDigests->signatureMatch = memcmp(pDigests->signature, pDexHeader->signature, kSHA1Len) == 0;
+  if (!repairSignature) {
+    memcpy(pDigests->signature, pDexHeader->signature, kSHA1Len);
+  }
+
+  // Checksum starts at the signature & CRC32 at the magic, so both are completed by combining the
+  // digests of the final header fields with the ones of the signed range
+  u4 sigAdler = adler32(adler32(0L, Z_NULL, 0), pDigests->signature, kSHA1Len);
+  pDigests->checksum = adler32_combine(sigAdler, multi.adler, (z_off_t)signedSz);
+
+  u1 header[kDexSignedOff];
+  memcpy(header, &pDexHeader->magic, sizeof(dexMagic));
+  memcpy(header + sizeof(dexMagic), &pDigests->checksum, sizeof(u4));
+  memcpy(header + sizeof(dexMagic) + sizeof(u4), pDigests->signature, kSHA1Len);
+  u4 headerCrc = checksum_crc32Update(crc32(0L, Z_NULL, 0), header, sizeof(header));
+  pDigests->crc32 = crc32_combine(headerCrc, multi.crc, (z_off_t)signedSz);
+}
+
+static void bufferStream(const void *arg, size_t off, size_t len, checksum_multi_t *pMulti) {
+  checksum_multiUpdate(pMulti, (const u1 *)arg + off, len);
+}
+
+void dex_computeDigests(const u1 *buf, size_t fileSz, bool repairSignature, dexDigests *pDigests) {
+  dex_computeStreamDigests(buf, fileSz, bufferStream, buf, repairSignature, pDigests);
+}
+
+void dex_repairDigests(const u1 *buf, const dexDigests *pDigests) {
+  dexHeader *pDexHeader = (dexHeader *)buf;
+  memcpy(&pDexHeader->checksum, &pDigests->checksum, sizeof(u4));
+  memcpy(pDexHeader->signature, pDigests->signature, kSHA1Len);
+}
+
 u4 dex_getFirstInstrOff(const dexMethod *pDexMethod) {
   // The first instruction is the last member of the dexCode struct
   return pDexMethod->codeOff + sizeof(dexCode) - sizeof(u2);
@@ -474,110 +512,61 @@ void dex_readClassDataMethod(const u1 **cursor, dexMethod *pDexMethod) {
   pDexMethod->codeOff = dex_readULeb128(cursor);
 }
 
-// Returns the StringId at the specified index.
-const dexStringId *dex_getStringId(const u1 *dexFileBuf, u2 idx) {
-  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
-  CHECK_LT(idx, pDexHeader->stringIdsSize);
-  dexStringId *dexStringIds = (dexStringId *)(dexFileBuf + pDexHeader->stringIdsOff);
-  return &dexStringIds[idx];
-}
-
-// Returns the dexTypeId at the specified index.
-const dexTypeId *dex_getTypeId(const u1 *dexFileBuf, u2 idx) {
-  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
-  CHECK_LT(idx, pDexHeader->typeIdsSize);
-  dexTypeId *dexTypeIds = (dexTypeId *)(dexFileBuf + pDexHeader->typeIdsOff);
-  return &dexTypeIds[idx];
-}
-
-// Returns the dexProtoId at the specified index.
-const dexProtoId *dex_getProtoId(const u1 *dexFileBuf, u2 idx) {
-  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
-  CHECK_LT(idx, pDexHeader->protoIdsSize);
-  dexProtoId *dexProtoIds = (dexProtoId *)(dexFileBuf + pDexHeader->protoIdsOff);
-  return &dexProtoIds[idx];
-}
-
-// Returns the dexFieldId at the specified index.
-const dexFieldId *dex_getFieldId(const u1 *dexFileBuf, u4 idx) {
-  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
-  CHECK_LT(idx, pDexHeader->fieldIdsSize);
-  dexFieldId *dexFieldIds = (dexFieldId *)(dexFileBuf + pDexHeader->fieldIdsOff);
-  return &dexFieldIds[idx];
-}
-
-// Returns the MethodId at the specified index.
-const dexMethodId *dex_getMethodId(const u1 *dexFileBuf, u4 idx) {
-  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
-  CHECK_LT(idx, pDexHeader->methodIdsSize);
-  dexMethodId *dexMethodIds = (dexMethodId *)(dexFileBuf + pDexHeader->methodIdsOff);
-  return &dexMethodIds[idx];
-}
-
-// Returns the ClassDef at the specified index.
-const dexClassDef *dex_getClassDef(const u1 *dexFileBuf, u2 idx) {
-  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
-  CHECK_LT(idx, pDexHeader->classDefsSize);
-  dexClassDef *dexClassDefs = (dexClassDef *)(dexFileBuf + pDexHeader->classDefsOff);
-  return &dexClassDefs[idx];
-}
-
-const char *dex_getStringDataAndUtf16Length(const u1 *dexFileBuf,
-                                            const dexStringId *pDexStringId,
-                                            u4 *utf16_length) {
-  CHECK(utf16_length != NULL);
-  const u1 *ptr = (u1 *)(dexFileBuf + pDexStringId->stringDataOff);
-  *utf16_length = dex_readULeb128(&ptr);
-  return (const char *)ptr;
-}
-
-const char *dex_getStringDataAndUtf16LengthByIdx(const u1 *dexFileBuf, u2 idx, u4 *utf16_length) {
-  const dexStringId *pDexStringId = dex_getStringId(dexFileBuf, idx);
-  return dex_getStringDataAndUtf16Length(dexFileBuf, pDexStringId, utf16_length);
-}
-
-const char *dex_getStringDataByIdx(const u1 *dexFileBuf, u2 idx) {
-  u4 unicode_length;
-  return dex_getStringDataAndUtf16LengthByIdx(dexFileBuf, idx, &unicode_length);
-}
-
-const char *dex_getStringByTypeIdx(const u1 *dexFileBuf, u2 idx) {
-  const dexTypeId *type_id = dex_getTypeId(dexFileBuf, idx);
-  return dex_getStringDataByIdx(dexFileBuf, type_id->descriptorIdx);
-}
-
 const char *dex_getMethodSignature(const u1 *dexFileBuf, const dexMethodId *pDexMethodId) {
-  return dex_getProtoSignature(dexFileBuf, dex_getProtoId(dexFileBuf, pDexMethodId->protoIdx));
+  return dex_getProtoSignature(dexFileBuf, pDexMethodId->protoIdx);
 }
 
-const char *dex_getProtoSignature(const u1 *dexFileBuf, const dexProtoId *pDexProtoId) {
-  const char *retSigStr = NULL;
-  size_t retSigStrSz = 0;
-  size_t retSigStrOff = 0;
+const char *dex_getProtoSignature(const u1 *dexFileBuf, u4 protoIdx) {
+  if (sigCacheDexFileBuf != dexFileBuf) {
+    if (sigCacheDexFileBuf == NULL) {
+      arena_init(&sigCacheArena, kSignatureArenaBlockSz);
+    } else {
+      arena_reset(&sigCacheArena);
+    }
+    u4 protoIdsSize = ((const dexHeader *)dexFileBuf)->protoIdsSize;
+    sigCacheProtos = arena_alloc(&sigCacheArena, protoIdsSize * sizeof(const char *));
+    memset(sigCacheProtos, 0, protoIdsSize * sizeof(const char *));
+    sigCacheDexFileBuf = dexFileBuf;
+  }
 
-  if (pDexProtoId == NULL) {
-    const char *kDefaultNoSigStr = "<no signature>";
-    retSigStr = utils_calloc(strlen(kDefaultNoSigStr) + 1);
-    strncpy((char *)retSigStr, kDefaultNoSigStr, strlen(kDefaultNoSigStr));
-    return retSigStr;
+  const char *sig = sigCacheProtos[protoIdx];
+  if (sig != NULL) {
+    return sig;
   }
 
+  // Measure the signature first, so that it is copied once in an exactly sized arena slot
+  const dexProtoId *pDexProtoId = dex_getProtoIdUnchecked(dexFileBuf, protoIdx);
   const dexTypeList *pDexTypeList = dex_getProtoParameters(dexFileBuf, pDexProtoId);
-  if (pDexTypeList == NULL) {
-    utils_pseudoStrAppend(&retSigStr, &retSigStrSz, &retSigStrOff, "()");
-  } else {
-    utils_pseudoStrAppend(&retSigStr, &retSigStrSz, &retSigStrOff, "(");
-    for (u4 i = 0; i < pDexTypeList->size; ++i) {
-      const char *paramStr = dex_getStringByTypeIdx(dexFileBuf, pDexTypeList->list[i].typeIdx);
-      utils_pseudoStrAppend(&retSigStr, &retSigStrSz, &retSigStrOff, paramStr);
-    }
-    utils_pseudoStrAppend(&retSigStr, &retSigStrSz, &retSigStrOff, ")");
+  u4 paramsSize = pDexTypeList ? pDexTypeList->size : 0;
+  const char *retTypeStr = dex_getTypeDescriptorUnchecked(dexFileBuf, pDexProtoId->returnTypeIdx);
+  size_t retTypeLen = strlen(retTypeStr);
+  size_t sigLen = retTypeLen + 2;
+  for (u4 i = 0; i < paramsSize; ++i) {
+    sigLen += strlen(dex_getTypeDescriptorUnchecked(dexFileBuf, pDexTypeList->list[i].typeIdx));
+  }
+
+  char *pSig = arena_alloc(&sigCacheArena, sigLen + 1);
+  char *pCur = pSig;
+  *pCur++ = '(';
+  for (u4 i = 0; i < paramsSize; ++i) {
+    const char *paramStr =
+        dex_getTypeDescriptorUnchecked(dexFileBuf, pDexTypeList->list[i].typeIdx);
+    size_t paramLen = strlen(paramStr);
+    memcpy(pCur, paramStr, paramLen);
+    pCur += paramLen;
   }
+  *pCur++ = ')';
+  memcpy(pCur, retTypeStr, retTypeLen + 1);
 
-  const char *retTypeStr = dex_getStringByTypeIdx(dexFileBuf, pDexProtoId->returnTypeIdx);
-  utils_pseudoStrAppend(&retSigStr, &retSigStrSz, &retSigStrOff, retTypeStr);
+  sigCacheProtos[protoIdx] = pSig;
+  return pSig;
+}
 
-  return retSigStr;
+void dex_releaseSignatureCache(void) {
+  if (sigCacheDexFileBuf == NULL) return;
+  arena_destroy(&sigCacheArena);
+  sigCacheDexFileBuf = NULL;
+  sigCacheProtos = NULL;
 }
 
 const dexTypeList *dex_getProtoParameters(const u1 *dexFileBuf, const dexProtoId *pDexProtoId) {
@@ -591,41 +580,41 @@ const dexTypeList *dex_getProtoParameters(const u1 *dexFileBuf, const dexProtoId
 
 const char *dex_getFieldDeclaringClassDescriptor(const u1 *dexFileBuf,
                                                  const dexFieldId *pDexFieldId) {
-  const dexTypeId *pDexTypeId = dex_getTypeId(dexFileBuf, pDexFieldId->classIdx);
-  return dex_getTypeDescriptor(dexFileBuf, pDexTypeId);
+  return dex_getTypeDescriptorUnchecked(dexFileBuf, pDexFieldId->classIdx);
 }
 
 const char *dex_getTypeDescriptor(const u1 *dexFileBuf, const dexTypeId *pDexTypeId) {
-  return dex_getStringDataByIdx(dexFileBuf, pDexTypeId->descriptorIdx);
+  return dex_getStringDataUnchecked(dexFileBuf, pDexTypeId->descriptorIdx);
 }
 
 const char *dex_getFieldName(const u1 *dexFileBuf, const dexFieldId *pDexField) {
-  return dex_getStringDataByIdx(dexFileBuf, pDexField->nameIdx);
+  return dex_getStringDataUnchecked(dexFileBuf, pDexField->nameIdx);
 }
 
 const char *dex_getFieldTypeDescriptor(const u1 *dexFileBuf, const dexFieldId *pDexFieldId) {
-  const dexTypeId *pDexTypeId = dex_getTypeId(dexFileBuf, pDexFieldId->typeIdx);
-  return dex_getTypeDescriptor(dexFileBuf, pDexTypeId);
+  return dex_getTypeDescriptorUnchecked(dexFileBuf, pDexFieldId->typeIdx);
 }
 
 const char *dex_getMethodDeclaringClassDescriptor(const u1 *dexFileBuf,
                                                   const dexMethodId *pDexMethodId) {
-  const dexTypeId *pDexTypeId = dex_getTypeId(dexFileBuf, pDexMethodId->classIdx);
-  return dex_getTypeDescriptor(dexFileBuf, pDexTypeId);
+  return dex_getTypeDescriptorUnchecked(dexFileBuf, pDexMethodId->classIdx);
 }
 
 const char *dex_getMethodName(const u1 *dexFileBuf, const dexMethodId *pDexMethodId) {
-  return dex_getStringDataByIdx(dexFileBuf, pDexMethodId->nameIdx);
+  return dex_getStringDataUnchecked(dexFileBuf, pDexMethodId->nameIdx);
 }
 
 void dex_dumpClassInfo(const u1 *dexFileBuf, u4 idx) {
-  const dexClassDef *pDexClassDef = dex_getClassDef(dexFileBuf, idx);
-  const char *classDescriptor = dex_getStringByTypeIdx(dexFileBuf, pDexClassDef->classIdx);
+  // Save time if no disassemble
+  if (enableDisassembler == false) return;
+
+  const dexClassDef *pDexClassDef = dex_getClassDefUnchecked(dexFileBuf, idx);
+  const char *classDescriptor = dex_getTypeDescriptorUnchecked(dexFileBuf, pDexClassDef->classIdx);
   const char *classDescriptorFormated = dex_descriptorClassToDot(classDescriptor);
   const char *classAccessStr = createAccessFlagStr(pDexClassDef->accessFlags, kDexAccessForClass);
   const char *srcFileName = "null";
-  if (pDexClassDef->sourceFileIdx < USHRT_MAX) {
-    srcFileName = dex_getStringDataByIdx(dexFileBuf, pDexClassDef->sourceFileIdx);
+  if (pDexClassDef->sourceFileIdx != kDexNoIndex) {
+    srcFileName = dex_getStringDataUnchecked(dexFileBuf, pDexClassDef->sourceFileIdx);
   }
 
   log_dis("  class #%" PRIu32 ": %s ('%s')\n", idx, classDescriptorFormated, classDescriptor);
@@ -652,9 +641,13 @@ void dex_dumpMethodInfo(const u1 *dexFileBuf,
                         dexMethod *pDexMethod,
                         u4 localIdx,
                         const char *type) {
+  // Save time if no disassemble
+  if (enableDisassembler == false) return;
+
+  // The dumped index is not the accumulated method id, thus not covered by the Dex validation
   const dexMethodId *pDexMethodId = dex_getMethodId(dexFileBuf, localIdx + pDexMethod->methodIdx);
 
-  const char *methodName = dex_getStringDataByIdx(dexFileBuf, pDexMethodId->nameIdx);
+  const char *methodName = dex_getStringDataUnchecked(dexFileBuf, pDexMethodId->nameIdx);
   const char *typeDesc = dex_getMethodSignature(dexFileBuf, pDexMethodId);
   const char *methodAccessStr = createAccessFlagStr(pDexMethod->accessFlags, kDexAccessForMethod);
 
@@ -663,7 +656,6 @@ void dex_dumpMethodInfo(const u1 *dexFileBuf,
   log_dis("    codeOff=%" PRIx32 " (%" PRIu32 ")\n", pDexMethod->codeOff, pDexMethod->codeOff);
 
   free((void *)methodAccessStr);
-  free((void *)typeDesc);
 }
 
 void dex_dumpInstruction(
@@ -671,6 +663,17 @@ void dex_dumpInstruction(
   // Save time if no disassemble
   if (enableDisassembler == false) return;
 
+  dexIrInsn insn;
+  dexIr_decodeInsn(codePtr, insnIdx, &insn);
+  dex_dumpIrInstruction(dexFileBuf, codePtr, &insn, codeOffset, highlight);
+}
+
+void dex_dumpIrInstruction(
+    const u1 *dexFileBuf, u2 *codePtr, const dexIrInsn *pInsn, u4 codeOffset, bool highlight) {
+  // Save time if no disassemble
+  if (enableDisassembler == false) return;
+  const u4 insnIdx = pInsn->dexPc;
+
   // Highlight decompile instructions
   if (highlight) {
     log_dis("[new] ");
@@ -680,7 +683,7 @@ void dex_dumpInstruction(
 
   // Address of instruction (expressed as byte offset).
   log_dis("%06x:", codeOffset);
-  u4 insnWidth = dexInstr_SizeInCodeUnits(codePtr);
+  u4 insnWidth = pInsn->width;
 
   // Dump (part of) raw bytes.
   for (u4 i = 0; i < 8; i++) {
@@ -698,7 +701,7 @@ void dex_dumpInstruction(
   }
 
   // Dump pseudo-instruction or opcode.
-  if (dexInstr_getOpcode(codePtr) == NOP) {
+  if (pInsn->opcode == NOP) {
     const u2 instr = get2LE((const u1 *)codePtr);
     if (instr == kPackedSwitchSignature) {
       log_dis("|%04x: packed-switch-data (%d units)", insnIdx, insnWidth);
@@ -710,90 +713,90 @@ void dex_dumpInstruction(
       log_dis("|%04x: nop // spacer", insnIdx);
     }
   } else {
-    log_dis("|%04x: %s", insnIdx, dexInst_getOpcodeStr(codePtr));
+    log_dis("|%04x: %s", insnIdx, kInstructionNames[pInsn->opcode]);
   }
 
   // Set up additional argument.
   char *indexBuf = NULL;
-  if (kInstructionDescriptors[dexInstr_getOpcode(codePtr)].index_type != kIndexNone) {
+  if (kInstructionClasses[pInsn->opcode] & kClassIndexed) {
     const size_t kDefaultIndexStrLen = 256;
-    indexBuf = indexString(dexFileBuf, codePtr, kDefaultIndexStrLen);
+    indexBuf = indexString(dexFileBuf, pInsn, kDefaultIndexStrLen);
   }
 
   // Dump the instruction.
-  switch (kInstructionDescriptors[dexInstr_getOpcode(codePtr)].format) {
+  switch (pInsn->format) {
     case k10x:  // op
       break;
     case k12x:  // op vA, vB
-      log_dis(" v%d, v%d", dexInstr_getVRegA(codePtr), dexInstr_getVRegB(codePtr));
+      log_dis(" v%d, v%d", pInsn->vA, pInsn->vB);
       break;
     case k11n:  // op vA, #+B
-      log_dis(" v%d, #int %d // #%x", dexInstr_getVRegA(codePtr), (s4)dexInstr_getVRegB(codePtr),
-              (u1)dexInstr_getVRegB(codePtr));
+      log_dis(" v%d, #int %d // #%x", pInsn->vA, (s4)pInsn->vB,
+              (u1)pInsn->vB);
       break;
     case k11x:  // op vAA
-      log_dis(" v%d", dexInstr_getVRegA(codePtr));
+      log_dis(" v%d", pInsn->vA);
       break;
     case k10t:    // op +AA
     case k20t: {  // op +AAAA
-      const s4 targ = (s4)dexInstr_getVRegA(codePtr);
+      const s4 targ = (s4)pInsn->vA;
       log_dis(" %04x // %c%04x", insnIdx + targ, (targ < 0) ? '-' : '+', (targ < 0) ? -targ : targ);
       break;
     }
     case k22x:  // op vAA, vBBBB
-      log_dis(" v%d, v%d", dexInstr_getVRegA(codePtr), dexInstr_getVRegB(codePtr));
+      log_dis(" v%d, v%d", pInsn->vA, pInsn->vB);
       break;
     case k21t: {  // op vAA, +BBBB
-      const s4 targ = (s4)dexInstr_getVRegB(codePtr);
-      log_dis(" v%d, %04x // %c%04x", dexInstr_getVRegA(codePtr), insnIdx + targ,
+      const s4 targ = (s4)pInsn->vB;
+      log_dis(" v%d, %04x // %c%04x", pInsn->vA, insnIdx + targ,
               (targ < 0) ? '-' : '+', (targ < 0) ? -targ : targ);
       break;
     }
     case k21s:  // op vAA, #+BBBB
-      log_dis(" v%d, #int %d // #%x", dexInstr_getVRegA(codePtr), (s4)dexInstr_getVRegB(codePtr),
-              (u2)dexInstr_getVRegB(codePtr));
+      log_dis(" v%d, #int %d // #%x", pInsn->vA, (s4)pInsn->vB,
+              (u2)pInsn->vB);
       break;
     case k21h:  // op vAA, #+BBBB0000[00000000]
       // The printed format varies a bit based on the actual opcode.
-      if (dexInstr_getOpcode(codePtr) == CONST_HIGH16) {
-        const s4 value = dexInstr_getVRegB(codePtr) << 16;
-        log_dis(" v%d, #int %d // #%x", dexInstr_getVRegA(codePtr), value,
-                (u2)dexInstr_getVRegB(codePtr));
+      if (pInsn->opcode == CONST_HIGH16) {
+        const s4 value = pInsn->vB << 16;
+        log_dis(" v%d, #int %d // #%x", pInsn->vA, value,
+                (u2)pInsn->vB);
       } else {
-        const s8 value = ((s8)dexInstr_getVRegB(codePtr)) << 48;
-        log_dis(" v%d, #long %" PRId64 " // #%x", dexInstr_getVRegA(codePtr), value,
-                (u2)dexInstr_getVRegB(codePtr));
+        const s8 value = ((s8)pInsn->vB) << 48;
+        log_dis(" v%d, #long %" PRId64 " // #%x", pInsn->vA, value,
+                (u2)pInsn->vB);
       }
       break;
     case k21c:  // op vAA, thing@BBBB
     case k31c:  // op vAA, thing@BBBBBBBB
-      log_dis(" v%d, %s", dexInstr_getVRegA(codePtr), indexBuf);
+      log_dis(" v%d, %s", pInsn->vA, indexBuf);
       break;
     case k23x:  // op vAA, vBB, vCC
-      log_dis(" v%d, v%d, v%d", dexInstr_getVRegA(codePtr), dexInstr_getVRegB(codePtr),
-              dexInstr_getVRegC(codePtr));
+      log_dis(" v%d, v%d, v%d", pInsn->vA, pInsn->vB,
+              pInsn->vC);
       break;
     case k22b:  // op vAA, vBB, #+CC
-      log_dis(" v%d, v%d, #int %d // #%02x", dexInstr_getVRegA(codePtr), dexInstr_getVRegB(codePtr),
-              (s4)dexInstr_getVRegC(codePtr), (u1)dexInstr_getVRegC(codePtr));
+      log_dis(" v%d, v%d, #int %d // #%02x", pInsn->vA, pInsn->vB,
+              (s4)pInsn->vC, (u1)pInsn->vC);
       break;
     case k22t: {  // op vA, vB, +CCCC
-      const s4 targ = (s4)dexInstr_getVRegC(codePtr);
-      log_dis(" v%d, v%d, %04x // %c%04x", dexInstr_getVRegA(codePtr), dexInstr_getVRegB(codePtr),
+      const s4 targ = (s4)pInsn->vC;
+      log_dis(" v%d, v%d, %04x // %c%04x", pInsn->vA, pInsn->vB,
               insnIdx + targ, (targ < 0) ? '-' : '+', (targ < 0) ? -targ : targ);
       break;
     }
     case k22s:  // op vA, vB, #+CCCC
-      log_dis(" v%d, v%d, #int %d // #%04x", dexInstr_getVRegA(codePtr), dexInstr_getVRegB(codePtr),
-              (s4)dexInstr_getVRegC(codePtr), (u2)dexInstr_getVRegC(codePtr));
+      log_dis(" v%d, v%d, #int %d // #%04x", pInsn->vA, pInsn->vB,
+              (s4)pInsn->vC, (u2)pInsn->vC);
       break;
     case k22c:  // op vA, vB, thing@CCCC
                 // NOT SUPPORTED:
                 // case k22cs:    // [opt] op vA, vB, field offset CCCC
-      log_dis(" v%d, v%d, %s", dexInstr_getVRegA(codePtr), dexInstr_getVRegB(codePtr), indexBuf);
+      log_dis(" v%d, v%d, %s", pInsn->vA, pInsn->vB, indexBuf);
       break;
     case k30t:
-      log_dis(" #%08x", dexInstr_getVRegA(codePtr));
+      log_dis(" #%08x", pInsn->vA);
       break;
     case k31i: {  // op vAA, #+BBBBBBBB
       // This is often, but not always, a float.
@@ -801,27 +804,26 @@ void dex_dumpInstruction(
         float f;
         u4 i;
       } conv;
-      conv.i = dexInstr_getVRegB(codePtr);
-      log_dis(" v%d, #float %g // #%08x", dexInstr_getVRegA(codePtr), conv.f,
-              dexInstr_getVRegB(codePtr));
+      conv.i = pInsn->vB;
+      log_dis(" v%d, #float %g // #%08x", pInsn->vA, conv.f,
+              pInsn->vB);
       break;
     }
     case k31t:  // op vAA, offset +BBBBBBBB
-      log_dis(" v%d, %08x // +%08x", dexInstr_getVRegA(codePtr),
-              insnIdx + dexInstr_getVRegB(codePtr), dexInstr_getVRegA(codePtr));
+      log_dis(" v%d, %08x // +%08x", pInsn->vA,
+              insnIdx + pInsn->vB, pInsn->vA);
       break;
     case k32x:  // op vAAAA, vBBBB
-      log_dis(" v%d, v%d", dexInstr_getVRegA(codePtr), dexInstr_getVRegB(codePtr));
+      log_dis(" v%d, v%d", pInsn->vA, pInsn->vB);
       break;
     case k35c:     // op {vC, vD, vE, vF, vG}, thing@BBBB
     case k45cc: {  // op {vC, vD, vE, vF, vG}, method@BBBB, proto@HHHH
                    // NOT SUPPORTED:
                    // case k35ms:       // [opt] invoke-virtual+super
                    // case k35mi:       // [opt] inline invoke
-      u4 arg[kMaxVarArgRegs];
-      dexInstr_getVarArgs(codePtr, arg);
+      const u4 *arg = pInsn->args;
       log_dis(" {");
-      for (int i = 0, n = dexInstr_getVRegA(codePtr); i < n; i++) {
+      for (int i = 0, n = pInsn->vA; i < n; i++) {
         if (i == 0) {
           log_dis("v%d", arg[i]);
         } else {
@@ -839,11 +841,11 @@ void dex_dumpInstruction(
       // This doesn't match the "dx" output when some of the args are
       // 64-bit values -- dx only shows the first register.
       log_dis(" {");
-      for (int i = 0, n = dexInstr_getVRegA(codePtr); i < n; i++) {
+      for (int i = 0, n = pInsn->vA; i < n; i++) {
         if (i == 0) {
-          log_dis("v%d", dexInstr_getVRegC(codePtr) + i);
+          log_dis("v%d", pInsn->vC + i);
         } else {
-          log_dis(", v%d", dexInstr_getVRegC(codePtr) + i);
+          log_dis(", v%d", pInsn->vC + i);
         }
       }  // for
       log_dis("}, %s", indexBuf);
@@ -854,9 +856,9 @@ void dex_dumpInstruction(
         double d;
         u8 j;
       } conv;
-      conv.j = dexInstr_getWideVRegB(codePtr);
-      log_dis(" v%d, #double %g // #%016" PRIx64, dexInstr_getVRegA(codePtr), conv.d,
-              dexInstr_getWideVRegB(codePtr));
+      conv.j = pInsn->wideB;
+      log_dis(" v%d, #double %g // #%016" PRIx64, pInsn->vA, conv.d,
+              pInsn->wideB);
       break;
     }
     // NOT SUPPORTED:
@@ -24,8 +24,10 @@
 #define _DEX_H_
 
 #include <zlib.h>
+#include "checksum.h"
 #include "common.h"
 #include "dex_instruction.h"
+#include "dex_ir.h"
 
 #define kNumDexVersions 4
 #define kDexVersionLen 4
@@ -77,6 +79,9 @@ typedef struct __attribute__((packed)) {
   u4 dataOff;
 } dexHeader;
 
+// Marks an absent 32-bit index (e.g. class def source file or superclass)
+#define kDexNoIndex 0xffffffff
+
 typedef struct __attribute__((packed)) { u4 stringDataOff; } dexStringId;
 
 typedef struct __attribute__((packed)) { u4 descriptorIdx; } dexTypeId;
@@ -199,6 +204,29 @@ u4 dex_computeDexCRC(const u1 *, off_t);
 // Repair Dex file CRC
 void dex_repairDexCRC(const u1 *, off_t);
 
+// Digests of a Dex file as written out
+typedef struct {
+  u4 checksum;             // Adler32 header checksum
+  u1 signature[kSHA1Len];  // Header signature, recomputed if repaired
+  u4 crc32;                // CRC32 of the whole file, as stored in zip entries
+  bool signatureMatch;     // Computed SHA-1 equals the header signature
+} dexDigests;
+
+// Feeds a range (offset & length) of a Dex file, as it reads with any pending modifications, to a
+// fused digest state
+typedef void (*dex_streamFn)(const void *, size_t, size_t, checksum_multi_t *);
+
+// Computes the Adler32 checksum, SHA-1 signature & CRC32 of a Dex file in one pass over the bytes
+// past the header signature. The header fields are folded in afterwards, using the computed
+// checksum & the computed signature if repairing it (else the one in the header).
+void dex_computeStreamDigests(const u1 *, size_t, dex_streamFn, const void *, bool, dexDigests *);
+
+// Same as above for a Dex file in a contiguous buffer
+void dex_computeDigests(const u1 *, size_t, bool, dexDigests *);
+
+// Stores the checksum & signature of the digests in the Dex header
+void dex_repairDigests(const u1 *, const dexDigests *);
+
 // Reads an unsigned LEB128 (Little-Endian Base 128) value, updating the
 // given pointer to point just past the end of the read value. This function
 // tolerates non-zero high-order bits in the fifth encoded byte.
@@ -221,21 +249,120 @@ void dex_readClassDataField(const u1 **, dexField *);
 // Read a Leb128 class data method item
 void dex_readClassDataMethod(const u1 **, dexMethod *);
 
-// Methods to access Dex file primitive types
-const dexStringId *dex_getStringId(const u1 *, u2);
-const dexTypeId *dex_getTypeId(const u1 *, u2);
-const dexProtoId *dex_getProtoId(const u1 *, u2);
-const dexFieldId *dex_getFieldId(const u1 *, u4);
-const dexMethodId *dex_getMethodId(const u1 *, u4);
-const dexClassDef *dex_getClassDef(const u1 *, u2);
-
-// Helper methods to extract data from Dex primitive types
-const char *dex_getStringDataAndUtf16Length(const u1 *, const dexStringId *, u4 *);
-const char *dex_getStringDataAndUtf16LengthByIdx(const u1 *, u2, u4 *);
-const char *dex_getStringDataByIdx(const u1 *, u2);
-const char *dex_getStringByTypeIdx(const u1 *, u2);
+// Methods to access Dex file primitive types. Ids are 32-bit wide as string & class def indexes of
+// large Dex files go past 65535. Accessors are inlined, so that section bases are loaded from the
+// header once & kept in registers across the lookups of a caller.
+//
+// Unchecked variants are only for Dex files that passed dexVerify_dexFile() (all Dex files of an
+// opened vdexFile) and ids read out of their validated tables & class data. Ids taken from bytecode
+// operands or Vdex deps go through the checked ones.
+static inline const dexStringId *dex_getStringIdUnchecked(const u1 *dexFileBuf, u4 idx) {
+  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+  return &((const dexStringId *)(dexFileBuf + pDexHeader->stringIdsOff))[idx];
+}
+
+static inline const dexTypeId *dex_getTypeIdUnchecked(const u1 *dexFileBuf, u4 idx) {
+  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+  return &((const dexTypeId *)(dexFileBuf + pDexHeader->typeIdsOff))[idx];
+}
+
+static inline const dexProtoId *dex_getProtoIdUnchecked(const u1 *dexFileBuf, u4 idx) {
+  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+  return &((const dexProtoId *)(dexFileBuf + pDexHeader->protoIdsOff))[idx];
+}
+
+static inline const dexFieldId *dex_getFieldIdUnchecked(const u1 *dexFileBuf, u4 idx) {
+  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+  return &((const dexFieldId *)(dexFileBuf + pDexHeader->fieldIdsOff))[idx];
+}
+
+static inline const dexMethodId *dex_getMethodIdUnchecked(const u1 *dexFileBuf, u4 idx) {
+  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+  return &((const dexMethodId *)(dexFileBuf + pDexHeader->methodIdsOff))[idx];
+}
+
+static inline const dexClassDef *dex_getClassDefUnchecked(const u1 *dexFileBuf, u4 idx) {
+  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+  return &((const dexClassDef *)(dexFileBuf + pDexHeader->classDefsOff))[idx];
+}
+
+static inline const dexStringId *dex_getStringId(const u1 *dexFileBuf, u4 idx) {
+  CHECK_LT(idx, ((const dexHeader *)dexFileBuf)->stringIdsSize);
+  return dex_getStringIdUnchecked(dexFileBuf, idx);
+}
+
+static inline const dexTypeId *dex_getTypeId(const u1 *dexFileBuf, u4 idx) {
+  CHECK_LT(idx, ((const dexHeader *)dexFileBuf)->typeIdsSize);
+  return dex_getTypeIdUnchecked(dexFileBuf, idx);
+}
+
+static inline const dexProtoId *dex_getProtoId(const u1 *dexFileBuf, u4 idx) {
+  CHECK_LT(idx, ((const dexHeader *)dexFileBuf)->protoIdsSize);
+  return dex_getProtoIdUnchecked(dexFileBuf, idx);
+}
+
+static inline const dexFieldId *dex_getFieldId(const u1 *dexFileBuf, u4 idx) {
+  CHECK_LT(idx, ((const dexHeader *)dexFileBuf)->fieldIdsSize);
+  return dex_getFieldIdUnchecked(dexFileBuf, idx);
+}
+
+static inline const dexMethodId *dex_getMethodId(const u1 *dexFileBuf, u4 idx) {
+  CHECK_LT(idx, ((const dexHeader *)dexFileBuf)->methodIdsSize);
+  return dex_getMethodIdUnchecked(dexFileBuf, idx);
+}
+
+static inline const dexClassDef *dex_getClassDef(const u1 *dexFileBuf, u4 idx) {
+  CHECK_LT(idx, ((const dexHeader *)dexFileBuf)->classDefsSize);
+  return dex_getClassDefUnchecked(dexFileBuf, idx);
+}
+
+// Helper methods to extract data from Dex primitive types. String data is prefixed by its UTF-16
+// length, which is a single byte for all but the longest strings.
+static inline const char *dex_getStringDataAndUtf16Length(const u1 *dexFileBuf,
+                                                          const dexStringId *pDexStringId,
+                                                          u4 *utf16_length) {
+  const u1 *ptr = dexFileBuf + pDexStringId->stringDataOff;
+  if (LIKELY(*ptr <= 0x7f)) {
+    *utf16_length = *ptr;
+    return (const char *)(ptr + 1);
+  }
+  *utf16_length = dex_readULeb128(&ptr);
+  return (const char *)ptr;
+}
+
+static inline const char *dex_getStringDataAndUtf16LengthByIdx(const u1 *dexFileBuf,
+                                                               u4 idx,
+                                                               u4 *utf16_length) {
+  return dex_getStringDataAndUtf16Length(dexFileBuf, dex_getStringId(dexFileBuf, idx),
+                                         utf16_length);
+}
+
+static inline const char *dex_getStringDataByIdx(const u1 *dexFileBuf, u4 idx) {
+  u4 utf16_length;
+  return dex_getStringDataAndUtf16LengthByIdx(dexFileBuf, idx, &utf16_length);
+}
+
+static inline const char *dex_getStringByTypeIdx(const u1 *dexFileBuf, u4 idx) {
+  return dex_getStringDataByIdx(dexFileBuf, dex_getTypeId(dexFileBuf, idx)->descriptorIdx);
+}
+
+static inline const char *dex_getStringDataUnchecked(const u1 *dexFileBuf, u4 idx) {
+  u4 utf16_length;
+  return dex_getStringDataAndUtf16Length(dexFileBuf, dex_getStringIdUnchecked(dexFileBuf, idx),
+                                         &utf16_length);
+}
+
+static inline const char *dex_getTypeDescriptorUnchecked(const u1 *dexFileBuf, u4 idx) {
+  const dexTypeId *pDexTypeId = dex_getTypeIdUnchecked(dexFileBuf, idx);
+  return dex_getStringDataUnchecked(dexFileBuf, pDexTypeId->descriptorIdx);
+}
+
+// Proto signatures (e.g. '(ILjava/lang/String;)V') are built once per proto id of the Dex file
+// last queried by the calling thread & cached. The returned strings are borrowed and stay valid
+// until the thread moves to another Dex file or releases the cache.
 const char *dex_getMethodSignature(const u1 *, const dexMethodId *);
-const char *dex_getProtoSignature(const u1 *, const dexProtoId *);
+const char *dex_getProtoSignature(const u1 *, u4);
+void dex_releaseSignatureCache(void);
 const dexTypeList *dex_getProtoParameters(const u1 *, const dexProtoId *);
 const char *dex_getFieldDeclaringClassDescriptor(const u1 *, const dexFieldId *);
 const char *dex_getTypeDescriptor(const u1 *, const dexTypeId *);
@@ -249,6 +376,10 @@ void dex_setDisassemblerStatus(bool);
 bool dex_getDisassemblerStatus(void);
 void dex_dumpInstruction(const u1 *, u2 *, u4, u4, bool);
 
+// Dumps an already decoded instruction. The raw code units are only used for the bytes column
+// & the payload pseudo instructions.
+void dex_dumpIrInstruction(const u1 *, u2 *, const dexIrInsn *, u4, bool);
+
 // Functions to print information of primitive types (mainly used by disassembler)
 void dex_dumpClassInfo(const u1 *, u4);
 void dex_dumpMethodInfo(const u1 *, dexMethod *, u4, const char *);
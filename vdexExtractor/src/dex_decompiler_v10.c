@@ -23,75 +23,40 @@
 #include "dex_decompiler_v10.h"
 #include "utils.h"
 
-static const u1 *quicken_info_ptr;
-static size_t quicken_info_number_of_indices;
-static size_t quicken_index;
-
-static u2 GetData(size_t index) {
-  return quicken_info_ptr[index * 2] | (u2)(quicken_info_ptr[index * 2 + 1] << 8);
+static u2 GetData(dexDecompilerCtx_v10 *ctx, size_t index) {
+  return ctx->quicken_info_ptr[index * 2] | (u2)(ctx->quicken_info_ptr[index * 2 + 1] << 8);
 }
 
 static size_t NumberOfIndices(size_t bytes) { return bytes / sizeof(u2); }
 
-static u2 *code_ptr;
-static u2 *code_end;
-static u4 dex_pc;
-static u4 cur_code_off;
-
-static void initCodeIterator(u2 *pCode, u4 codeSize, u4 startCodeOff) {
-  code_ptr = pCode;
-  code_end = pCode + codeSize;
-  dex_pc = 0;
-  cur_code_off = startCodeOff;
-}
-
-static bool isCodeIteratorDone() { return code_ptr >= code_end; }
-
-static void codeIteratorAdvance() {
-  u4 instruction_size = dexInstr_SizeInCodeUnits(code_ptr);
-  code_ptr += instruction_size;
-  dex_pc += instruction_size;
-  cur_code_off += instruction_size * sizeof(u2);
-}
-
-static u2 NextIndex() {
-  CHECK_LT(quicken_index, quicken_info_number_of_indices);
-  const u2 ret = GetData(quicken_index);
-  quicken_index++;
+static u2 NextIndex(void *arg, u4 dex_pc) {
+  (void)dex_pc;
+  dexDecompilerCtx_v10 *ctx = (dexDecompilerCtx_v10 *)arg;
+  CHECK_LT(ctx->quicken_index, ctx->quicken_info_number_of_indices);
+  const u2 ret = GetData(ctx, ctx->quicken_index);
+  ctx->quicken_index++;
   return ret;
 }
 
-static bool DecompileNop(u2 *insns) {
-  const u2 reference_index = NextIndex();
-  if (reference_index == kDexNoIndex16) {
-    // This means it was a normal nop and not a check-cast.
-    return false;
+static dexUnquickenNop NopIndices(void *arg, u4 dex_pc, u2 *indices) {
+  dexDecompilerCtx_v10 *ctx = (dexDecompilerCtx_v10 *)arg;
+  if (ctx->quicken_info_number_of_indices == 0) {
+    // Only try to decompile NOP if there are more than 0 indices. Not having
+    // any index happens when we unquicken a code item that only has
+    // RETURN_VOID_NO_BARRIER as quickened instruction.
+    return kNopUnresolved;
   }
-  const u2 type_index = NextIndex();
-  dexInstr_SetOpcode(insns, CHECK_CAST);
-  dexInstr_SetVRegA_21c(insns, reference_index);
-  dexInstr_SetVRegB_21c(insns, type_index);
-
-  return true;
-}
-
-static void DecompileInstanceFieldAccess(u2 *insns, Code new_opcode) {
-  u2 index = NextIndex();
-  dexInstr_SetOpcode(insns, new_opcode);
-  dexInstr_SetVRegC_22c(insns, index);
-}
-
-static void DecompileInvokeVirtual(u2 *insns, Code new_opcode, bool is_range) {
-  u2 index = NextIndex();
-  dexInstr_SetOpcode(insns, new_opcode);
-  if (is_range) {
-    dexInstr_SetVRegB_3rc(insns, index);
-  } else {
-    dexInstr_SetVRegB_35c(insns, index);
+  indices[0] = NextIndex(ctx, dex_pc);
+  if (indices[0] == kDexNoIndex16) {
+    // This means it was a normal nop and not a check-cast.
+    return kNopPlain;
   }
+  indices[1] = NextIndex(ctx, dex_pc);
+  return kNopCheckCast;
 }
 
-bool dexDecompilerV10_decompile(const u1 *dexFileBuf,
+bool dexDecompilerV10_decompile(dexDecompilerCtx_v10 *ctx,
+                                const u1 *dexFileBuf,
                                 dexMethod *pDexMethod,
                                 const u1 *quickening_info,
                                 u4 quickening_size,
@@ -100,99 +65,30 @@ bool dexDecompilerV10_decompile(const u1 *dexFileBuf,
     return true;
   }
 
-  dexCode *pDexCode = (dexCode *)(dexFileBuf + pDexMethod->codeOff);
-  u4 startCodeOff = dex_getFirstInstrOff(pDexMethod);
+  // Without quickening info only return-void-no-barrier is restored, so methods rejected by the
+  // prefilter are skipped unless disassembling
+  if (quickening_size == 0 && !dex_getDisassemblerStatus() &&
+      !dexUnquicken_prefilter(&ctx->iter, dexFileBuf, pDexMethod)) {
+    return true;
+  }
 
-  quicken_info_ptr = quickening_info;
-  quicken_index = 0;
-  quicken_info_number_of_indices = NumberOfIndices(quickening_size);
+  ctx->quicken_info_ptr = quickening_info;
+  ctx->quicken_index = 0;
+  ctx->quicken_info_number_of_indices = NumberOfIndices(quickening_size);
 
   log_dis("    quickening_size=%" PRIx32 " (%" PRIu32 ")\n", quickening_size, quickening_size);
-  initCodeIterator(pDexCode->insns, pDexCode->insns_size, startCodeOff);
-
-  while (isCodeIteratorDone() == false) {
-    bool hasCodeChange = true;
-    dex_dumpInstruction(dexFileBuf, code_ptr, cur_code_off, dex_pc, false);
-    switch (dexInstr_getOpcode(code_ptr)) {
-      case RETURN_VOID_NO_BARRIER:
-        if (decompile_return_instruction) {
-          dexInstr_SetOpcode(code_ptr, RETURN_VOID);
-        }
-        break;
-      case NOP:
-        if (quicken_info_number_of_indices > 0) {
-          // Only try to decompile NOP if there are more than 0 indices. Not having
-          // any index happens when we unquicken a code item that only has
-          // RETURN_VOID_NO_BARRIER as quickened instruction.
-          hasCodeChange = DecompileNop(code_ptr);
-        }
-        break;
-      case IGET_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IGET);
-        break;
-      case IGET_WIDE_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IGET_WIDE);
-        break;
-      case IGET_OBJECT_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IGET_OBJECT);
-        break;
-      case IGET_BOOLEAN_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IGET_BOOLEAN);
-        break;
-      case IGET_BYTE_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IGET_BYTE);
-        break;
-      case IGET_CHAR_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IGET_CHAR);
-        break;
-      case IGET_SHORT_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IGET_SHORT);
-        break;
-      case IPUT_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IPUT);
-        break;
-      case IPUT_BOOLEAN_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IPUT_BOOLEAN);
-        break;
-      case IPUT_BYTE_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IPUT_BYTE);
-        break;
-      case IPUT_CHAR_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IPUT_CHAR);
-        break;
-      case IPUT_SHORT_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IPUT_SHORT);
-        break;
-      case IPUT_WIDE_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IPUT_WIDE);
-        break;
-      case IPUT_OBJECT_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IPUT_OBJECT);
-        break;
-      case INVOKE_VIRTUAL_QUICK:
-        DecompileInvokeVirtual(code_ptr, INVOKE_VIRTUAL, false);
-        break;
-      case INVOKE_VIRTUAL_RANGE_QUICK:
-        DecompileInvokeVirtual(code_ptr, INVOKE_VIRTUAL_RANGE, true);
-        break;
-      default:
-        hasCodeChange = false;
-        break;
-    }
+  const dexUnquickenIndexSource source = {
+    .nextIndex = NextIndex, .nopIndices = NopIndices, .arg = ctx,
+  };
+  dexUnquicken_method(&ctx->iter, dexFileBuf, pDexMethod, &source, decompile_return_instruction);
 
-    if (hasCodeChange) {
-      dex_dumpInstruction(dexFileBuf, code_ptr, cur_code_off, dex_pc, true);
-    }
-    codeIteratorAdvance();
-  }
-
-  if (quicken_index != quicken_info_number_of_indices) {
-    if (quicken_index == 0) {
+  if (ctx->quicken_index != ctx->quicken_info_number_of_indices) {
+    if (ctx->quicken_index == 0) {
       LOGMSG(l_ERROR,
              "Failed to use any value in quickening info, potentially due to duplicate methods.");
     } else {
       LOGMSG(l_ERROR, "Failed to use all values in quickening info, '%zx' items not processed",
-             quicken_info_number_of_indices - quicken_index);
+             ctx->quicken_info_number_of_indices - ctx->quicken_index);
       return false;
     }
   }
@@ -200,12 +96,6 @@ bool dexDecompilerV10_decompile(const u1 *dexFileBuf,
   return true;
 }
 
-void dexDecompilerV10_walk(const u1 *dexFileBuf, dexMethod *pDexMethod) {
-  dexCode *pDexCode = (dexCode *)(dexFileBuf + pDexMethod->codeOff);
-  u4 startCodeOff = dex_getFirstInstrOff(pDexMethod);
-  initCodeIterator(pDexCode->insns, pDexCode->insns_size, startCodeOff);
-  while (isCodeIteratorDone() == false) {
-    dex_dumpInstruction(dexFileBuf, code_ptr, cur_code_off, dex_pc, false);
-    codeIteratorAdvance();
-  }
+void dexDecompilerV10_walk(dexDecompilerCtx_v10 *ctx, const u1 *dexFileBuf, dexMethod *pDexMethod) {
+  dexUnquicken_walk(&ctx->iter, dexFileBuf, pDexMethod);
 }
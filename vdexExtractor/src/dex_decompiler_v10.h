@@ -26,11 +26,23 @@
 #include "common.h"
 #include "dex.h"
 #include "dex_instruction.h"
+#include "dex_unquicken.h"
+
+// Per method decompiler state. Owned by the caller, so each thread decompiling methods
+// concurrently needs its own context.
+typedef struct {
+  const u1 *quicken_info_ptr;
+  size_t quicken_info_number_of_indices;
+  size_t quicken_index;
+
+  dexCodeIter iter;
+} dexDecompilerCtx_v10;
 
 // Dex decompiler driver function using quicken_info data
-bool dexDecompilerV10_decompile(const u1 *, dexMethod *, const u1 *, u4, bool);
+bool dexDecompilerV10_decompile(
+    dexDecompilerCtx_v10 *, const u1 *, dexMethod *, const u1 *, u4, bool);
 
 // Dex decompiler walk method that simply disassembles code blocks
-void dexDecompilerV10_walk(const u1 *, dexMethod *);
+void dexDecompilerV10_walk(dexDecompilerCtx_v10 *, const u1 *, dexMethod *);
 
 #endif
@@ -26,11 +26,22 @@
 #include "common.h"
 #include "dex.h"
 #include "dex_instruction.h"
+#include "dex_unquicken.h"
+
+// Per method decompiler state. Owned by the caller, so each thread decompiling methods
+// concurrently needs its own context.
+typedef struct {
+  const u1 *quickening_info_ptr;
+  const u1 *quickening_info_end;
+
+  dexCodeIter iter;
+} dexDecompilerCtx_v6;
 
 // Dex decompiler driver function using quicken_info data
-bool dexDecompilerV6_decompile(const u1 *, dexMethod *, const u1 *, u4, bool);
+bool dexDecompilerV6_decompile(
+    dexDecompilerCtx_v6 *, const u1 *, dexMethod *, const u1 *, u4, bool);
 
 // Dex decompiler walk method that simply disassembles code blocks
-void dexDecompilerV6_walk(const u1 *, dexMethod *);
+void dexDecompilerV6_walk(dexDecompilerCtx_v6 *, const u1 *, dexMethod *);
 
 #endif
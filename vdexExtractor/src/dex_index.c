@@ -0,0 +1,149 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stddef.h>
+
+#include "dex_index.h"
+#include "utils.h"
+
+dexClassLookup *dexIndex_createClassLookup(const u1 *dexFileBuf) {
+  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+  u4 numEntries = 2;
+  while (numEntries < (u8)pDexHeader->classDefsSize * 2) numEntries <<= 1;
+
+  size_t entrySz = sizeof(((dexClassLookup *)NULL)->table[0]);
+  size_t tableSz = offsetof(dexClassLookup, table) + numEntries * entrySz;
+  dexClassLookup *pLookup = utils_calloc(tableSz);
+  pLookup->size = (int)tableSz;
+  pLookup->numEntries = (int)numEntries;
+
+  // String data never starts at offset 0, which thus marks the empty slots
+  u4 mask = numEntries - 1;
+  for (u4 i = 0; i < pDexHeader->classDefsSize; ++i) {
+    const dexClassDef *pDexClassDef = dex_getClassDefUnchecked(dexFileBuf, i);
+    const dexTypeId *pDexTypeId = dex_getTypeIdUnchecked(dexFileBuf, pDexClassDef->classIdx);
+    const char *descriptor = dex_getStringDataUnchecked(dexFileBuf, pDexTypeId->descriptorIdx);
+    u4 hash = dexIndex_classDescriptorHash(descriptor);
+
+    u4 idx = hash & mask;
+    while (pLookup->table[idx].classDescriptorOff != 0) idx = (idx + 1) & mask;
+    pLookup->table[idx].classDescriptorHash = hash;
+    pLookup->table[idx].classDescriptorOff = (int)((const u1 *)descriptor - dexFileBuf);
+    pLookup->table[idx].classDefOff = (int)((const u1 *)pDexClassDef - dexFileBuf);
+  }
+  return pLookup;
+}
+
+s4 dexIndex_findClass(const dexClassLookup *pLookup, const u1 *dexFileBuf, const char *descriptor) {
+  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+  u4 hash = dexIndex_classDescriptorHash(descriptor);
+  u4 mask = (u4)pLookup->numEntries - 1;
+
+  // Duplicate definitions resolve to the first class def as it was inserted first
+  for (u4 idx = hash & mask; pLookup->table[idx].classDescriptorOff != 0; idx = (idx + 1) & mask) {
+    if (pLookup->table[idx].classDescriptorHash == hash &&
+        strcmp((const char *)dexFileBuf + pLookup->table[idx].classDescriptorOff, descriptor) ==
+            0) {
+      return (s4)((pLookup->table[idx].classDefOff - pDexHeader->classDefsOff) /
+                  sizeof(dexClassDef));
+    }
+  }
+  return -1;
+}
+
+// Extends the class descriptor hash with the member name & scrambles it, as only the low bits
+// select the slot
+static u4 memberHash(const char *classDescriptor, const char *name) {
+  u4 hash = dexIndex_classDescriptorHash(classDescriptor);
+  while (*name != '\0') hash = hash * 31 + (u1)*name++;
+  hash *= 0x9e3779b1;
+  return hash ^ (hash >> 16);
+}
+
+static u4 *createSlots(u4 count, u4 *pMask) {
+  u4 numEntries = 2;
+  while (numEntries < (u8)count * 2) numEntries <<= 1;
+  *pMask = numEntries - 1;
+  return utils_calloc(numEntries * sizeof(u4));
+}
+
+static void insertSlot(u4 *slots, u4 mask, u4 hash, u4 id) {
+  u4 idx = hash & mask;
+  while (slots[idx] != 0) idx = (idx + 1) & mask;
+  slots[idx] = id + 1;
+}
+
+dexMemberIndex *dexIndex_createMemberIndex(const u1 *dexFileBuf) {
+  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+  dexMemberIndex *pIndex = utils_malloc(sizeof(dexMemberIndex));
+
+  pIndex->methodSlots = createSlots(pDexHeader->methodIdsSize, &pIndex->methodMask);
+  for (u4 i = 0; i < pDexHeader->methodIdsSize; ++i) {
+    const dexMethodId *pDexMethodId = dex_getMethodIdUnchecked(dexFileBuf, i);
+    u4 hash = memberHash(dex_getTypeDescriptorUnchecked(dexFileBuf, pDexMethodId->classIdx),
+                         dex_getStringDataUnchecked(dexFileBuf, pDexMethodId->nameIdx));
+    insertSlot(pIndex->methodSlots, pIndex->methodMask, hash, i);
+  }
+  return pIndex;
+}
+
+void dexIndex_destroyMemberIndex(dexMemberIndex *pIndex) {
+  if (pIndex == NULL) return;
+  free(pIndex->methodSlots);
+  free(pIndex);
+}
+
+// Compares a proto against a '(params)return' signature without building its string
+static bool protoMatches(const u1 *dexFileBuf, const dexProtoId *pDexProtoId, const char *sig) {
+  if (*sig++ != '(') return false;
+  const dexTypeList *pDexTypeList = dex_getProtoParameters(dexFileBuf, pDexProtoId);
+  u4 paramsSize = pDexTypeList ? pDexTypeList->size : 0;
+  for (u4 i = 0; i < paramsSize; ++i) {
+    const char *param = dex_getTypeDescriptorUnchecked(dexFileBuf, pDexTypeList->list[i].typeIdx);
+    size_t paramLen = strlen(param);
+    if (strncmp(sig, param, paramLen) != 0) return false;
+    sig += paramLen;
+  }
+  if (*sig++ != ')') return false;
+  return strcmp(sig, dex_getTypeDescriptorUnchecked(dexFileBuf, pDexProtoId->returnTypeIdx)) == 0;
+}
+
+u4 dexIndex_findMethod(const dexMemberIndex *pIndex,
+                       const u1 *dexFileBuf,
+                       const char *classDescriptor,
+                       const char *name,
+                       const char *signature) {
+  u4 mask = pIndex->methodMask;
+  for (u4 idx = memberHash(classDescriptor, name) & mask; pIndex->methodSlots[idx] != 0;
+       idx = (idx + 1) & mask) {
+    u4 methodIdx = pIndex->methodSlots[idx] - 1;
+    const dexMethodId *pDexMethodId = dex_getMethodIdUnchecked(dexFileBuf, methodIdx);
+    if (strcmp(dex_getStringDataUnchecked(dexFileBuf, pDexMethodId->nameIdx), name) == 0 &&
+        strcmp(dex_getTypeDescriptorUnchecked(dexFileBuf, pDexMethodId->classIdx),
+               classDescriptor) == 0 &&
+        protoMatches(dexFileBuf, dex_getProtoIdUnchecked(dexFileBuf, pDexMethodId->protoIdx),
+                     signature)) {
+      return methodIdx;
+    }
+  }
+  return kDexNoIndex;
+}
@@ -0,0 +1,62 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _DEX_INDEX_H_
+#define _DEX_INDEX_H_
+
+#include "common.h"
+#include "dex.h"
+
+// Class lookup by descriptor, an open addressing table of the class defs of a Dex file keyed by
+// dexIndex_classDescriptorHash(). Sized to at least twice the number of class defs so that
+// probe sequences stay short. Built once per Dex file on demand & released with free().
+dexClassLookup *dexIndex_createClassLookup(const u1 *);
+
+// Returns the index of the class def with the given descriptor (e.g. 'Ljava/lang/Object;') or -1
+// if the Dex file doesn't define it
+s4 dexIndex_findClass(const dexClassLookup *, const u1 *, const char *);
+
+// Method ids of a Dex file, hashed by the (class descriptor, name) strings they intern, so that a
+// method reference can be resolved without building signature strings. Overloads share a probe
+// sequence & are told apart by their proto. Slots hold the id + 1, 0 being empty. Built in a
+// single pass over the method ids once per Dex file on demand.
+typedef struct {
+  u4 methodMask;
+  u4 *methodSlots;
+} dexMemberIndex;
+
+dexMemberIndex *dexIndex_createMemberIndex(const u1 *);
+void dexIndex_destroyMemberIndex(dexMemberIndex *);
+
+// Resolves a method from its class descriptor, name & signature (e.g. '(ILjava/lang/String;)V').
+// Returns the method id or kDexNoIndex.
+u4 dexIndex_findMethod(
+    const dexMemberIndex *, const u1 *, const char *, const char *, const char *);
+
+// Java String.hashCode() style hash of a class descriptor, as used by the Dalvik lookup tables
+static inline u4 dexIndex_classDescriptorHash(const char *str) {
+  u4 hash = 1;
+  while (*str != '\0') hash = hash * 31 + (u1)*str++;
+  return hash;
+}
+
+#endif
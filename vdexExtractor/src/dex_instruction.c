@@ -22,7 +22,33 @@
 
 #include "dex_instruction.h"
 
-static u4 SizeInCodeUnitsComplexOpcode(u2 *code_ptr) {
+// clang-format off
+
+#define INSTRUCTION_CLASS(index, flags) \
+    ((((flags) & kBranch) ? kClassBranch : 0) | \
+     (((flags) & kUnconditional) ? kClassUnconditional : 0) | \
+     (((flags) & kSwitch) ? kClassSwitch : 0) | \
+     (((flags) & kThrow) ? kClassThrow : 0) | \
+     (((flags) & kReturn) ? kClassReturn : 0) | \
+     (((flags) & kInvoke) ? kClassInvoke : 0) | \
+     (((index) == kIndexFieldOffset || (index) == kIndexVtableOffset) ? kClassQuickened : 0) | \
+     (((index) != kIndexNone) ? kClassIndexed : 0))
+
+__attribute__((aligned(64))) const s1 kInstructionSizes[256] = {
+#define INSTRUCTION_SIZE_ENTRY(o, c, p, format, i, a, e, v) INSTRUCTION_SIZE((c), (format)),
+  DEX_INSTRUCTION_LIST(INSTRUCTION_SIZE_ENTRY)
+#undef INSTRUCTION_SIZE_ENTRY
+};
+
+__attribute__((aligned(64))) const u1 kInstructionClasses[256] = {
+#define INSTRUCTION_CLASS_ENTRY(o, c, p, f, index, flags, e, v) INSTRUCTION_CLASS((index), (flags)),
+  DEX_INSTRUCTION_LIST(INSTRUCTION_CLASS_ENTRY)
+#undef INSTRUCTION_CLASS_ENTRY
+};
+
+// clang-format on
+
+u4 dexInstr_SizeInCodeUnitsComplex(u2 *code_ptr) {
   // Handle special NOP encoded variable length sequences.
   switch (*code_ptr) {
     case kPackedSwitchSignature:
@@ -736,44 +762,34 @@ void dexInstr_SetVRegB_21c(u2 *code_ptr, u2 val) {
 }
 
 bool dexInstr_isBranch(u2 *code_ptr) {
-  return (kInstructionDescriptors[dexInstr_getOpcode(code_ptr)].flags & kBranch) != 0;
+  return (kInstructionClasses[dexInstr_getOpcode(code_ptr)] & kClassBranch) != 0;
 }
 
 bool dexInstr_isUnconditional(u2 *code_ptr) {
-  return (kInstructionDescriptors[dexInstr_getOpcode(code_ptr)].flags & kUnconditional) != 0;
+  return (kInstructionClasses[dexInstr_getOpcode(code_ptr)] & kClassUnconditional) != 0;
 }
 
 bool dexInstr_isQuickened(u2 *code_ptr) {
-  return (kInstructionDescriptors[dexInstr_getOpcode(code_ptr)].index_type == kIndexFieldOffset) ||
-         (kInstructionDescriptors[dexInstr_getOpcode(code_ptr)].index_type == kIndexVtableOffset);
+  return (kInstructionClasses[dexInstr_getOpcode(code_ptr)] & kClassQuickened) != 0;
 }
 
 bool dexInstr_isSwitch(u2 *code_ptr) {
-  return (kInstructionDescriptors[dexInstr_getOpcode(code_ptr)].flags & kSwitch) != 0;
+  return (kInstructionClasses[dexInstr_getOpcode(code_ptr)] & kClassSwitch) != 0;
 }
 
 bool dexInstr_isThrow(u2 *code_ptr) {
-  return (kInstructionDescriptors[dexInstr_getOpcode(code_ptr)].flags & kThrow) != 0;
+  return (kInstructionClasses[dexInstr_getOpcode(code_ptr)] & kClassThrow) != 0;
 }
 
 bool dexInstr_isReturn(u2 *code_ptr) {
-  return (kInstructionDescriptors[dexInstr_getOpcode(code_ptr)].flags & kReturn) != 0;
+  return (kInstructionClasses[dexInstr_getOpcode(code_ptr)] & kClassReturn) != 0;
 }
 
 bool dexInstr_isBasicBlockEnd(u2 *code_ptr) {
-  return dexInstr_isBranch(code_ptr) || dexInstr_isReturn(code_ptr) ||
+  return (kInstructionClasses[dexInstr_getOpcode(code_ptr)] & (kClassBranch | kClassReturn)) != 0 ||
          dexInstr_getOpcode(code_ptr) == THROW;
 }
 
 bool dexInstr_isInvoke(u2 *code_ptr) {
-  return (kInstructionDescriptors[dexInstr_getOpcode(code_ptr)].flags & kInvoke) != 0;
-}
-
-u4 dexInstr_SizeInCodeUnits(u2 *code_ptr) {
-  s1 result = kInstructionDescriptors[dexInstr_getOpcode(code_ptr)].size_in_code_units;
-  if (result < 0) {
-    return SizeInCodeUnitsComplexOpcode(code_ptr);
-  } else {
-    return (u4)result;
-  }
+  return (kInstructionClasses[dexInstr_getOpcode(code_ptr)] & kClassInvoke) != 0;
 }
@@ -104,6 +104,19 @@ typedef enum {
   kExperimental = 0x80,   // is an experimental opcode
 } Flags;
 
+// Opcode classes packed in a byte per opcode, so that predicates used by the bytecode walkers
+// don't need to load the wide instruction descriptors
+typedef enum {
+  kClassBranch = 0x01,
+  kClassUnconditional = 0x02,
+  kClassSwitch = 0x04,
+  kClassThrow = 0x08,
+  kClassReturn = 0x10,
+  kClassInvoke = 0x20,
+  kClassQuickened = 0x40,  // field or vtable offset operand
+  kClassIndexed = 0x80,    // references an index of the Dex file or a quickened offset
+} InstrClass;
+
 typedef enum {
   kAdd = 0x0000080,        // addition
   kSubtract = 0x0000100,   // subtract
@@ -165,7 +178,7 @@ typedef struct {
   s1 size_in_code_units;
 } instrDesc_t;
 
-static const u4 kMaxVarArgRegs = 5;
+enum { kMaxVarArgRegs = 5 };
 
 // clang-format off
 
@@ -275,7 +288,7 @@ s4 dexInstr_getVRegH(u2 *);
 u2 dexInstr_getVRegH_45cc(u2 *);
 u2 dexInstr_getVRegH_4rcc(u2 *);
 bool dexInstr_hasVarArgs(u2 *);
-void dexInstr_getVarArgs(u2 *, u4[]);
+void dexInstr_getVarArgs(u2 *, u4[kMaxVarArgRegs]);
 
 // Set register functions
 void dexInstr_SetVRegA_10x(u2 *, u1);
@@ -294,11 +307,22 @@ bool dexInstr_isReturn(u2 *);
 bool dexInstr_isBasicBlockEnd(u2 *);
 bool dexInstr_isInvoke(u2 *);
 
-// Returns the size (in 2 byte code units) of this instruction.
-u4 dexInstr_SizeInCodeUnits(u2 *);
+// Size of the variable length payloads & nop, which have no size in kInstructionSizes
+u4 dexInstr_SizeInCodeUnitsComplex(u2 *);
 
 // Global exported arrays with constants
 extern const char *const kInstructionNames[];
 extern instrDesc_t const kInstructionDescriptors[];
 
+// Dense per opcode tables generated from DEX_INSTRUCTION_LIST, 4 cache lines each. Sizes are in
+// 2 byte code units, -1 for nop & payloads. Classes are InstrClass bits.
+extern const s1 kInstructionSizes[256];
+extern const u1 kInstructionClasses[256];
+
+// Returns the size (in 2 byte code units) of this instruction.
+static inline u4 dexInstr_SizeInCodeUnits(u2 *code_ptr) {
+  s1 result = kInstructionSizes[code_ptr[0] & 0xFF];
+  return LIKELY(result > 0) ? (u4)result : dexInstr_SizeInCodeUnitsComplex(code_ptr);
+}
+
 #endif
@@ -306,6 +306,27 @@
   V(k4rcc) \
   V(k51l)
 
+// Quickened instructions & the ones they are restored to when unquickening. Operands are derived
+// from the DEX_INSTRUCTION_LIST format column, which the index type column is checked against.
+// V(quickened_instruction_code, instruction_code);
+#define DEX_QUICKENED_INSTRUCTION_LIST(V) \
+  V(IGET_QUICK, IGET) \
+  V(IGET_WIDE_QUICK, IGET_WIDE) \
+  V(IGET_OBJECT_QUICK, IGET_OBJECT) \
+  V(IGET_BOOLEAN_QUICK, IGET_BOOLEAN) \
+  V(IGET_BYTE_QUICK, IGET_BYTE) \
+  V(IGET_CHAR_QUICK, IGET_CHAR) \
+  V(IGET_SHORT_QUICK, IGET_SHORT) \
+  V(IPUT_QUICK, IPUT) \
+  V(IPUT_WIDE_QUICK, IPUT_WIDE) \
+  V(IPUT_OBJECT_QUICK, IPUT_OBJECT) \
+  V(IPUT_BOOLEAN_QUICK, IPUT_BOOLEAN) \
+  V(IPUT_BYTE_QUICK, IPUT_BYTE) \
+  V(IPUT_CHAR_QUICK, IPUT_CHAR) \
+  V(IPUT_SHORT_QUICK, IPUT_SHORT) \
+  V(INVOKE_VIRTUAL_QUICK, INVOKE_VIRTUAL) \
+  V(INVOKE_VIRTUAL_RANGE_QUICK, INVOKE_VIRTUAL_RANGE)
+
 // clang-format on
 
 #endif
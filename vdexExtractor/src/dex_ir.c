@@ -0,0 +1,224 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "dex_ir.h"
+
+static u1 InstAA(const u2 *code_ptr) { return code_ptr[0] >> 8; }
+
+static u1 InstA(const u2 *code_ptr) { return (code_ptr[0] >> 8) & 0x0f; }
+
+static u1 InstB(const u2 *code_ptr) { return code_ptr[0] >> 12; }
+
+static u4 Fetch32(const u2 *code_ptr) { return code_ptr[0] | ((u4)code_ptr[1] << 16); }
+
+// Operands are extracted with a single switch on the format, matching the dexInstr_getVReg*
+// accessors of each format
+void dexIr_decodeInsn(u2 *code_ptr, u4 dex_pc, dexIrInsn *pInsn) {
+  memset(pInsn, 0, sizeof(dexIrInsn));
+  pInsn->opcode = dexInstr_getOpcode(code_ptr);
+  pInsn->format = kInstructionDescriptors[pInsn->opcode].format;
+  pInsn->width = dexInstr_SizeInCodeUnits(code_ptr);
+  pInsn->dexPc = dex_pc;
+
+  switch (pInsn->format) {
+    case k10x:
+    case k11x:
+      pInsn->vA = InstAA(code_ptr);
+      break;
+    case k10t:
+      pInsn->vA = (s1)InstAA(code_ptr);
+      break;
+    case k11n:
+      pInsn->vA = InstA(code_ptr);
+      pInsn->vB = (s1)(InstB(code_ptr) << 4) >> 4;
+      break;
+    case k12x:
+      pInsn->vA = InstA(code_ptr);
+      pInsn->vB = InstB(code_ptr);
+      break;
+    case k20t:
+      pInsn->vA = (s2)code_ptr[1];
+      break;
+    case k21c:
+    case k21h:
+    case k22x:
+      pInsn->vA = InstAA(code_ptr);
+      pInsn->vB = code_ptr[1];
+      pInsn->index = pInsn->format == k21c ? pInsn->vB : 0;
+      break;
+    case k21s:
+    case k21t:
+      pInsn->vA = InstAA(code_ptr);
+      pInsn->vB = (s2)code_ptr[1];
+      break;
+    case k22b:
+      pInsn->vA = InstAA(code_ptr);
+      pInsn->vB = code_ptr[1] & 0xff;
+      pInsn->vC = (s1)(code_ptr[1] >> 8);
+      break;
+    case k23x:
+      pInsn->vA = InstAA(code_ptr);
+      pInsn->vB = code_ptr[1] & 0xff;
+      pInsn->vC = code_ptr[1] >> 8;
+      break;
+    case k22c:
+      pInsn->vA = InstA(code_ptr);
+      pInsn->vB = InstB(code_ptr);
+      pInsn->vC = code_ptr[1];
+      pInsn->index = pInsn->vC;
+      break;
+    case k22s:
+    case k22t:
+      pInsn->vA = InstA(code_ptr);
+      pInsn->vB = InstB(code_ptr);
+      pInsn->vC = (s2)code_ptr[1];
+      break;
+    case k30t:
+      pInsn->vA = (s4)Fetch32(code_ptr + 1);
+      break;
+    case k31c:
+      pInsn->vA = InstAA(code_ptr);
+      pInsn->vB = Fetch32(code_ptr + 1);
+      pInsn->index = pInsn->vB;
+      break;
+    case k31i:
+    case k31t:
+      pInsn->vA = InstAA(code_ptr);
+      pInsn->vB = (s4)Fetch32(code_ptr + 1);
+      break;
+    case k32x:
+      pInsn->vA = code_ptr[1];
+      pInsn->vB = code_ptr[2];
+      break;
+    case k35c:
+    case k45cc:
+      pInsn->vA = InstB(code_ptr);  // This is labeled A in the spec.
+      pInsn->vB = code_ptr[1];
+      pInsn->vC = code_ptr[2] & 0x0f;
+      pInsn->vH = pInsn->format == k45cc ? code_ptr[3] : 0;
+      pInsn->index = pInsn->vB;
+      dexInstr_getVarArgs(code_ptr, pInsn->args);
+      break;
+    case k3rc:
+    case k4rcc:
+      pInsn->vA = InstAA(code_ptr);
+      pInsn->vB = code_ptr[1];
+      pInsn->vC = code_ptr[2];
+      pInsn->vH = pInsn->format == k4rcc ? code_ptr[3] : 0;
+      pInsn->index = pInsn->vB;
+      break;
+    case k51l:
+      pInsn->vA = InstAA(code_ptr);
+      pInsn->wideB = Fetch32(code_ptr + 1) | ((u8)Fetch32(code_ptr + 3) << 32);
+      pInsn->vB = (s4)pInsn->wideB;
+      break;
+    default:
+      break;
+  }
+}
+
+static bool hasArgs(u1 format) { return format == k35c || format == k45cc; }
+
+static void storeInsn(dexIrMethod *pIr, u4 i, const dexIrInsn *pInsn) {
+  pIr->opcode[i] = pInsn->opcode;
+  pIr->format[i] = pInsn->format;
+  pIr->width[i] = pInsn->width;
+  pIr->dexPc[i] = pInsn->dexPc;
+  pIr->vA[i] = pInsn->vA;
+  pIr->vB[i] = pInsn->vB;
+  pIr->vC[i] = pInsn->vC;
+  pIr->vH[i] = pInsn->vH;
+  pIr->wideB[i] = pInsn->wideB;
+  pIr->index[i] = pInsn->index;
+  if (hasArgs(pInsn->format)) {
+    memcpy(&pIr->args[pIr->argsOff[i]], pInsn->args, sizeof(pInsn->args));
+  }
+}
+
+// Smallest instruction with variable arguments, which bounds their number in a method
+#define kMinVarArgsInsnUnits 3
+
+void dexIr_initMethod(arena_t *pArena, u4 insnsSize, dexIrMethod *pIr) {
+  u4 capacity = insnsSize;
+  u4 argsCapacity = (insnsSize / kMinVarArgsInsnUnits) * kMaxVarArgRegs;
+  pIr->count = 0;
+  pIr->argsCapacity = argsCapacity;
+  pIr->capacity = capacity;
+  pIr->opcode = arena_alloc(pArena, capacity * sizeof(u1));
+  pIr->format = arena_alloc(pArena, capacity * sizeof(u1));
+  pIr->width = arena_alloc(pArena, capacity * sizeof(u4));
+  pIr->dexPc = arena_alloc(pArena, capacity * sizeof(u4));
+  pIr->vA = arena_alloc(pArena, capacity * sizeof(s4));
+  pIr->vB = arena_alloc(pArena, capacity * sizeof(s4));
+  pIr->vC = arena_alloc(pArena, capacity * sizeof(s4));
+  pIr->vH = arena_alloc(pArena, capacity * sizeof(u2));
+  pIr->wideB = arena_alloc(pArena, capacity * sizeof(u8));
+  pIr->index = arena_alloc(pArena, capacity * sizeof(u4));
+  pIr->argsOff = arena_alloc(pArena, capacity * sizeof(u4));
+  pIr->args = arena_alloc(pArena, argsCapacity * sizeof(u4));
+  pIr->argsCount = 0;
+}
+
+u4 dexIr_appendInsn(dexIrMethod *pIr, u2 *code_ptr, u4 dex_pc) {
+  CHECK_LT(pIr->count, pIr->capacity);
+  u4 i = pIr->count++;
+  pIr->format[i] = k10x;
+  pIr->dexPc[i] = dex_pc;
+  dexIr_updateInsn(pIr, i, code_ptr);
+  return i;
+}
+
+void dexIr_updateInsn(dexIrMethod *pIr, u4 i, u2 *code_ptr) {
+  dexIrInsn insn;
+  dexIr_decodeInsn(code_ptr, pIr->dexPc[i], &insn);
+  // Instructions gaining variable arguments when rewritten take a new slot
+  if (hasArgs(insn.format) && !hasArgs(pIr->format[i])) {
+    CHECK_LE(pIr->argsCount + kMaxVarArgRegs, pIr->argsCapacity);
+    pIr->argsOff[i] = pIr->argsCount;
+    pIr->argsCount += kMaxVarArgRegs;
+  }
+  storeInsn(pIr, i, &insn);
+}
+
+void dexIr_decodeMethod(arena_t *pArena, u2 *insns, u4 insnsSize, dexIrMethod *pIr) {
+  dexIr_initMethod(pArena, insnsSize, pIr);
+  for (u4 dex_pc = 0; dex_pc < insnsSize;) {
+    u4 i = dexIr_appendInsn(pIr, insns + dex_pc, dex_pc);
+    dex_pc += pIr->width[i];
+  }
+}
+
+void dexIr_getInsn(const dexIrMethod *pIr, u4 i, dexIrInsn *pInsn) {
+  pInsn->opcode = pIr->opcode[i];
+  pInsn->format = pIr->format[i];
+  pInsn->width = pIr->width[i];
+  pInsn->dexPc = pIr->dexPc[i];
+  pInsn->vA = pIr->vA[i];
+  pInsn->vB = pIr->vB[i];
+  pInsn->vC = pIr->vC[i];
+  pInsn->vH = pIr->vH[i];
+  pInsn->wideB = pIr->wideB[i];
+  pInsn->index = pIr->index[i];
+  if (hasArgs(pInsn->format)) {
+    memcpy(pInsn->args, &pIr->args[pIr->argsOff[i]], sizeof(pInsn->args));
+  }
+}
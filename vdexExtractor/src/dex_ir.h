@@ -0,0 +1,86 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _DEX_IR_H_
+#define _DEX_IR_H_
+
+#include "arena.h"
+#include "common.h"
+#include "dex_instruction.h"
+
+// A decoded instruction. Operands absent from the format are zero.
+typedef struct {
+  u1 opcode;
+  u1 format;
+  u4 width;  // in 2 byte code units
+  u4 dexPc;
+  s4 vA;
+  s4 vB;
+  s4 vC;
+  u2 vH;
+  u8 wideB;  // 64 bit literal of k51l
+  u4 index;  // primary index (type, string, method, field or quickened offset), if any
+  u4 args[kMaxVarArgRegs];
+} dexIrInsn;
+
+// Bytecode of a method decoded once, stored as one array per field (struct of arrays) so that
+// passes reading a few fields of every instruction touch contiguous memory only. Variable
+// argument registers are stored for k35c & k45cc instructions only, at argsOff in args.
+typedef struct {
+  u4 count;
+  u4 capacity;
+  u1 *opcode;
+  u1 *format;
+  u4 *width;
+  u4 *dexPc;
+  s4 *vA;
+  s4 *vB;
+  s4 *vC;
+  u2 *vH;
+  u8 *wideB;
+  u4 *index;
+  u4 *argsOff;
+  u4 *args;
+  u4 argsCount;
+  u4 argsCapacity;
+} dexIrMethod;
+
+// Decodes a single instruction at the given dex pc
+void dexIr_decodeInsn(u2 *, u4, dexIrInsn *);
+
+// Allocates from the arena the IR columns of a method with the given number of code units, which
+// bounds the number of instructions
+void dexIr_initMethod(arena_t *, u4, dexIrMethod *);
+
+// Decodes the instruction at the given dex pc as the next one of the method. Returns its index.
+u4 dexIr_appendInsn(dexIrMethod *, u2 *, u4);
+
+// Decodes again the i-th instruction of a method after it was rewritten in place
+void dexIr_updateInsn(dexIrMethod *, u4, u2 *);
+
+// Decodes all the code units of a method into IR columns allocated from the arena
+void dexIr_decodeMethod(arena_t *, u2 *, u4, dexIrMethod *);
+
+// Gathers the fields of the i-th instruction of a method
+void dexIr_getInsn(const dexIrMethod *, u4, dexIrInsn *);
+
+#endif
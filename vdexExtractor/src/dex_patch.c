@@ -0,0 +1,243 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <zlib.h>
+
+#include "checksum.h"
+#include "dex.h"
+#include "dex_patch.h"
+#include "utils.h"
+
+// Checksum covers everything past the magic & the checksum field itself
+#define kDexChecksumOff (sizeof(dexMagic))
+#define kDexChecksummedOff (sizeof(dexMagic) + sizeof(u4))
+
+void dexPatch_init(dexPatchList *pList) { memset(pList, 0, sizeof(dexPatchList)); }
+
+void dexPatch_destroy(dexPatchList *pList) {
+  free(pList->patches);
+  free(pList->units);
+  memset(pList, 0, sizeof(dexPatchList));
+}
+
+static void addPatch(dexPatchList *pList, u4 off, u2 unit) {
+  if (pList->count == pList->capacity) {
+    pList->capacity = pList->capacity ? pList->capacity * 2 : 64;
+    pList->patches = utils_realloc(pList->patches, pList->capacity * sizeof(dexPatch));
+  }
+  pList->patches[pList->count].off = off;
+  pList->patches[pList->count].unit = unit;
+  pList->count++;
+}
+
+bool dexPatch_recordInstruction(
+    dexPatchList *pList, const u1 *dexFileBuf, const u2 *code, const u2 *patched, u4 units) {
+  bool changed = false;
+  for (u4 i = 0; i < units; ++i) {
+    if (code[i] != patched[i]) {
+      addPatch(pList, (u4)((const u1 *)&code[i] - dexFileBuf), patched[i]);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+void dexPatch_merge(dexPatchList *pDst, dexPatchList *pSrc) {
+  if (pDst->count + pSrc->count > pDst->capacity) {
+    pDst->capacity = pDst->count + pSrc->count;
+    pDst->patches = utils_realloc(pDst->patches, pDst->capacity * sizeof(dexPatch));
+  }
+  memcpy(&pDst->patches[pDst->count], pSrc->patches, pSrc->count * sizeof(dexPatch));
+  pDst->count += pSrc->count;
+  dexPatch_destroy(pSrc);
+}
+
+static int dexPatchCmp(const void *a, const void *b) {
+  const dexPatch *pA = (const dexPatch *)a;
+  const dexPatch *pB = (const dexPatch *)b;
+  return pA->off < pB->off ? -1 : (pA->off > pB->off);
+}
+
+void dexPatch_finalize(dexPatchList *pList) {
+  // Instructions are visited in offset order, so lists are commonly sorted already
+  bool sorted = true;
+  for (size_t i = 1; i < pList->count && sorted; ++i) {
+    sorted = pList->patches[i - 1].off < pList->patches[i].off;
+  }
+  if (!sorted) {
+    qsort(pList->patches, pList->count, sizeof(dexPatch), dexPatchCmp);
+    size_t kept = 0;
+    for (size_t i = 0; i < pList->count; ++i) {
+      if (kept > 0 && pList->patches[kept - 1].off == pList->patches[i].off) {
+        pList->patches[kept - 1] = pList->patches[i];
+      } else {
+        pList->patches[kept++] = pList->patches[i];
+      }
+    }
+    pList->count = kept;
+  }
+
+  free(pList->units);
+  pList->units = utils_malloc((pList->count + 1) * sizeof(u2));
+  for (size_t i = 0; i < pList->count; ++i) {
+    pList->units[i] = pList->patches[i].unit;
+  }
+}
+
+// Iterates a range of the patched view as alternating original ranges & runs of consecutive
+// patched units. Range bounds are expected to be code unit aligned.
+typedef struct {
+  const u1 *buf;
+  size_t end;
+  const dexPatchList *pList;
+  size_t pos;
+  size_t patchIdx;
+} patchedView;
+
+static bool patchedViewNext(patchedView *pView, const u1 **pData, size_t *pLen) {
+  if (pView->pos >= pView->end) return false;
+
+  const dexPatchList *pList = pView->pList;
+  if (pView->patchIdx < pList->count && pList->patches[pView->patchIdx].off == pView->pos) {
+    size_t first = pView->patchIdx;
+    size_t last = first;
+    while (last + 1 < pList->count &&
+           pList->patches[last + 1].off == pList->patches[last].off + sizeof(u2) &&
+           pList->patches[last + 1].off < pView->end) {
+      last++;
+    }
+    *pData = (const u1 *)&pList->units[first];
+    *pLen = (last - first + 1) * sizeof(u2);
+    pView->patchIdx = last + 1;
+  } else {
+    size_t end = pView->end;
+    if (pView->patchIdx < pList->count && pList->patches[pView->patchIdx].off < end) {
+      end = pList->patches[pView->patchIdx].off;
+    }
+    *pData = pView->buf + pView->pos;
+    *pLen = end - pView->pos;
+  }
+  pView->pos += *pLen;
+  return true;
+}
+
+static void patchedViewInit(
+    patchedView *pView, const u1 *buf, size_t end, const dexPatchList *pList, size_t start) {
+  pView->buf = buf;
+  pView->end = end;
+  pView->pList = pList;
+  pView->pos = start;
+  pView->patchIdx = 0;
+  while (pView->patchIdx < pList->count && pList->patches[pView->patchIdx].off < start) {
+    pView->patchIdx++;
+  }
+}
+
+typedef struct {
+  const u1 *buf;
+  const dexPatchList *pList;
+} patchedBuf;
+
+static u4 patchedRange(const void *arg, size_t off, size_t len, u4 adler_checksum) {
+  const patchedBuf *pPatched = (const patchedBuf *)arg;
+  patchedView view;
+  patchedViewInit(&view, pPatched->buf, off + len, pPatched->pList, off);
+  const u1 *data;
+  size_t dataLen;
+  while (patchedViewNext(&view, &data, &dataLen)) {
+    adler_checksum = checksum_adler32Update(adler_checksum, data, dataLen);
+  }
+  return adler_checksum;
+}
+
+u4 dexPatch_computeDexCRC(const u1 *buf, size_t bufSz, const dexPatchList *pList) {
+  const patchedBuf patched = { .buf = buf, .pList = pList };
+  return checksum_adler32Range(patchedRange, &patched, kDexChecksummedOff,
+                               bufSz - kDexChecksummedOff);
+}
+
+static void patchedStream(const void *arg, size_t off, size_t len, checksum_multi_t *pMulti) {
+  const patchedBuf *pPatched = (const patchedBuf *)arg;
+  patchedView view;
+  patchedViewInit(&view, pPatched->buf, off + len, pPatched->pList, off);
+  const u1 *data;
+  size_t dataLen;
+  while (patchedViewNext(&view, &data, &dataLen)) {
+    checksum_multiUpdate(pMulti, data, dataLen);
+  }
+}
+
+void dexPatch_computeDigests(const u1 *buf,
+                             size_t bufSz,
+                             const dexPatchList *pList,
+                             bool repairSignature,
+                             dexDigests *pDigests) {
+  const patchedBuf patched = { .buf = buf, .pList = pList };
+  dex_computeStreamDigests(buf, bufSz, patchedStream, &patched, repairSignature, pDigests);
+}
+
+// Replaces the patches of a header field with ones storing the given bytes
+static void setHeaderField(dexPatchList *pList, size_t off, const u1 *data, size_t len) {
+  size_t count = 0;
+  dexPatch *patches = utils_malloc((pList->count + len / sizeof(u2)) * sizeof(dexPatch));
+  for (size_t i = 0; i < len; i += sizeof(u2)) {
+    patches[count].off = (u4)(off + i);
+    memcpy(&patches[count].unit, data + i, sizeof(u2));
+    count++;
+  }
+  for (size_t i = 0; i < pList->count; ++i) {
+    if (pList->patches[i].off < off || pList->patches[i].off >= off + len) {
+      patches[count++] = pList->patches[i];
+    }
+  }
+  free(pList->patches);
+  pList->patches = patches;
+  pList->count = count;
+  pList->capacity = count;
+  dexPatch_finalize(pList);
+}
+
+void dexPatch_setChecksum(dexPatchList *pList, u4 checksum) {
+  setHeaderField(pList, kDexChecksumOff, (const u1 *)&checksum, sizeof(u4));
+}
+
+void dexPatch_setSignature(dexPatchList *pList, const u1 *signature) {
+  setHeaderField(pList, kDexChecksummedOff, signature, kSHA1Len);
+}
+
+int dexPatch_buildIov(const u1 *buf, size_t bufSz, const dexPatchList *pList, struct iovec **pIov) {
+  int iovCnt = 0;
+  size_t iovCap = pList->count * 2 + 1;
+  struct iovec *iov = utils_malloc(iovCap * sizeof(struct iovec));
+
+  patchedView view;
+  patchedViewInit(&view, buf, bufSz, pList, 0);
+  const u1 *data;
+  size_t len;
+  while (patchedViewNext(&view, &data, &len)) {
+    iov[iovCnt].iov_base = (void *)data;
+    iov[iovCnt].iov_len = len;
+    iovCnt++;
+  }
+  *pIov = iov;
+  return iovCnt;
+}
@@ -0,0 +1,80 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _DEX_PATCH_H_
+#define _DEX_PATCH_H_
+
+#include <sys/uio.h>
+
+#include "common.h"
+#include "dex.h"
+
+// Quickened instructions are rewritten to formats of up to 3 code units (35c & 3rc)
+#define kDexMaxPatchedInsnUnits 3
+
+// Code unit rewritten by the decompiler, at a byte offset from the Dex file start
+typedef struct {
+  u4 off;
+  u2 unit;
+} dexPatch;
+
+// Patch list of a Dex file. Instead of unquickening in place (which copies on write every touched
+// page of the input mapping), decompilers may record the changed code units so that the input is
+// mapped read-only and the output is assembled from the original ranges plus the patches.
+typedef struct {
+  dexPatch *patches;
+  size_t count;
+  size_t capacity;
+  u2 *units;  // Patched units in offset order, populated by dexPatch_finalize()
+} dexPatchList;
+
+void dexPatch_init(dexPatchList *);
+void dexPatch_destroy(dexPatchList *);
+
+// Records the units of a patched instruction copy that differ from the original code. Returns
+// true if any unit changed.
+bool dexPatch_recordInstruction(dexPatchList *, const u1 *, const u2 *, const u2 *, u4);
+
+// Moves all patches of the second list to the first one
+void dexPatch_merge(dexPatchList *, dexPatchList *);
+
+// Sorts patches by offset collapsing duplicates. Must be called before the patched view is
+// checksummed or written.
+void dexPatch_finalize(dexPatchList *);
+
+// Adler32 checksum of the Dex file as it reads with the patches applied
+u4 dexPatch_computeDexCRC(const u1 *, size_t, const dexPatchList *);
+
+// Checksum, signature & CRC32 of the Dex file as it reads with the patches applied, optionally
+// repairing the signature (see dex_computeStreamDigests())
+void dexPatch_computeDigests(const u1 *, size_t, const dexPatchList *, bool, dexDigests *);
+
+// Add patches of the header checksum & signature fields. Expect a finalized list and keep it
+// finalized.
+void dexPatch_setChecksum(dexPatchList *, u4);
+void dexPatch_setSignature(dexPatchList *, const u1 *);
+
+// Builds the scatter list of the patched Dex file out of the original buffer ranges and the
+// patched units. Returns the number of vectors stored in the allocated array.
+int dexPatch_buildIov(const u1 *, size_t, const dexPatchList *, struct iovec **);
+
+#endif
@@ -0,0 +1,140 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <sys/mman.h>
+
+#include "dex.h"
+#include "dex_repair.h"
+#include "io_engine.h"
+#include "out_writer.h"
+#include "stats.h"
+#include "utils.h"
+
+// Header bytes covering the checksum & signature fields, rewritten when repairing
+#define kDexRepairedHeaderSz (sizeof(dexMagic) + sizeof(u4) + kSHA1Len)
+
+static bool isValidDexFile(const char *fileName, const u1 *buf, off_t fileSz) {
+  const dexHeader *pDexHeader = (const dexHeader *)buf;
+  if ((size_t)fileSz < sizeof(dexHeader) || !dex_isValidDexMagic(pDexHeader)) {
+    LOGMSG(l_WARN, "Invalid Dex header - skipping '%s'", fileName);
+    return false;
+  }
+  if (pDexHeader->fileSize != (u4)fileSz) {
+    LOGMSG(l_WARN, "Dex header file size (%" PRIu32 ") doesn't match '%s' (%jd bytes) - skipping",
+           pDexHeader->fileSize, fileName, (intmax_t)fileSz);
+    return false;
+  }
+  return true;
+}
+
+static bool digestsMatch(const u1 *buf, const dexDigests *pDigests) {
+  const dexHeader *pDexHeader = (const dexHeader *)buf;
+  return pDexHeader->checksum == pDigests->checksum && pDigests->signatureMatch;
+}
+
+static dexRepairStatus repairInPlace(const char *fileName) {
+  off_t fileSz;
+  int fd;
+  u1 *buf = utils_mapFileToWrite(fileName, &fileSz, &fd);
+  if (buf == NULL) return kDexRepairFailed;
+
+  dexRepairStatus status = kDexRepairFailed;
+  if (isValidDexFile(fileName, buf, fileSz)) {
+    madvise(buf, fileSz, MADV_SEQUENTIAL);
+    struct timespec timer;
+    utils_startTimer(&timer);
+    dexDigests digests;
+    dex_computeDigests(buf, fileSz, true, &digests);
+    stats_addDigests(fileSz, utils_endTimer(&timer));
+
+    // Leave up to date files untouched, so that their pages aren't dirtied & written back
+    if (digestsMatch(buf, &digests)) {
+      status = kDexRepairValid;
+    } else {
+      dex_repairDigests(buf, &digests);
+      status = kDexRepairRepaired;
+    }
+  }
+
+  munmap(buf, fileSz);
+  close(fd);
+  return status;
+}
+
+static dexRepairStatus repairToOutputDir(const char *fileName, const runArgs_t *pRunArgs) {
+  off_t fileSz;
+  int fd;
+  u1 *buf = utils_mapFileReadOnly(fileName, &fileSz, &fd);
+  if (buf == NULL) return kDexRepairFailed;
+
+  dexRepairStatus status = kDexRepairFailed;
+  char outFile[PATH_MAX];
+  outWriter_mirrorName(outFile, sizeof(outFile), pRunArgs->outputDir, pRunArgs->inputDir,
+                       fileName);
+  if (!isValidDexFile(fileName, buf, fileSz)) {
+    goto complete;
+  }
+  if (!utils_makeParentDirs(outFile)) {
+    LOGMSG(l_ERROR, "Couldn't create parent directories of '%s'", outFile);
+    goto complete;
+  }
+
+  madvise(buf, fileSz, MADV_SEQUENTIAL);
+  struct timespec timer;
+  utils_startTimer(&timer);
+  dexDigests digests;
+  dex_computeDigests(buf, fileSz, true, &digests);
+  stats_addDigests(fileSz, utils_endTimer(&timer));
+  status = digestsMatch(buf, &digests) ? kDexRepairValid : kDexRepairRepaired;
+
+  // Repaired header fields followed by the rest of the file straight out of the mapping
+  u1 header[kDexRepairedHeaderSz];
+  memcpy(header, buf, sizeof(header));
+  dex_repairDigests(header, &digests);
+  struct iovec iov[2] = {
+    { .iov_base = header, .iov_len = sizeof(header) },
+    { .iov_base = buf + sizeof(header), .iov_len = fileSz - sizeof(header) },
+  };
+  ioEngine_writeReq_t req = {
+    .path = outFile,
+    .flags = O_CREAT | O_WRONLY | O_TRUNC | (pRunArgs->fileOverride ? 0 : O_EXCL),
+    .mode = 0644,
+    .iov = iov,
+    .iovCnt = 2,
+  };
+  ioEngine_writeFiles(&req, 1);
+  if (req.err != 0) {
+    errno = req.err;
+    LOGMSG_P(l_ERROR, "Couldn't write output file '%s'", outFile);
+    status = kDexRepairFailed;
+  }
+
+complete:
+  munmap(buf, fileSz);
+  close(fd);
+  return status;
+}
+
+dexRepairStatus dexRepair_file(const char *fileName, const runArgs_t *pRunArgs) {
+  LOGMSG(l_DEBUG, "Repairing '%s'", fileName);
+  return pRunArgs->outputDir ? repairToOutputDir(fileName, pRunArgs) : repairInPlace(fileName);
+}
@@ -0,0 +1,40 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _DEX_REPAIR_H_
+#define _DEX_REPAIR_H_
+
+#include "common.h"
+
+// Outcome of repairing a standalone Dex file
+typedef enum {
+  kDexRepairFailed = 0,
+  kDexRepairValid,     // Checksum & signature already matched, nothing was written in place
+  kDexRepairRepaired,  // Header was rewritten (or a repaired copy written to the output dir)
+} dexRepairStatus;
+
+// Recomputes the checksum & signature of a plain Dex file in a single pass over its mapping.
+// Without an output dir the header is fixed in place through a shared mapping (only when stale),
+// otherwise a repaired copy is written under the output dir out of the read-only mapping.
+dexRepairStatus dexRepair_file(const char *, const runArgs_t *);
+
+#endif
@@ -0,0 +1,311 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "dex_unquicken.h"
+#include "cpu_features.h"
+
+#if VDEX_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Formats & index types of all opcodes as constant expressions, so that the remap table below is
+// generated & checked at compile time
+// clang-format off
+enum {
+#define INSTRUCTION_FORMAT(o, c, p, format, i, a, e, v) kFormatOf_##c = (format),
+  DEX_INSTRUCTION_LIST(INSTRUCTION_FORMAT)
+#undef INSTRUCTION_FORMAT
+};
+
+enum {
+#define INSTRUCTION_INDEX_TYPE(o, c, p, f, index, a, e, v) kIndexTypeOf_##c = (index),
+  DEX_INSTRUCTION_LIST(INSTRUCTION_INDEX_TYPE)
+#undef INSTRUCTION_INDEX_TYPE
+};
+
+#define UNQUICKEN_OPERAND(format) \
+    ((int)(format) == (int)k22c ? kUnquickenVRegC_22c : \
+     (int)(format) == (int)k35c ? kUnquickenVRegB_35c : \
+     (int)(format) == (int)k3rc ? kUnquickenVRegB_3rc : kUnquickenNone)
+
+const dexUnquickenRemap kDexUnquickenRemap[256] = {
+  [NOP] = { CHECK_CAST, kUnquickenNop },
+  [RETURN_VOID_NO_BARRIER] = { RETURN_VOID, kUnquickenReturnVoid },
+#define UNQUICKEN_REMAP(quick, code) \
+  [quick] = { (code), UNQUICKEN_OPERAND(kFormatOf_##quick) },
+  DEX_QUICKENED_INSTRUCTION_LIST(UNQUICKEN_REMAP)
+#undef UNQUICKEN_REMAP
+};
+
+// Each operand rewritten by unquickenInstruction() consumes exactly one index, which only holds
+// for opcodes quickened into a field or vtable offset
+#define UNQUICKEN_INDEX_CHECK(quick, code) \
+  _Static_assert((int)kIndexTypeOf_##quick == (int)kIndexFieldOffset || \
+                     (int)kIndexTypeOf_##quick == (int)kIndexVtableOffset, \
+                 #quick " doesn't carry a field or vtable offset");
+DEX_QUICKENED_INSTRUCTION_LIST(UNQUICKEN_INDEX_CHECK)
+#undef UNQUICKEN_INDEX_CHECK
+// clang-format on
+
+// Opcodes the prefilter looks for: return-void-no-barrier & the contiguous range of the quickened
+// field accesses & invokes. Nops are left out as they only hide a check-cast when the quickening
+// info says so.
+enum {
+  kPrefilterOpcode = RETURN_VOID_NO_BARRIER,
+  kPrefilterFirstOpcode = IGET_QUICK,
+  kPrefilterLastOpcode = IGET_SHORT_QUICK,
+};
+
+#define PREFILTER_RANGE_CHECK(quick, code)                                                    \
+  _Static_assert((int)(quick) >= (int)kPrefilterFirstOpcode &&                                \
+                     (int)(quick) <= (int)kPrefilterLastOpcode,                                \
+                 #quick " is outside of the prefilter opcode range");
+DEX_QUICKENED_INSTRUCTION_LIST(PREFILTER_RANGE_CHECK)
+#undef PREFILTER_RANGE_CHECK
+
+static bool isPrefilterCandidate(u2 unit) {
+  u1 op = unit & 0xff;
+  return op == kPrefilterOpcode || (u1)(op - kPrefilterFirstOpcode) <=
+                                       (u1)(kPrefilterLastOpcode - kPrefilterFirstOpcode);
+}
+
+static bool hasCandidatesScalar(const u2 *insns, u4 units) {
+  for (u4 i = 0; i < units; ++i) {
+    if (isPrefilterCandidate(insns[i])) return true;
+  }
+  return false;
+}
+
+#if VDEX_HAVE_X86_SIMD
+// Code units are checked 16 at a time: the low byte is isolated, then matched against the single
+// opcode & the range, the latter as an unsigned min against the range width.
+__attribute__((target("avx2"))) static bool hasCandidatesAVX2(const u2 *insns, u4 units) {
+  const __m256i lowMask = _mm256_set1_epi16(0xff);
+  const __m256i opcode = _mm256_set1_epi16(kPrefilterOpcode);
+  const __m256i first = _mm256_set1_epi16(kPrefilterFirstOpcode);
+  const __m256i width = _mm256_set1_epi16(kPrefilterLastOpcode - kPrefilterFirstOpcode);
+  u4 i = 0;
+  for (; i + 16 <= units; i += 16) {
+    __m256i op = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(insns + i)), lowMask);
+    __m256i rel = _mm256_sub_epi16(op, first);
+    __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi16(op, opcode),
+                                  _mm256_cmpeq_epi16(_mm256_min_epu16(rel, width), rel));
+    if (!_mm256_testz_si256(hit, hit)) return true;
+  }
+  return hasCandidatesScalar(insns + i, units - i);
+}
+
+__attribute__((target("sse4.2"))) static bool hasCandidatesSSE42(const u2 *insns, u4 units) {
+  const __m128i lowMask = _mm_set1_epi16(0xff);
+  const __m128i opcode = _mm_set1_epi16(kPrefilterOpcode);
+  const __m128i first = _mm_set1_epi16(kPrefilterFirstOpcode);
+  const __m128i width = _mm_set1_epi16(kPrefilterLastOpcode - kPrefilterFirstOpcode);
+  u4 i = 0;
+  for (; i + 8 <= units; i += 8) {
+    __m128i op = _mm_and_si128(_mm_loadu_si128((const __m128i *)(insns + i)), lowMask);
+    __m128i rel = _mm_sub_epi16(op, first);
+    __m128i hit = _mm_or_si128(_mm_cmpeq_epi16(op, opcode),
+                               _mm_cmpeq_epi16(_mm_min_epu16(rel, width), rel));
+    if (!_mm_testz_si128(hit, hit)) return true;
+  }
+  return hasCandidatesScalar(insns + i, units - i);
+}
+#endif
+
+bool dexUnquicken_prefilter(dexCodeIter *pIter, const u1 *dexFileBuf, dexMethod *pDexMethod) {
+  const dexCode *pDexCode = (const dexCode *)(dexFileBuf + pDexMethod->codeOff);
+  bool candidate;
+#if VDEX_HAVE_X86_SIMD
+  if (cpu_hasAVX2()) {
+    candidate = hasCandidatesAVX2(pDexCode->insns, pDexCode->insns_size);
+  } else if (cpu_hasSSE42()) {
+    candidate = hasCandidatesSSE42(pDexCode->insns, pDexCode->insns_size);
+  } else
+#endif
+  {
+    candidate = hasCandidatesScalar(pDexCode->insns, pDexCode->insns_size);
+  }
+  if (!candidate) pIter->skippedMethods++;
+  return candidate;
+}
+
+// Default size of the blocks backing the IR of a method
+#define kIrArenaBlockSz (64 * 1024)
+
+void dexUnquicken_initIter(dexCodeIter *pIter, dexPatchList *pPatches) {
+  memset(pIter, 0, sizeof(dexCodeIter));
+  pIter->pPatches = pPatches;
+  arena_init(&pIter->irArena, kIrArenaBlockSz);
+}
+
+void dexUnquicken_destroyIter(dexCodeIter *pIter) { arena_destroy(&pIter->irArena); }
+
+static void dumpIrInsn(
+    dexCodeIter *pIter, const u1 *dexFileBuf, u2 *insns, u4 irIdx, bool highlight) {
+  dexIrInsn insn;
+  dexIr_getInsn(&pIter->ir, irIdx, &insn);
+  dex_dumpIrInstruction(dexFileBuf, insns, &insn, pIter->cur_code_off, highlight);
+}
+
+static void iterStart(dexCodeIter *pIter, const u1 *dexFileBuf, dexMethod *pDexMethod) {
+  dexCode *pDexCode = (dexCode *)(dexFileBuf + pDexMethod->codeOff);
+  pIter->code_ptr = pDexCode->insns;
+  pIter->code_end = pDexCode->insns + pDexCode->insns_size;
+  pIter->dex_pc = 0;
+  pIter->cur_code_off = dex_getFirstInstrOff(pDexMethod);
+}
+
+static void iterAdvance(dexCodeIter *pIter, u2 *insns) {
+  u4 instruction_size = dexInstr_SizeInCodeUnits(insns);
+  pIter->code_ptr += instruction_size;
+  pIter->dex_pc += instruction_size;
+  pIter->cur_code_off += instruction_size * sizeof(u2);
+  pIter->instructions++;
+}
+
+static size_t iterCopyUnits(const dexCodeIter *pIter) {
+  size_t units = pIter->code_end - pIter->code_ptr;
+  return units > kDexMaxPatchedInsnUnits ? kDexMaxPatchedInsnUnits : units;
+}
+
+// Instruction to rewrite, which is a copy of the code when recording patches
+static u2 *iterInsns(dexCodeIter *pIter) {
+  if (pIter->pPatches == NULL) {
+    return pIter->code_ptr;
+  }
+  memset(pIter->insns_copy, 0, sizeof(pIter->insns_copy));
+  memcpy(pIter->insns_copy, pIter->code_ptr, iterCopyUnits(pIter) * sizeof(u2));
+  return pIter->insns_copy;
+}
+
+// Records the changes of a rewritten instruction copy. Returns the instruction to advance over,
+// which is the copy only if it changed since the size of payloads can't be decoded from it.
+static u2 *iterCommit(dexCodeIter *pIter, const u1 *dexFileBuf, u2 *insns) {
+  if (insns == pIter->code_ptr) {
+    return insns;
+  }
+  bool changed = dexPatch_recordInstruction(pIter->pPatches, dexFileBuf, pIter->code_ptr, insns,
+                                            (u4)iterCopyUnits(pIter));
+  return changed ? insns : pIter->code_ptr;
+}
+
+// Rewrites a quickened instruction. Returns whether the disassembler reports it as changed.
+static bool unquickenInstruction(dexCodeIter *pIter,
+                                 u2 *insns,
+                                 const dexUnquickenRemap *pRemap,
+                                 const dexUnquickenIndexSource *pSource,
+                                 bool decompileReturn) {
+  u2 indices[2];
+  switch (pRemap->operand) {
+    case kUnquickenReturnVoid:
+      if (decompileReturn) {
+        dexInstr_SetOpcode(insns, pRemap->opcode);
+      }
+      return true;
+    case kUnquickenNop:
+      switch (pSource->nopIndices(pSource->arg, pIter->dex_pc, indices)) {
+        case kNopCheckCast:
+          dexInstr_SetOpcode(insns, pRemap->opcode);
+          dexInstr_SetVRegA_21c(insns, indices[0]);
+          dexInstr_SetVRegB_21c(insns, indices[1]);
+          return true;
+        case kNopUnresolved:
+          return true;
+        default:
+          return false;
+      }
+    case kUnquickenVRegC_22c:
+      indices[0] = pSource->nextIndex(pSource->arg, pIter->dex_pc);
+      dexInstr_SetOpcode(insns, pRemap->opcode);
+      dexInstr_SetVRegC_22c(insns, indices[0]);
+      return true;
+    case kUnquickenVRegB_35c:
+      indices[0] = pSource->nextIndex(pSource->arg, pIter->dex_pc);
+      dexInstr_SetOpcode(insns, pRemap->opcode);
+      dexInstr_SetVRegB_35c(insns, indices[0]);
+      return true;
+    case kUnquickenVRegB_3rc:
+      indices[0] = pSource->nextIndex(pSource->arg, pIter->dex_pc);
+      dexInstr_SetOpcode(insns, pRemap->opcode);
+      dexInstr_SetVRegB_3rc(insns, indices[0]);
+      return true;
+    default:
+      return false;
+  }
+}
+
+void dexUnquicken_method(dexCodeIter *pIter,
+                         const u1 *dexFileBuf,
+                         dexMethod *pDexMethod,
+                         const dexUnquickenIndexSource *pSource,
+                         bool decompileReturn) {
+  bool disassemble = dex_getDisassemblerStatus();
+  iterStart(pIter, dexFileBuf, pDexMethod);
+  if (disassemble) {
+    // Instructions are decoded as they are visited, since unquickening a nop may change the
+    // boundaries of the following ones
+    arena_reset(&pIter->irArena);
+    dexIr_initMethod(&pIter->irArena, pIter->code_end - pIter->code_ptr, &pIter->ir);
+  }
+
+  while (pIter->code_ptr < pIter->code_end) {
+    const dexUnquickenRemap *pRemap = &kDexUnquickenRemap[dexInstr_getOpcode(pIter->code_ptr)];
+    u4 irIdx = 0;
+    if (disassemble) {
+      irIdx = dexIr_appendInsn(&pIter->ir, pIter->code_ptr, pIter->dex_pc);
+      dumpIrInsn(pIter, dexFileBuf, pIter->code_ptr, irIdx, false);
+    }
+
+    // Most instructions aren't quickened, advance over them without any bookkeeping
+    if (LIKELY(pRemap->operand == kUnquickenNone)) {
+      iterAdvance(pIter, pIter->code_ptr);
+      continue;
+    }
+
+    u2 *insns = iterInsns(pIter);
+    if (unquickenInstruction(pIter, insns, pRemap, pSource, decompileReturn) && disassemble) {
+      dexIr_updateInsn(&pIter->ir, irIdx, insns);
+      dumpIrInsn(pIter, dexFileBuf, insns, irIdx, true);
+    }
+    iterAdvance(pIter, iterCommit(pIter, dexFileBuf, insns));
+  }
+}
+
+void dexUnquicken_walk(dexCodeIter *pIter, const u1 *dexFileBuf, dexMethod *pDexMethod) {
+  // Nothing to do besides disassembling
+  if (!dex_getDisassemblerStatus()) {
+    pIter->skippedMethods++;
+    return;
+  }
+
+  iterStart(pIter, dexFileBuf, pDexMethod);
+  arena_reset(&pIter->irArena);
+  dexIr_decodeMethod(&pIter->irArena, pIter->code_ptr, pIter->code_end - pIter->code_ptr,
+                     &pIter->ir);
+  for (u4 i = 0; i < pIter->ir.count; ++i) {
+    dumpIrInsn(pIter, dexFileBuf, pIter->code_ptr, i, false);
+    pIter->code_ptr += pIter->ir.width[i];
+    pIter->dex_pc += pIter->ir.width[i];
+    pIter->cur_code_off += pIter->ir.width[i] * sizeof(u2);
+    pIter->instructions++;
+  }
+}
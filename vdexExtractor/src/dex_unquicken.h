@@ -0,0 +1,104 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _DEX_UNQUICKEN_H_
+#define _DEX_UNQUICKEN_H_
+
+#include "common.h"
+#include "dex.h"
+#include "arena.h"
+#include "dex_instruction.h"
+#include "dex_ir.h"
+#include "dex_patch.h"
+
+// Operand restored when unquickening an opcode
+typedef enum {
+  kUnquickenNone = 0,
+  kUnquickenReturnVoid,  // return-void-no-barrier, no index
+  kUnquickenNop,         // nop hiding an elided check-cast, type & register indices
+  kUnquickenVRegC_22c,   // field offset replaced by the field index
+  kUnquickenVRegB_35c,   // vtable offset replaced by the method index
+  kUnquickenVRegB_3rc,
+} dexUnquickenOperand;
+
+// Opcode remap entry, generated from the instruction X-macros. The operand tells which indices
+// are consumed: one from nextIndex for field & vtable offsets, two from nopIndices for a nop.
+typedef struct {
+  u1 opcode;
+  u1 operand;
+} dexUnquickenRemap;
+
+extern const dexUnquickenRemap kDexUnquickenRemap[256];
+
+// Bytecode iterator shared by the decompilers of all Vdex versions
+typedef struct {
+  u2 *code_ptr;
+  u2 *code_end;
+  u4 dex_pc;
+  u4 cur_code_off;
+
+  // When set, quickened instructions are rewritten in a copy & the changed code units recorded
+  // here, leaving the Dex file buffer untouched
+  dexPatchList *pPatches;
+  u2 insns_copy[kDexMaxPatchedInsnUnits];
+
+  // Instructions visited & methods skipped without visiting them since the iterator was created
+  u8 instructions;
+  u8 skippedMethods;
+
+  // When disassembling, each instruction of the current method is decoded once in the IR, which
+  // the disassembler reads from. Backed by an arena reset for every method.
+  arena_t irArena;
+  dexIrMethod ir;
+} dexCodeIter;
+
+// Outcome of restoring a nop
+typedef enum {
+  kNopPlain = 0,    // genuine nop
+  kNopCheckCast,    // check-cast restored from the indices
+  kNopUnresolved,   // no quickening data to tell, reported as a code change by the disassembler
+} dexUnquickenNop;
+
+// Version specific source of the indices stripped from quickened instructions
+typedef struct {
+  u2 (*nextIndex)(void *, u4);
+  dexUnquickenNop (*nopIndices)(void *, u4, u2 *);
+  void *arg;
+} dexUnquickenIndexSource;
+
+void dexUnquicken_initIter(dexCodeIter *, dexPatchList *);
+void dexUnquicken_destroyIter(dexCodeIter *);
+
+// Scans the code units of a method for any whose low byte is a quickened opcode, other than nop.
+// False positives are possible since operands are scanned as well, but a method without any
+// candidate has nothing to unquicken unless quickening info says a nop hides a check-cast.
+// Methods rejected are accounted as skipped.
+bool dexUnquicken_prefilter(dexCodeIter *, const u1 *, dexMethod *);
+
+// Unquickens the bytecode of a method using the remap table
+void dexUnquicken_method(
+    dexCodeIter *, const u1 *, dexMethod *, const dexUnquickenIndexSource *, bool);
+
+// Visits the bytecode of a method, disassembling it if enabled
+void dexUnquicken_walk(dexCodeIter *, const u1 *, dexMethod *);
+
+#endif
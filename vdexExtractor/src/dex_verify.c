@@ -0,0 +1,316 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stddef.h>
+
+#include "dex.h"
+#include "dex_verify.h"
+
+#define kDexEndianConstant 0x12345678
+
+// Map item types of fixed size entries, which are checked against their id table as well
+#define kDexTypeHeaderItem 0x0000
+#define kDexTypeStringIdItem 0x0001
+#define kDexTypeTypeIdItem 0x0002
+#define kDexTypeProtoIdItem 0x0003
+#define kDexTypeFieldIdItem 0x0004
+#define kDexTypeMethodIdItem 0x0005
+#define kDexTypeClassDefItem 0x0006
+#define kDexTypeMapList 0x1000
+
+typedef struct {
+  const u1 *buf;
+  const dexHeader *pDexHeader;
+  u4 fileSize;
+} dexVerifyCtx;
+
+#define VERIFY_FAIL(...)            \
+  do {                              \
+    LOGMSG(l_ERROR, __VA_ARGS__);   \
+    return false;                   \
+  } while (false) /**/
+
+// Checks that [off, off + count * elemSz) lies within the file, in 64 bits so it can't wrap
+static bool isInFile(const dexVerifyCtx *ctx, u4 off, u8 count, u8 elemSz) {
+  return (u8)off + count * elemSz <= ctx->fileSize;
+}
+
+// Bounded counterpart of dex_readULeb128(), fails instead of reading past the end of the file
+static bool readULeb128(const dexVerifyCtx *ctx, const u1 **pStream, u4 *pValue) {
+  const u1 *ptr = *pStream;
+  const u1 *end = ctx->buf + ctx->fileSize;
+  u4 result = 0;
+  for (u4 shift = 0; shift < 35; shift += 7) {
+    if (ptr >= end) return false;
+    u1 cur = *(ptr++);
+    result |= (u4)(cur & 0x7f) << shift;
+    if (cur <= 0x7f) {
+      *pStream = ptr;
+      *pValue = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool verifyTable(const dexVerifyCtx *ctx, const char *name, u4 size, u4 off, u8 elemSz) {
+  if (size != 0 && !isInFile(ctx, off, size, elemSz)) {
+    VERIFY_FAIL("Dex %s (%" PRIu32 " at offset 0x%" PRIx32 ") exceed the file size", name, size,
+                off);
+  }
+  return true;
+}
+
+static bool verifyHeader(dexVerifyCtx *ctx, size_t maxSize) {
+  const dexHeader *pDexHeader = ctx->pDexHeader;
+  if (maxSize < sizeof(dexHeader)) VERIFY_FAIL("Buffer too small for a Dex header");
+  if (pDexHeader->fileSize < sizeof(dexHeader) || pDexHeader->fileSize > maxSize) {
+    VERIFY_FAIL("Invalid Dex file size (%" PRIu32 " bytes)", pDexHeader->fileSize);
+  }
+  if (pDexHeader->headerSize < sizeof(dexHeader) ||
+      pDexHeader->headerSize > pDexHeader->fileSize) {
+    VERIFY_FAIL("Invalid Dex header size (%" PRIu32 " bytes)", pDexHeader->headerSize);
+  }
+  if (pDexHeader->endianTag != kDexEndianConstant) {
+    VERIFY_FAIL("Unexpected Dex endian tag (0x%" PRIx32 ")", pDexHeader->endianTag);
+  }
+  ctx->fileSize = pDexHeader->fileSize;
+
+  if (!verifyTable(ctx, "string ids", pDexHeader->stringIdsSize, pDexHeader->stringIdsOff,
+                   sizeof(dexStringId)) ||
+      !verifyTable(ctx, "type ids", pDexHeader->typeIdsSize, pDexHeader->typeIdsOff,
+                   sizeof(dexTypeId)) ||
+      !verifyTable(ctx, "proto ids", pDexHeader->protoIdsSize, pDexHeader->protoIdsOff,
+                   sizeof(dexProtoId)) ||
+      !verifyTable(ctx, "field ids", pDexHeader->fieldIdsSize, pDexHeader->fieldIdsOff,
+                   sizeof(dexFieldId)) ||
+      !verifyTable(ctx, "method ids", pDexHeader->methodIdsSize, pDexHeader->methodIdsOff,
+                   sizeof(dexMethodId)) ||
+      !verifyTable(ctx, "class defs", pDexHeader->classDefsSize, pDexHeader->classDefsOff,
+                   sizeof(dexClassDef)) ||
+      !verifyTable(ctx, "data", pDexHeader->dataSize, pDexHeader->dataOff, 1) ||
+      !verifyTable(ctx, "link data", pDexHeader->linkSize, pDexHeader->linkOff, 1)) {
+    return false;
+  }
+
+  // Type & proto ids are referenced through 16-bit fields of the other tables
+  if (pDexHeader->typeIdsSize > UINT16_MAX + 1 || pDexHeader->protoIdsSize > UINT16_MAX + 1) {
+    VERIFY_FAIL("Too many Dex type (%" PRIu32 ") or proto (%" PRIu32 ") ids",
+                pDexHeader->typeIdsSize, pDexHeader->protoIdsSize);
+  }
+  return true;
+}
+
+static bool verifyMapList(const dexVerifyCtx *ctx) {
+  const dexHeader *pDexHeader = ctx->pDexHeader;
+  u4 mapOff = pDexHeader->mapOff;
+  if (mapOff == 0) return true;
+  if ((mapOff & 3) != 0 || !isInFile(ctx, mapOff, 1, sizeof(u4))) {
+    VERIFY_FAIL("Invalid Dex map list offset (0x%" PRIx32 ")", mapOff);
+  }
+  const dexMapList *pMapList = (const dexMapList *)(ctx->buf + mapOff);
+  if (!isInFile(ctx, mapOff + sizeof(u4), pMapList->size, sizeof(dexMapItem))) {
+    VERIFY_FAIL("Dex map list (%" PRIu32 " items) exceeds the file size", pMapList->size);
+  }
+
+  for (u4 i = 0; i < pMapList->size; ++i) {
+    const dexMapItem *pItem = &pMapList->list[i];
+    u8 elemSz = 1;
+    switch (pItem->type) {
+      case kDexTypeHeaderItem:
+        elemSz = sizeof(dexHeader);
+        break;
+      case kDexTypeStringIdItem:
+        elemSz = sizeof(dexStringId);
+        break;
+      case kDexTypeTypeIdItem:
+        elemSz = sizeof(dexTypeId);
+        break;
+      case kDexTypeProtoIdItem:
+        elemSz = sizeof(dexProtoId);
+        break;
+      case kDexTypeFieldIdItem:
+        elemSz = sizeof(dexFieldId);
+        break;
+      case kDexTypeMethodIdItem:
+        elemSz = sizeof(dexMethodId);
+        break;
+      case kDexTypeClassDefItem:
+        elemSz = sizeof(dexClassDef);
+        break;
+      case kDexTypeMapList:
+        if (pItem->offset != mapOff) VERIFY_FAIL("Dex map list entry doesn't point to itself");
+        break;
+      default:
+        // Variable sized data items, only their start is checked here
+        break;
+    }
+    if (pItem->offset >= ctx->fileSize || !isInFile(ctx, pItem->offset, pItem->size, elemSz)) {
+      VERIFY_FAIL("Dex map item #%" PRIu32 " (type 0x%" PRIx16 ") exceeds the file size", i,
+                  pItem->type);
+    }
+  }
+  return true;
+}
+
+// String data is a uleb128 length followed by a NUL terminated MUTF-8 string
+static bool verifyStringIds(const dexVerifyCtx *ctx) {
+  const dexHeader *pDexHeader = ctx->pDexHeader;
+  const dexStringId *pStringIds = (const dexStringId *)(ctx->buf + pDexHeader->stringIdsOff);
+  for (u4 i = 0; i < pDexHeader->stringIdsSize; ++i) {
+    const u1 *ptr = ctx->buf + pStringIds[i].stringDataOff;
+    u4 utf16Len;
+    if (pStringIds[i].stringDataOff >= ctx->fileSize || !readULeb128(ctx, &ptr, &utf16Len) ||
+        memchr(ptr, '\0', ctx->buf + ctx->fileSize - ptr) == NULL) {
+      VERIFY_FAIL("Dex string id #%" PRIu32 " has invalid data at offset 0x%" PRIx32, i,
+                  pStringIds[i].stringDataOff);
+    }
+  }
+  return true;
+}
+
+static bool verifyTypeList(const dexVerifyCtx *ctx, u4 off) {
+  if ((off & 3) != 0 || !isInFile(ctx, off, 1, sizeof(u4))) return false;
+  const dexTypeList *pTypeList = (const dexTypeList *)(ctx->buf + off);
+  if (!isInFile(ctx, off + sizeof(u4), pTypeList->size, sizeof(dexTypeItem))) return false;
+  for (u4 i = 0; i < pTypeList->size; ++i) {
+    if (pTypeList->list[i].typeIdx >= ctx->pDexHeader->typeIdsSize) return false;
+  }
+  return true;
+}
+
+static bool verifyIds(const dexVerifyCtx *ctx) {
+  const dexHeader *pDexHeader = ctx->pDexHeader;
+  const u1 *buf = ctx->buf;
+
+  const dexTypeId *pTypeIds = (const dexTypeId *)(buf + pDexHeader->typeIdsOff);
+  for (u4 i = 0; i < pDexHeader->typeIdsSize; ++i) {
+    if (pTypeIds[i].descriptorIdx >= pDexHeader->stringIdsSize) {
+      VERIFY_FAIL("Dex type id #%" PRIu32 " has an invalid descriptor", i);
+    }
+  }
+
+  const dexProtoId *pProtoIds = (const dexProtoId *)(buf + pDexHeader->protoIdsOff);
+  for (u4 i = 0; i < pDexHeader->protoIdsSize; ++i) {
+    if (pProtoIds[i].shortyIdx >= pDexHeader->stringIdsSize ||
+        pProtoIds[i].returnTypeIdx >= pDexHeader->typeIdsSize ||
+        (pProtoIds[i].parametersOff != 0 && !verifyTypeList(ctx, pProtoIds[i].parametersOff))) {
+      VERIFY_FAIL("Dex proto id #%" PRIu32 " is invalid", i);
+    }
+  }
+
+  const dexFieldId *pFieldIds = (const dexFieldId *)(buf + pDexHeader->fieldIdsOff);
+  for (u4 i = 0; i < pDexHeader->fieldIdsSize; ++i) {
+    if (pFieldIds[i].classIdx >= pDexHeader->typeIdsSize ||
+        pFieldIds[i].typeIdx >= pDexHeader->typeIdsSize ||
+        pFieldIds[i].nameIdx >= pDexHeader->stringIdsSize) {
+      VERIFY_FAIL("Dex field id #%" PRIu32 " is invalid", i);
+    }
+  }
+
+  const dexMethodId *pMethodIds = (const dexMethodId *)(buf + pDexHeader->methodIdsOff);
+  for (u4 i = 0; i < pDexHeader->methodIdsSize; ++i) {
+    if (pMethodIds[i].classIdx >= pDexHeader->typeIdsSize ||
+        pMethodIds[i].protoIdx >= pDexHeader->protoIdsSize ||
+        pMethodIds[i].nameIdx >= pDexHeader->stringIdsSize) {
+      VERIFY_FAIL("Dex method id #%" PRIu32 " is invalid", i);
+    }
+  }
+  return true;
+}
+
+// Code item header, instructions & try items (handlers are never parsed)
+static bool verifyCodeItem(const dexVerifyCtx *ctx, u4 codeOff) {
+  if ((codeOff & 3) != 0 || !isInFile(ctx, codeOff, 1, offsetof(dexCode, insns))) return false;
+  const dexCode *pDexCode = (const dexCode *)(ctx->buf + codeOff);
+  u8 insnsEnd = (u8)codeOff + offsetof(dexCode, insns) + (u8)pDexCode->insns_size * sizeof(u2);
+  if (insnsEnd > ctx->fileSize) return false;
+  if (pDexCode->tries_size != 0) {
+    u8 triesEnd = ((insnsEnd + 3) & ~3ULL) + (u8)pDexCode->tries_size * sizeof(dexTryItem);
+    if (triesEnd > ctx->fileSize) return false;
+  }
+  return true;
+}
+
+// Walks one list of encoded fields or methods, whose indexes are delta encoded
+static bool verifyClassDataMembers(const dexVerifyCtx *ctx,
+                                   const u1 **pCursor,
+                                   u4 count,
+                                   bool isMethod) {
+  u4 idsSize = isMethod ? ctx->pDexHeader->methodIdsSize : ctx->pDexHeader->fieldIdsSize;
+  u8 idx = 0;
+  for (u4 i = 0; i < count; ++i) {
+    u4 idxDelta, accessFlags, codeOff = 0;
+    if (!readULeb128(ctx, pCursor, &idxDelta) || !readULeb128(ctx, pCursor, &accessFlags) ||
+        (isMethod && !readULeb128(ctx, pCursor, &codeOff))) {
+      return false;
+    }
+    idx += idxDelta;
+    if (idx >= idsSize || (codeOff != 0 && !verifyCodeItem(ctx, codeOff))) return false;
+  }
+  return true;
+}
+
+static bool verifyClassDefs(const dexVerifyCtx *ctx) {
+  const dexHeader *pDexHeader = ctx->pDexHeader;
+  const dexClassDef *pClassDefs = (const dexClassDef *)(ctx->buf + pDexHeader->classDefsOff);
+  for (u4 i = 0; i < pDexHeader->classDefsSize; ++i) {
+    const dexClassDef *pClassDef = &pClassDefs[i];
+    if (pClassDef->classIdx >= pDexHeader->typeIdsSize ||
+        (pClassDef->superclassOdx != kDexNoIndex &&
+         pClassDef->superclassOdx >= pDexHeader->typeIdsSize) ||
+        (pClassDef->sourceFileIdx != kDexNoIndex &&
+         pClassDef->sourceFileIdx >= pDexHeader->stringIdsSize) ||
+        (pClassDef->interfacesOff != 0 && !verifyTypeList(ctx, pClassDef->interfacesOff)) ||
+        pClassDef->annotationsOff >= ctx->fileSize ||
+        pClassDef->staticValuesOff >= ctx->fileSize) {
+      VERIFY_FAIL("Dex class def #%" PRIu32 " is invalid", i);
+    }
+    if (pClassDef->classDataOff == 0) continue;
+
+    const u1 *cursor = ctx->buf + pClassDef->classDataOff;
+    dexClassDataHeader hdr;
+    if (pClassDef->classDataOff >= ctx->fileSize ||
+        !readULeb128(ctx, &cursor, &hdr.staticFieldsSize) ||
+        !readULeb128(ctx, &cursor, &hdr.instanceFieldsSize) ||
+        !readULeb128(ctx, &cursor, &hdr.directMethodsSize) ||
+        !readULeb128(ctx, &cursor, &hdr.virtualMethodsSize) ||
+        !verifyClassDataMembers(ctx, &cursor, hdr.staticFieldsSize, false) ||
+        !verifyClassDataMembers(ctx, &cursor, hdr.instanceFieldsSize, false) ||
+        !verifyClassDataMembers(ctx, &cursor, hdr.directMethodsSize, true) ||
+        !verifyClassDataMembers(ctx, &cursor, hdr.virtualMethodsSize, true)) {
+      VERIFY_FAIL("Dex class def #%" PRIu32 " has invalid class data at offset 0x%" PRIx32, i,
+                  pClassDef->classDataOff);
+    }
+  }
+  return true;
+}
+
+bool dexVerify_dexFile(const u1 *dexFileBuf, size_t maxSize) {
+  dexVerifyCtx ctx = {
+    .buf = dexFileBuf,
+    .pDexHeader = (const dexHeader *)dexFileBuf,
+    .fileSize = 0,
+  };
+  return verifyHeader(&ctx, maxSize) && verifyMapList(&ctx) && verifyStringIds(&ctx) &&
+         verifyIds(&ctx) && verifyClassDefs(&ctx);
+}
@@ -0,0 +1,37 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _DEX_VERIFY_H_
+#define _DEX_VERIFY_H_
+
+#include "common.h"
+
+// One-time structural validation of a Dex file mapped in a buffer of the given size. The header,
+// map list, every id table & class def, as well as the class data & code items they reference,
+// are checked against the file size and the id table sizes. Returns false (with the reason
+// logged) on the first violation.
+//
+// Ids read out of a Dex file that passed are in range, so they can be resolved with the unchecked
+// dex_*Unchecked() accessors. Ids coming from bytecode operands or Vdex deps are not covered.
+bool dexVerify_dexFile(const u1 *, size_t);
+
+#endif
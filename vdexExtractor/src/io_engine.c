@@ -0,0 +1,480 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "io_engine.h"
+#include "utils.h"
+
+#ifdef VDEX_HAVE_IO_URING
+#include <linux/io_uring.h>
+
+// IORING_OP_OPENAT, IORING_OP_CLOSE & the opcode probe came with the 5.6 UAPI. The opcodes are
+// enumerators, so the probe's flag macro tells whether the header has them.
+#ifndef IO_URING_OP_SUPPORTED
+#undef VDEX_HAVE_IO_URING
+#endif
+#endif
+
+// Read without the ring lock by ioEngine_isUring(), so it's atomic
+static _Atomic bool ioEngine_uring;
+
+// Vectors handed to a single writev
+#define kMaxIovPerWrite 256
+
+static size_t iovTotal(const struct iovec *iov, int iovCnt) {
+  size_t total = 0;
+  for (int i = 0; i < iovCnt; ++i) {
+    total += iov[i].iov_len;
+  }
+  return total;
+}
+
+// Copies up to kMaxIovPerWrite vectors of what remains to be written after skip bytes
+static int iovSlice(const struct iovec *iov, int iovCnt, size_t skip, struct iovec *out) {
+  int i = 0;
+  while (i < iovCnt && skip >= iov[i].iov_len) {
+    skip -= iov[i].iov_len;
+    i++;
+  }
+  int outCnt = 0;
+  for (; i < iovCnt && outCnt < kMaxIovPerWrite; ++i, ++outCnt) {
+    out[outCnt].iov_base = (u1 *)iov[i].iov_base + skip;
+    out[outCnt].iov_len = iov[i].iov_len - skip;
+    skip = 0;
+  }
+  return outCnt;
+}
+
+static bool writevToFd(int fd, const struct iovec *iov, int iovCnt) {
+  struct iovec slice[kMaxIovPerWrite];
+  size_t total = iovTotal(iov, iovCnt);
+  size_t written = 0;
+  while (written < total) {
+    int sliceCnt = iovSlice(iov, iovCnt, written, slice);
+    ssize_t sz = writev(fd, slice, sliceCnt);
+    if (sz < 0 && errno == EINTR) continue;
+    if (sz <= 0) return false;
+    written += sz;
+  }
+  return true;
+}
+
+// Writes all contents to an open fd & closes it
+static void finishFile(ioEngine_writeReq_t *pReq, int fd) {
+  errno = 0;
+  if (!writevToFd(fd, pReq->iov, pReq->iovCnt)) {
+    pReq->err = errno ? errno : EIO;
+  }
+  if (close(fd) != 0 && pReq->err == 0) {
+    pReq->err = errno;
+  }
+}
+
+static void writeFileBlocking(ioEngine_writeReq_t *pReq, int flags) {
+  pReq->err = 0;
+  int fd = open(pReq->path, flags, pReq->mode);
+  if (fd == -1) {
+    pReq->err = errno;
+    return;
+  }
+  finishFile(pReq, fd);
+}
+
+static void writeFilesBlocking(ioEngine_writeReq_t *reqs, size_t reqsCnt) {
+  for (size_t i = 0; i < reqsCnt; ++i) {
+    writeFileBlocking(&reqs[i], reqs[i].flags);
+  }
+}
+
+#ifdef VDEX_HAVE_IO_URING
+
+#define kRingEntries 64U
+
+typedef struct {
+  int fd;
+  void *sqRingPtr;
+  size_t sqRingSz;
+  void *cqRingPtr;
+  size_t cqRingSz;
+  struct io_uring_sqe *sqes;
+  size_t sqesSz;
+  _Atomic u4 *sqHead;
+  _Atomic u4 *sqTail;
+  u4 sqMask;
+  u4 *sqArray;
+  _Atomic u4 *cqHead;
+  _Atomic u4 *cqTail;
+  u4 cqMask;
+  struct io_uring_cqe *cqes;
+} ioEngine_ring_t;
+
+// The ring is driven by one thread at a time under the lock. ioEngine_uring must be checked again
+// once the lock is held, since a failed batch tears the ring down.
+static ioEngine_ring_t ioEngine_ring = { .fd = -1 };
+static pthread_mutex_t ioEngine_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void ringDestroy(ioEngine_ring_t *pRing) {
+  if (pRing->sqes) munmap(pRing->sqes, pRing->sqesSz);
+  if (pRing->cqRingPtr && pRing->cqRingPtr != pRing->sqRingPtr) {
+    munmap(pRing->cqRingPtr, pRing->cqRingSz);
+  }
+  if (pRing->sqRingPtr) munmap(pRing->sqRingPtr, pRing->sqRingSz);
+  if (pRing->fd != -1) close(pRing->fd);
+  memset(pRing, 0, sizeof(ioEngine_ring_t));
+  pRing->fd = -1;
+}
+
+// Kernels before 5.6 set rings up but fail OPENAT & CLOSE with -EINVAL. These also lack the
+// opcode probe, so a failed probe means the ring can't be used either.
+static bool ringSupportsOps(int ringFd) {
+  static const u1 kOps[] = { IORING_OP_OPENAT, IORING_OP_WRITEV, IORING_OP_CLOSE };
+  size_t probeSz = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *pProbe = utils_calloc(probeSz);
+  bool ret = true;
+
+  if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, pProbe, 256) == -1) {
+    LOGMSG_P(l_DEBUG, "io_uring opcode probe failed");
+    ret = false;
+  }
+  for (size_t i = 0; i < sizeof(kOps) && ret; ++i) {
+    if (kOps[i] >= pProbe->ops_len || !(pProbe->ops[kOps[i]].flags & IO_URING_OP_SUPPORTED)) {
+      LOGMSG(l_DEBUG, "io_uring opcode %" PRIu8 " is not supported", kOps[i]);
+      ret = false;
+    }
+  }
+  free(pProbe);
+  return ret;
+}
+
+static bool ringInit(ioEngine_ring_t *pRing) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  pRing->fd = (int)syscall(__NR_io_uring_setup, kRingEntries, &params);
+  if (pRing->fd == -1) {
+    LOGMSG_P(l_DEBUG, "io_uring_setup() failed");
+    return false;
+  }
+  if (!ringSupportsOps(pRing->fd)) {
+    ringDestroy(pRing);
+    return false;
+  }
+
+  pRing->sqRingSz = params.sq_off.array + params.sq_entries * sizeof(u4);
+  pRing->cqRingSz = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (pRing->cqRingSz > pRing->sqRingSz) pRing->sqRingSz = pRing->cqRingSz;
+    pRing->cqRingSz = pRing->sqRingSz;
+  }
+
+  pRing->sqRingPtr = mmap(NULL, pRing->sqRingSz, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, pRing->fd, IORING_OFF_SQ_RING);
+  if (pRing->sqRingPtr == MAP_FAILED) {
+    pRing->sqRingPtr = NULL;
+    goto fail;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    pRing->cqRingPtr = pRing->sqRingPtr;
+  } else {
+    pRing->cqRingPtr = mmap(NULL, pRing->cqRingSz, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, pRing->fd, IORING_OFF_CQ_RING);
+    if (pRing->cqRingPtr == MAP_FAILED) {
+      pRing->cqRingPtr = NULL;
+      goto fail;
+    }
+  }
+  pRing->sqesSz = params.sq_entries * sizeof(struct io_uring_sqe);
+  pRing->sqes = mmap(NULL, pRing->sqesSz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     pRing->fd, IORING_OFF_SQES);
+  if (pRing->sqes == MAP_FAILED) {
+    pRing->sqes = NULL;
+    goto fail;
+  }
+
+  u1 *sq = (u1 *)pRing->sqRingPtr;
+  u1 *cq = (u1 *)pRing->cqRingPtr;
+  pRing->sqHead = (_Atomic u4 *)(sq + params.sq_off.head);
+  pRing->sqTail = (_Atomic u4 *)(sq + params.sq_off.tail);
+  pRing->sqMask = *(u4 *)(sq + params.sq_off.ring_mask);
+  pRing->sqArray = (u4 *)(sq + params.sq_off.array);
+  pRing->cqHead = (_Atomic u4 *)(cq + params.cq_off.head);
+  pRing->cqTail = (_Atomic u4 *)(cq + params.cq_off.tail);
+  pRing->cqMask = *(u4 *)(cq + params.cq_off.ring_mask);
+  pRing->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  return true;
+
+fail:
+  LOGMSG_P(l_DEBUG, "Couldn't map io_uring rings");
+  ringDestroy(pRing);
+  return false;
+}
+
+// Entry n of the next batch. It isn't visible to the kernel until ringSubmitAndReap() publishes
+// the whole batch, so it can't be consumed half written. Caller guarantees that no more than
+// kRingEntries requests are in flight.
+static struct io_uring_sqe *ringGetSqe(ioEngine_ring_t *pRing, u4 n) {
+  u4 idx = (atomic_load_explicit(pRing->sqTail, memory_order_relaxed) + n) & pRing->sqMask;
+  struct io_uring_sqe *pSqe = &pRing->sqes[idx];
+  memset(pSqe, 0, sizeof(struct io_uring_sqe));
+  pRing->sqArray[idx] = idx;
+  return pSqe;
+}
+
+// Publishes the filled batch of entries, submits them and waits until as many completions have
+// been posted. Completions are handed to the callback along with their user data. On failure the
+// number of entries the kernel consumed (in queue order) is stored, their completions may still
+// be pending.
+static bool ringSubmitAndReap(ioEngine_ring_t *pRing,
+                              u4 toSubmit,
+                              void (*cqeCb)(u8, s4, void *),
+                              void *cbArg,
+                              u4 *pSubmitted) {
+  u4 tail = atomic_load_explicit(pRing->sqTail, memory_order_relaxed);
+  atomic_store_explicit(pRing->sqTail, tail + toSubmit, memory_order_release);
+
+  u4 submitted = 0, reaped = 0;
+  while (reaped < toSubmit) {
+    int ret = (int)syscall(__NR_io_uring_enter, pRing->fd, toSubmit - submitted,
+                           toSubmit - reaped, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret < 0 && errno != EINTR) {
+      LOGMSG_P(l_ERROR, "io_uring_enter() failed");
+      *pSubmitted = submitted;
+      return false;
+    }
+    if (ret > 0) submitted += ret;
+
+    u4 head = atomic_load_explicit(pRing->cqHead, memory_order_relaxed);
+    u4 tail = atomic_load_explicit(pRing->cqTail, memory_order_acquire);
+    for (; head != tail; ++head, ++reaped) {
+      struct io_uring_cqe *pCqe = &pRing->cqes[head & pRing->cqMask];
+      cqeCb(pCqe->user_data, pCqe->res, cbArg);
+    }
+    atomic_store_explicit(pRing->cqHead, head, memory_order_release);
+  }
+  return true;
+}
+
+// Progress of a request through the ring, so that a failed batch can be finished with blocking
+// I/O without opening a file twice or touching an fd the kernel may be closing
+typedef enum {
+  kReqPending = 0,  // open not submitted
+  kReqOpening,      // open submitted, completion not reaped
+  kReqOpen,         // fd open, contents being written
+  kReqClosing,      // close submitted, completion not reaped
+  kReqDone,         // closed, or the open failed
+} writeReqState_t;
+
+typedef struct {
+  ioEngine_writeReq_t *reqs;
+  u1 *states;
+  int *fds;
+  size_t *written;
+} writeBatch_t;
+
+static void openDone(u8 userData, s4 res, void *arg) {
+  writeBatch_t *pBatch = (writeBatch_t *)arg;
+  if (res < 0) {
+    pBatch->reqs[userData].err = -res;
+    pBatch->states[userData] = kReqDone;
+  } else {
+    pBatch->fds[userData] = res;
+    pBatch->states[userData] = kReqOpen;
+  }
+}
+
+static void writeDone(u8 userData, s4 res, void *arg) {
+  writeBatch_t *pBatch = (writeBatch_t *)arg;
+  if (res < 0) {
+    pBatch->reqs[userData].err = -res;
+  } else if (res == 0) {
+    pBatch->reqs[userData].err = EIO;
+  } else {
+    pBatch->written[userData] += res;
+  }
+}
+
+static void closeDone(u8 userData, s4 res, void *arg) {
+  writeBatch_t *pBatch = (writeBatch_t *)arg;
+  if (res < 0 && pBatch->reqs[userData].err == 0) {
+    pBatch->reqs[userData].err = -res;
+  }
+  pBatch->fds[userData] = -1;
+  pBatch->states[userData] = kReqDone;
+}
+
+// Finishes the requests of a batch whose submission failed. Files never submitted are written as
+// usual. An open in flight may have created its file, so it's retried without O_EXCL. Open files
+// are written again from the start on their fd (ring writes are positional, so the file offset is
+// still 0) & closed. Closes in flight are left to the kernel.
+static void finishBatchBlocking(writeBatch_t *pBatch, size_t reqsCnt) {
+  for (size_t i = 0; i < reqsCnt; ++i) {
+    ioEngine_writeReq_t *pReq = &pBatch->reqs[i];
+    switch (pBatch->states[i]) {
+      case kReqPending:
+        writeFileBlocking(pReq, pReq->flags);
+        break;
+      case kReqOpening:
+        writeFileBlocking(pReq, pReq->flags & ~O_EXCL);
+        break;
+      case kReqOpen:
+        pReq->err = 0;
+        finishFile(pReq, pBatch->fds[i]);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// Runs the open, write (until no short writes remain) & close steps for up to kRingEntries files.
+// If a submission fails the batch is finished with blocking I/O & false is returned, as the ring
+// is no longer usable.
+static bool writeFilesUring(ioEngine_ring_t *pRing, ioEngine_writeReq_t *reqs, size_t reqsCnt) {
+  u1 states[kRingEntries];
+  int fds[kRingEntries];
+  size_t written[kRingEntries];
+  size_t totals[kRingEntries];
+  u4 closing[kRingEntries];
+  struct iovec(*slices)[kMaxIovPerWrite] = utils_malloc(reqsCnt * sizeof(*slices));
+  writeBatch_t batch = { .reqs = reqs, .states = states, .fds = fds, .written = written };
+  bool ret = false;
+  u4 queued = 0, submitted = 0;
+
+  for (size_t i = 0; i < reqsCnt; ++i) {
+    reqs[i].err = 0;
+    states[i] = kReqPending;
+    fds[i] = -1;
+    written[i] = 0;
+    totals[i] = iovTotal(reqs[i].iov, reqs[i].iovCnt);
+    struct io_uring_sqe *pSqe = ringGetSqe(pRing, i);
+    pSqe->opcode = IORING_OP_OPENAT;
+    pSqe->fd = AT_FDCWD;
+    pSqe->addr = (u8)(uintptr_t)reqs[i].path;
+    pSqe->open_flags = (u4)reqs[i].flags;
+    pSqe->len = reqs[i].mode;
+    pSqe->user_data = i;
+  }
+  if (!ringSubmitAndReap(pRing, reqsCnt, openDone, &batch, &submitted)) {
+    for (u4 i = 0; i < submitted; ++i) {
+      if (states[i] == kReqPending) states[i] = kReqOpening;
+    }
+    goto out;
+  }
+
+  for (;;) {
+    queued = 0;
+    for (size_t i = 0; i < reqsCnt; ++i) {
+      if (fds[i] == -1 || reqs[i].err != 0 || written[i] == totals[i]) continue;
+      struct io_uring_sqe *pSqe = ringGetSqe(pRing, queued);
+      pSqe->opcode = IORING_OP_WRITEV;
+      pSqe->fd = fds[i];
+      pSqe->addr = (u8)(uintptr_t)slices[i];
+      pSqe->len = (u4)iovSlice(reqs[i].iov, reqs[i].iovCnt, written[i], slices[i]);
+      pSqe->off = written[i];
+      pSqe->user_data = i;
+      queued++;
+    }
+    if (queued == 0) break;
+    if (!ringSubmitAndReap(pRing, queued, writeDone, &batch, &submitted)) goto out;
+  }
+
+  queued = 0;
+  for (size_t i = 0; i < reqsCnt; ++i) {
+    if (fds[i] == -1) continue;
+    struct io_uring_sqe *pSqe = ringGetSqe(pRing, queued);
+    pSqe->opcode = IORING_OP_CLOSE;
+    pSqe->fd = fds[i];
+    pSqe->user_data = i;
+    closing[queued++] = i;
+  }
+  ret = queued == 0 || ringSubmitAndReap(pRing, queued, closeDone, &batch, &submitted);
+  if (!ret) {
+    for (u4 i = 0; i < submitted; ++i) {
+      if (states[closing[i]] == kReqOpen) states[closing[i]] = kReqClosing;
+    }
+  }
+
+out:
+  if (!ret) finishBatchBlocking(&batch, reqsCnt);
+  free(slices);
+  return ret;
+}
+
+#endif
+
+void ioEngine_init(bool useUring) {
+  ioEngine_uring = false;
+  if (!useUring) {
+    return;
+  }
+#ifdef VDEX_HAVE_IO_URING
+  if (ringInit(&ioEngine_ring)) {
+    ioEngine_uring = true;
+    LOGMSG(l_DEBUG, "io_uring I/O engine initialized");
+    return;
+  }
+#endif
+  LOGMSG(l_WARN, "io_uring is not available - falling back to blocking I/O");
+}
+
+void ioEngine_destroy(void) {
+#ifdef VDEX_HAVE_IO_URING
+  if (ioEngine_uring) {
+    ringDestroy(&ioEngine_ring);
+  }
+#endif
+  ioEngine_uring = false;
+}
+
+bool ioEngine_isUring(void) { return ioEngine_uring; }
+
+void ioEngine_writeFiles(ioEngine_writeReq_t *reqs, size_t reqsCnt) {
+#ifdef VDEX_HAVE_IO_URING
+  if (ioEngine_uring) {
+    pthread_mutex_lock(&ioEngine_lock);
+    if (!ioEngine_uring) {
+      pthread_mutex_unlock(&ioEngine_lock);
+      writeFilesBlocking(reqs, reqsCnt);
+      return;
+    }
+    for (size_t i = 0; i < reqsCnt; i += kRingEntries) {
+      size_t cnt = reqsCnt - i < kRingEntries ? reqsCnt - i : kRingEntries;
+      if (!writeFilesUring(&ioEngine_ring, &reqs[i], cnt)) {
+        // Ring is unusable after a failed submission, the failed batch has been finished with
+        // blocking I/O & so are the ones after it
+        LOGMSG(l_WARN, "io_uring submission failed - falling back to blocking I/O");
+        ringDestroy(&ioEngine_ring);
+        ioEngine_uring = false;
+        pthread_mutex_unlock(&ioEngine_lock);
+        writeFilesBlocking(&reqs[i + cnt], reqsCnt - i - cnt);
+        return;
+      }
+    }
+    pthread_mutex_unlock(&ioEngine_lock);
+    return;
+  }
+#endif
+  writeFilesBlocking(reqs, reqsCnt);
+}
@@ -0,0 +1,60 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _IO_ENGINE_H_
+#define _IO_ENGINE_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "common.h"
+
+// io_uring support is compiled in when the kernel UAPI header is available & recent enough (see
+// io_engine.c). The ring is driven through the raw syscalls so there is no liburing dependency.
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define VDEX_HAVE_IO_URING 1
+#endif
+#endif
+
+// Output file creation request, with contents gathered from a scatter list. err is set to 0 on
+// success or the errno of the failed step.
+typedef struct {
+  const char *path;
+  int flags;
+  mode_t mode;
+  const struct iovec *iov;
+  int iovCnt;
+  int err;
+} ioEngine_writeReq_t;
+
+// Sets up the io_uring engine if requested. Falls back to blocking syscalls (with a warning) if
+// io_uring is unavailable, so it never fails.
+void ioEngine_init(bool);
+void ioEngine_destroy(void);
+bool ioEngine_isUring(void);
+
+// Opens, writes & closes a batch of files. With io_uring each step is submitted for the whole
+// batch at once, instead of a few syscalls per file.
+void ioEngine_writeFiles(ioEngine_writeReq_t *, size_t);
+
+#endif
@@ -20,6 +20,7 @@
 
 */
 
+#include <pthread.h>
 #include <stdarg.h>
 #include <sys/time.h>
 #include <time.h>
@@ -30,9 +31,17 @@
 static unsigned int log_minLevel;
 static bool log_isTTY;
 static bool inside_line;
-static bool dis_enabled;
 static int log_fd;
 static FILE *log_disOut;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Disassembler status is toggled by each worker for the file it processes. When capture is
+// enabled the disassembler output is buffered per thread and flushed in one piece, so that
+// concurrently processed files don't interleave their output.
+static _Thread_local bool dis_enabled;
+static _Thread_local FILE *dis_captureOut;
+static _Thread_local char *dis_captureBuf;
+static _Thread_local size_t dis_captureSz;
 
 __attribute__((constructor)) void log_init(void) {
   log_minLevel = l_INFO;
@@ -41,6 +50,21 @@ __attribute__((constructor)) void log_init(void) {
   log_disOut = stdout;
 }
 
+// Append formatted text to a fixed size message buffer, silently truncating on overflow
+static void logVAppend(char *buf, size_t bufSz, size_t *off, const char *fmt, va_list args) {
+  if (*off + 1 >= bufSz) return;
+  int n = vsnprintf(buf + *off, bufSz - *off, fmt, args);
+  if (n < 0) return;
+  *off = ((size_t)n < bufSz - *off) ? *off + n : bufSz - 1;
+}
+
+static void logAppend(char *buf, size_t bufSz, size_t *off, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  logVAppend(buf, bufSz, off, fmt, args);
+  va_end(args);
+}
+
 void log_setMinLevel(log_level_t dl) { log_minLevel = dl; }
 void log_setDisStatus(bool status) { dis_enabled = status; }
 bool log_getDisStatus() { return dis_enabled; }
@@ -59,6 +83,32 @@ bool log_initLogFile(const char *logFile) {
   return true;
 }
 
+void log_disBeginCapture() {
+  if (dis_captureOut != NULL) {
+    return;
+  }
+  dis_captureOut = open_memstream(&dis_captureBuf, &dis_captureSz);
+  if (dis_captureOut == NULL) {
+    LOGMSG_P(l_WARN, "Couldn't open disassembler capture buffer - output might interleave");
+  }
+}
+
+void log_disEndCapture() {
+  if (dis_captureOut == NULL) {
+    return;
+  }
+  fclose(dis_captureOut);
+  dis_captureOut = NULL;
+
+  pthread_mutex_lock(&log_mutex);
+  fwrite(dis_captureBuf, 1, dis_captureSz, log_disOut);
+  pthread_mutex_unlock(&log_mutex);
+
+  free(dis_captureBuf);
+  dis_captureBuf = NULL;
+  dis_captureSz = 0;
+}
+
 void log_closeLogFile() {
   fflush(log_disOut);
   if (log_disOut != stdout) {
@@ -91,9 +141,6 @@ void log_msg(log_level_t dl,
 
   if (dl > log_minLevel) return;
 
-  // stdout might be used from disassembler output. If so, flush before writing generic log entry
-  if (dis_enabled && log_disOut == stdout) fflush(log_disOut);
-
   // Explicitly print display messages always to stdout and not to log file (if set)
   int curLogFd = log_fd;
   if (is_display) {
@@ -106,45 +153,61 @@ void log_msg(log_level_t dl,
   gettimeofday(&tv, NULL);
   localtime_r((const time_t *)&tv.tv_sec, &tm);
 
-  if (inside_line && !raw_print) {
-    dprintf(curLogFd, "\n");
-  }
+  // Compose the complete message first so that it can be emitted with a single write while
+  // other threads are also logging
+  char msg[4096];
+  size_t msgLen = 0;
 
   if (log_isTTY) {
-    dprintf(curLogFd, "%s", logLevels[dl].prefix);
+    logAppend(msg, sizeof(msg), &msgLen, "%s", logLevels[dl].prefix);
   }
 
-  if (raw_print) {
-    int fmtLen = strlen(fmt);
-    if (fmtLen > 0 && fmt[fmtLen - 1] == '\n') {
-      inside_line = false;
-    } else {
-      inside_line = true;
-    }
-  } else {
+  if (!raw_print) {
     if (!is_display && (log_minLevel >= l_DEBUG || !log_isTTY)) {
-      dprintf(curLogFd, "%s [%d] %d/%02d/%02d %02d:%02d:%02d (%s:%d %s) ", logLevels[dl].descr,
-              getpid(), tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
-              tm.tm_sec, file, line, func);
+      logAppend(msg, sizeof(msg), &msgLen, "%s [%d] %d/%02d/%02d %02d:%02d:%02d (%s:%d %s) ",
+                logLevels[dl].descr, getpid(), tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                tm.tm_hour, tm.tm_min, tm.tm_sec, file, line, func);
     } else {
-      dprintf(curLogFd, "%s ", logLevels[dl].descr);
+      logAppend(msg, sizeof(msg), &msgLen, "%s ", logLevels[dl].descr);
     }
   }
 
   va_list args;
   va_start(args, fmt);
-  vdprintf(curLogFd, fmt, args);
+  logVAppend(msg, sizeof(msg), &msgLen, fmt, args);
   va_end(args);
 
   if (perr) {
-    dprintf(curLogFd, ": %s", strerr);
+    logAppend(msg, sizeof(msg), &msgLen, ": %s", strerr);
   }
 
   if (log_isTTY) {
-    dprintf(curLogFd, "\033[0m");
+    logAppend(msg, sizeof(msg), &msgLen, "\033[0m");
   }
 
-  if (!raw_print) dprintf(curLogFd, "\n");
+  if (!raw_print) logAppend(msg, sizeof(msg), &msgLen, "\n");
+
+  pthread_mutex_lock(&log_mutex);
+
+  // stdout might be used from disassembler output. If so, flush before writing generic log entry
+  if (log_disOut == stdout) fflush(log_disOut);
+
+  if (inside_line && !raw_print) {
+    dprintf(curLogFd, "\n");
+  }
+
+  if (raw_print) {
+    int fmtLen = strlen(fmt);
+    if (fmtLen > 0 && fmt[fmtLen - 1] == '\n') {
+      inside_line = false;
+    } else {
+      inside_line = true;
+    }
+  }
+
+  dprintf(curLogFd, "%.*s", (int)msgLen, msg);
+
+  pthread_mutex_unlock(&log_mutex);
 
   if (dl == l_FATAL) {
     exitWrapper(EXIT_FAILURE);
@@ -155,6 +218,6 @@ void log_dis(const char *fmt, ...) {
   if (!dis_enabled) return;
   va_list args;
   va_start(args, fmt);
-  vfprintf(log_disOut, fmt, args);
+  vfprintf(dis_captureOut ? dis_captureOut : log_disOut, fmt, args);
   va_end(args);
 }
@@ -28,6 +28,8 @@ typedef enum { l_FATAL = 0, l_ERROR, l_WARN, l_INFO, l_DEBUG, l_MAX_LEVEL } log_
 void log_setMinLevel(log_level_t);
 void log_setDisStatus(bool);
 bool log_getDisStatus();
+void log_disBeginCapture();
+void log_disEndCapture();
 bool log_initLogFile(const char *);
 void log_closeLogFile();
 
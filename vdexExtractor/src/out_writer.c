@@ -20,25 +20,55 @@
 
 */
 
+#include "io_engine.h"
 #include "out_writer.h"
 #include "utils.h"
 
+// Files found under the input dir keep their relative path under the output dir, others are
+// saved by their base name
+static const char *relativeName(const char *inputDir, const char *fName) {
+  const char *relName = strrchr(fName, '/') ? strrchr(fName, '/') + 1 : fName;
+  if (inputDir) {
+    size_t inputDirLen = strlen(inputDir);
+    while (inputDirLen > 1 && inputDir[inputDirLen - 1] == '/') inputDirLen--;
+    if (strncmp(fName, inputDir, inputDirLen) == 0 && fName[inputDirLen] == '/') {
+      relName = fName + inputDirLen + 1;
+    }
+  }
+  return relName;
+}
+
+void outWriter_mirrorName(char *outBuf,
+                          size_t outBufLen,
+                          const char *rootPath,
+                          const char *inputDir,
+                          const char *fName) {
+  snprintf(outBuf, outBufLen, "%s/%s", rootPath, relativeName(inputDir, fName));
+}
+
 void outWriter_formatName(char *outBuf,
                           size_t outBufLen,
                           const char *rootPath,
+                          const char *inputDir,
                           const char *fName,
                           size_t classId,
                           const char *suffix) {
-  // Trim Vdex extension and replace with Apk
-  char *fileExt = strrchr(fName, '.');
-  if (fileExt) {
+  const char *relName = relativeName(inputDir, fName);
+
+  // Trim Vdex extension and replace with Apk. Work on a copy since the same input file name is
+  // shared by concurrently processed Dex files.
+  char baseName[PATH_MAX] = { 0 };
+  snprintf(baseName, sizeof(baseName), "%s", rootPath == NULL ? fName : relName);
+  char *fileExt = strrchr(baseName, '.');
+  if (fileExt && !strchr(fileExt, '/')) {
     *fileExt = '\0';
   }
-  char formattedName[PATH_MAX] = { 0 };
+
+  char formattedName[PATH_MAX + 64] = { 0 };
   if (classId == 0) {
-    snprintf(formattedName, sizeof(formattedName), "%s.apk_classes.%s", fName, suffix);
+    snprintf(formattedName, sizeof(formattedName), "%s.apk_classes.%s", baseName, suffix);
   } else {
-    snprintf(formattedName, sizeof(formattedName), "%s.apk_classes%zu.%s", fName, classId + 1,
+    snprintf(formattedName, sizeof(formattedName), "%s.apk_classes%zu.%s", baseName, classId + 1,
              suffix);
   }
 
@@ -46,41 +76,82 @@ void outWriter_formatName(char *outBuf,
     // Save to same directory as input file
     snprintf(outBuf, outBufLen, "%s", formattedName);
   } else {
-    const char *pFileBaseName = utils_fileBasename(formattedName);
-    snprintf(outBuf, outBufLen, "%s/%s", rootPath, pFileBaseName);
-    free((void *)pFileBaseName);
+    snprintf(outBuf, outBufLen, "%s/%s", rootPath, formattedName);
   }
 }
 
-bool outWriter_DexFile(const runArgs_t *pRunArgs,
-                       const char *VdexFileName,
-                       size_t dexIdx,
-                       const u1 *buf,
-                       size_t bufSize) {
-  char outFile[PATH_MAX] = { 0 };
-  outWriter_formatName(outFile, sizeof(outFile), pRunArgs->outputDir, VdexFileName, dexIdx, "dex");
-
-  // Write Dex file
-  int fileFlags = O_CREAT | O_RDWR;
-  if (pRunArgs->fileOverride == false) {
-    fileFlags |= O_EXCL;
-  }
-  int dstfd = -1;
-  dstfd = open(outFile, fileFlags, 0644);
-  if (dstfd == -1) {
-    LOGMSG_P(l_ERROR, "Couldn't create output file '%s' - skipping 'classes%zu.dex'", outFile,
-             dexIdx);
-    return false;
+void outWriter_DexFiles(outWriter_dexFile_t *dexFiles, size_t dexFilesCnt) {
+  char(*outFiles)[PATH_MAX] = utils_malloc(dexFilesCnt * PATH_MAX);
+  ioEngine_writeReq_t *reqs = utils_calloc(dexFilesCnt * sizeof(ioEngine_writeReq_t));
+  struct iovec *wholeIovs = utils_calloc(dexFilesCnt * sizeof(struct iovec));
+  size_t reqsCnt = 0;
+
+  for (size_t i = 0; i < dexFilesCnt; ++i) {
+    outWriter_dexFile_t *pDexFile = &dexFiles[i];
+    const runArgs_t *pRunArgs = pDexFile->pRunArgs;
+    pDexFile->success = false;
+    outWriter_formatName(outFiles[i], PATH_MAX, pRunArgs->outputDir, pRunArgs->inputDir,
+                         pDexFile->VdexFileName, pDexFile->dexIdx, "dex");
+
+    // Mirror sub-directories of recursively discovered inputs
+    if (pRunArgs->outputDir && !utils_makeParentDirs(outFiles[i])) {
+      LOGMSG(l_ERROR, "Couldn't create parent directories of '%s'", outFiles[i]);
+      continue;
+    }
+
+    ioEngine_writeReq_t *pReq = &reqs[reqsCnt++];
+    pReq->path = outFiles[i];
+    pReq->flags = O_CREAT | O_RDWR;
+    if (pRunArgs->fileOverride == false) {
+      pReq->flags |= O_EXCL;
+    }
+    pReq->mode = 0644;
+    if (pDexFile->pPatches) {
+      // Unmodified ranges are written straight out of the (read-only) input mapping
+      struct iovec *iov;
+      pReq->iovCnt = dexPatch_buildIov(pDexFile->buf, pDexFile->bufSize, pDexFile->pPatches, &iov);
+      pReq->iov = iov;
+    } else {
+      wholeIovs[i].iov_base = (void *)pDexFile->buf;
+      wholeIovs[i].iov_len = pDexFile->bufSize;
+      pReq->iov = &wholeIovs[i];
+      pReq->iovCnt = 1;
+    }
+    pDexFile->success = true;
   }
 
-  if (!utils_writeToFd(dstfd, buf, bufSize)) {
-    close(dstfd);
-    LOGMSG(l_ERROR, "Couldn't write '%s' file - skipping 'classes%zu.dex'", outFile, dexIdx);
-    return false;
+  // Write Dex files
+  ioEngine_writeFiles(reqs, reqsCnt);
+
+  size_t reqIdx = 0;
+  for (size_t i = 0; i < dexFilesCnt; ++i) {
+    outWriter_dexFile_t *pDexFile = &dexFiles[i];
+    if (!pDexFile->success) {
+      continue;
+    }
+    ioEngine_writeReq_t *pReq = &reqs[reqIdx++];
+    if (pDexFile->pPatches) {
+      free((void *)pReq->iov);
+    }
+    if (pReq->err != 0) {
+      errno = pReq->err;
+      LOGMSG_P(l_ERROR, "Couldn't write output file '%s' - skipping 'classes%zu.dex'", pReq->path,
+               pDexFile->dexIdx);
+      pDexFile->success = false;
+    } else if (pDexFile->pDigests) {
+      // Everything needed to package the output (e.g. zip entry CRC) without re-reading it
+      const dexDigests *pDigests = pDexFile->pDigests;
+      char *sigHex = utils_bin2hex(pDigests->signature, kSHA1Len);
+      DISPLAY(l_INFO,
+              "'%s': size %zu, checksum %08" PRIx32 ", crc32 %08" PRIx32 ", signature %s",
+              pReq->path, pDexFile->bufSize, pDigests->checksum, pDigests->crc32, sigHex);
+      free(sigHex);
+    }
   }
 
-  close(dstfd);
-  return true;
+  free(wholeIovs);
+  free(reqs);
+  free(outFiles);
 }
 
 bool outWriter_VdexFile(const runArgs_t *pRunArgs, const char *VdexFileName, u1 *buf, off_t bufSz) {
@@ -24,10 +24,27 @@
 #define _OUT_WRITER_H_
 
 #include "common.h"
-
-void outWriter_formatName(char *, size_t, const char *, const char *, size_t, const char *);
-
-bool outWriter_DexFile(const runArgs_t *, const char *, size_t, const u1 *, size_t);
+#include "dex_patch.h"
+
+void outWriter_formatName(
+    char *, size_t, const char *, const char *, const char *, size_t, const char *);
+
+// Path of an input file mirrored under the output dir
+void outWriter_mirrorName(char *, size_t, const char *, const char *, const char *);
+
+typedef struct {
+  const runArgs_t *pRunArgs;
+  const char *VdexFileName;
+  size_t dexIdx;
+  const u1 *buf;
+  size_t bufSize;
+  const dexPatchList *pPatches;  // Applied to buf when writing if not NULL
+  const dexDigests *pDigests;    // Reported once written if not NULL
+  bool success;
+} outWriter_dexFile_t;
+
+// Writes a batch of Dex files and sets the success status of each one
+void outWriter_DexFiles(outWriter_dexFile_t *, size_t);
 
 bool outWriter_VdexFile(const runArgs_t *, const char *, u1 *, off_t);
 
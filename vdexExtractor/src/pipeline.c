@@ -0,0 +1,391 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "dex.h"
+#include "out_writer.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "utils.h"
+
+#define kMaxWriteBatch 32
+
+typedef struct {
+  pipeline_file_t *pFile;
+  const runArgs_t *pRunArgs;
+  size_t dexIdx;
+  u1 *buf;
+  size_t bufSz;
+  bool verifyChecksum;
+  dexPatchList *pPatches;
+  dexDigests digests;  // Set if digests were requested
+} pipeline_dexFile_t;
+
+// Blocking single consumer ring buffer. Producers wait while it's full.
+typedef struct {
+  pipeline_dexFile_t **items;
+  size_t capacity;
+  size_t head;
+  size_t count;
+  bool closed;
+  pthread_mutex_t lock;
+  pthread_cond_t notEmpty;
+  pthread_cond_t notFull;
+} pipeline_queue_t;
+
+static pipeline_queue_t pipeline_checksumQueue;
+static pipeline_queue_t pipeline_writeQueue;
+static pthread_t pipeline_checksumThread;
+static pthread_t pipeline_writeThread;
+static bool pipeline_async;
+
+static pthread_mutex_t pipeline_slotsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pipeline_slotsCond = PTHREAD_COND_INITIALIZER;
+static u4 pipeline_maxInFlight = 1;
+static u4 pipeline_inFlight;
+
+static void queueInit(pipeline_queue_t *pQueue, size_t capacity) {
+  pQueue->items = utils_calloc(sizeof(pipeline_dexFile_t *) * capacity);
+  pQueue->capacity = capacity;
+  pQueue->head = 0;
+  pQueue->count = 0;
+  pQueue->closed = false;
+  pthread_mutex_init(&pQueue->lock, NULL);
+  pthread_cond_init(&pQueue->notEmpty, NULL);
+  pthread_cond_init(&pQueue->notFull, NULL);
+}
+
+static void queueDestroy(pipeline_queue_t *pQueue) {
+  free(pQueue->items);
+  pQueue->items = NULL;
+  pthread_mutex_destroy(&pQueue->lock);
+  pthread_cond_destroy(&pQueue->notEmpty);
+  pthread_cond_destroy(&pQueue->notFull);
+}
+
+static void queuePush(pipeline_queue_t *pQueue, pipeline_dexFile_t *pItem) {
+  pthread_mutex_lock(&pQueue->lock);
+  while (pQueue->count == pQueue->capacity) {
+    pthread_cond_wait(&pQueue->notFull, &pQueue->lock);
+  }
+  pQueue->items[(pQueue->head + pQueue->count) % pQueue->capacity] = pItem;
+  pQueue->count++;
+  pthread_cond_signal(&pQueue->notEmpty);
+  pthread_mutex_unlock(&pQueue->lock);
+}
+
+// Pops up to maxItems, waiting for at least one. Returns 0 once the queue has been closed and
+// drained.
+static size_t queuePop(pipeline_queue_t *pQueue, pipeline_dexFile_t **items, size_t maxItems) {
+  pthread_mutex_lock(&pQueue->lock);
+  while (pQueue->count == 0 && !pQueue->closed) {
+    pthread_cond_wait(&pQueue->notEmpty, &pQueue->lock);
+  }
+  size_t popped = 0;
+  while (pQueue->count > 0 && popped < maxItems) {
+    items[popped++] = pQueue->items[pQueue->head];
+    pQueue->head = (pQueue->head + 1) % pQueue->capacity;
+    pQueue->count--;
+  }
+  if (popped > 0) {
+    pthread_cond_broadcast(&pQueue->notFull);
+  }
+  pthread_mutex_unlock(&pQueue->lock);
+  return popped;
+}
+
+static void queueClose(pipeline_queue_t *pQueue) {
+  pthread_mutex_lock(&pQueue->lock);
+  pQueue->closed = true;
+  pthread_cond_broadcast(&pQueue->notEmpty);
+  pthread_mutex_unlock(&pQueue->lock);
+}
+
+static void releaseFile(pipeline_file_t *pFile) {
+  if (atomic_fetch_sub(&pFile->refs, 1) != 1) {
+    return;
+  }
+
+  munmap(pFile->buf, pFile->fileSz);
+  close(pFile->fd);
+  if (atomic_load(&pFile->failed)) {
+    pFile->dexCnt = -1;
+  }
+  pFile->doneCb(pFile, pFile->cbArg);
+  free(pFile);
+
+  pthread_mutex_lock(&pipeline_slotsLock);
+  pipeline_inFlight--;
+  pthread_cond_signal(&pipeline_slotsCond);
+  pthread_mutex_unlock(&pipeline_slotsLock);
+}
+
+static void freeDexFile(pipeline_dexFile_t *pItem) {
+  if (pItem->pPatches) {
+    dexPatch_destroy(pItem->pPatches);
+    free(pItem->pPatches);
+  }
+  free(pItem);
+}
+
+// Fused variant of the checksum stage, which also computes the signature & CRC32 of the output
+static bool digestDexFile(pipeline_dexFile_t *pItem) {
+  const dexHeader *pDexHeader = (const dexHeader *)pItem->buf;
+  bool repairSignature = !pItem->verifyChecksum && pItem->pRunArgs->repairSignature;
+  dexDigests *pDigests = &pItem->digests;
+  struct timespec timer;
+  utils_startTimer(&timer);
+  if (pItem->pPatches) {
+    dexPatch_computeDigests(pItem->buf, pItem->bufSz, pItem->pPatches, repairSignature, pDigests);
+  } else {
+    dex_computeDigests(pItem->buf, pItem->bufSz, repairSignature, pDigests);
+  }
+  stats_addDigests(pItem->bufSz, utils_endTimer(&timer));
+
+  if (pItem->verifyChecksum) {
+    if (pDigests->checksum != pDexHeader->checksum) {
+      LOGMSG(l_ERROR,
+             "Unexpected checksum (%" PRIx32 " vs %" PRIx32 ") - failed to unquicken Dex file",
+             pDigests->checksum, pDexHeader->checksum);
+      return false;
+    }
+    if (!pDigests->signatureMatch) {
+      LOGMSG(l_WARN, "Dex file signature doesn't match its contents");
+    }
+  } else if (pItem->pPatches) {
+    dexPatch_setChecksum(pItem->pPatches, pDigests->checksum);
+    if (repairSignature) {
+      dexPatch_setSignature(pItem->pPatches, pDigests->signature);
+    }
+  } else {
+    dex_repairDigests(pItem->buf, pDigests);
+  }
+  return true;
+}
+
+static bool checksumDexFile(pipeline_dexFile_t *pItem) {
+  const dexHeader *pDexHeader = (const dexHeader *)pItem->buf;
+  if (pItem->pPatches) {
+    dexPatch_finalize(pItem->pPatches);
+  }
+  if (pItem->pRunArgs->digests) {
+    return digestDexFile(pItem);
+  }
+  if (pItem->verifyChecksum) {
+    // If unquicken was successful original checksum should verify
+    u4 curChecksum = pItem->pPatches
+                         ? dexPatch_computeDexCRC(pItem->buf, pItem->bufSz, pItem->pPatches)
+                         : dex_computeDexCRC(pItem->buf, pItem->bufSz);
+    if (curChecksum != pDexHeader->checksum) {
+      LOGMSG(l_ERROR,
+             "Unexpected checksum (%" PRIx32 " vs %" PRIx32 ") - failed to unquicken Dex file",
+             curChecksum, pDexHeader->checksum);
+      return false;
+    }
+  } else if (pItem->pPatches) {
+    // Repair CRC if not decompiling so we can still run Dex parsing tools against output
+    dexPatch_setChecksum(pItem->pPatches,
+                         dexPatch_computeDexCRC(pItem->buf, pItem->bufSz, pItem->pPatches));
+  } else {
+    // Repair CRC if not decompiling so we can still run Dex parsing tools against output
+    dex_repairDexCRC(pItem->buf, pItem->bufSz);
+  }
+  return true;
+}
+
+static void writeDexFiles(pipeline_dexFile_t **items, size_t itemsCnt) {
+  outWriter_dexFile_t dexFiles[kMaxWriteBatch];
+  for (size_t i = 0; i < itemsCnt; ++i) {
+    dexFiles[i].pRunArgs = items[i]->pRunArgs;
+    dexFiles[i].VdexFileName = items[i]->pFile->fileName;
+    dexFiles[i].dexIdx = items[i]->dexIdx;
+    dexFiles[i].buf = items[i]->buf;
+    dexFiles[i].bufSize = items[i]->bufSz;
+    dexFiles[i].pPatches = items[i]->pPatches;
+    dexFiles[i].pDigests = items[i]->pRunArgs->digests ? &items[i]->digests : NULL;
+  }
+  outWriter_DexFiles(dexFiles, itemsCnt);
+
+  for (size_t i = 0; i < itemsCnt; ++i) {
+    if (!dexFiles[i].success) {
+      atomic_store(&items[i]->pFile->failed, true);
+    }
+    releaseFile(items[i]->pFile);
+    freeDexFile(items[i]);
+  }
+}
+
+static void *checksumStageMain(void *unused) {
+  (void)unused;
+  pipeline_dexFile_t *pItem;
+  while (queuePop(&pipeline_checksumQueue, &pItem, 1) != 0) {
+    if (checksumDexFile(pItem)) {
+      queuePush(&pipeline_writeQueue, pItem);
+    } else {
+      atomic_store(&pItem->pFile->failed, true);
+      releaseFile(pItem->pFile);
+      freeDexFile(pItem);
+    }
+  }
+  queueClose(&pipeline_writeQueue);
+  return NULL;
+}
+
+// Writes whatever has accumulated while the previous batch was being written, so that file
+// creation syscalls are batched when the writer falls behind
+static void *writeStageMain(void *unused) {
+  (void)unused;
+  pipeline_dexFile_t *items[kMaxWriteBatch];
+  size_t itemsCnt;
+  while ((itemsCnt = queuePop(&pipeline_writeQueue, items, kMaxWriteBatch)) != 0) {
+    writeDexFiles(items, itemsCnt);
+  }
+  return NULL;
+}
+
+bool pipeline_init(u4 maxInFlight, bool async) {
+  pipeline_maxInFlight = maxInFlight > 0 ? maxInFlight : 1;
+  pipeline_inFlight = 0;
+  pipeline_async = false;
+  if (!async) {
+    return true;
+  }
+
+  // Queued Dex files live in the mappings of the files in flight, so the queues don't need to be
+  // deeper than that for the stages to stay busy
+  queueInit(&pipeline_checksumQueue, pipeline_maxInFlight);
+  queueInit(&pipeline_writeQueue,
+            pipeline_maxInFlight > kMaxWriteBatch ? pipeline_maxInFlight : kMaxWriteBatch);
+  int ret = pthread_create(&pipeline_checksumThread, NULL, checksumStageMain, NULL);
+  if (ret != 0) {
+    errno = ret;
+    LOGMSG_P(l_ERROR, "Couldn't create checksum stage thread");
+    queueDestroy(&pipeline_checksumQueue);
+    queueDestroy(&pipeline_writeQueue);
+    return false;
+  }
+  ret = pthread_create(&pipeline_writeThread, NULL, writeStageMain, NULL);
+  if (ret != 0) {
+    errno = ret;
+    LOGMSG_P(l_ERROR, "Couldn't create writer stage thread");
+    queueClose(&pipeline_checksumQueue);
+    pthread_join(pipeline_checksumThread, NULL);
+    queueDestroy(&pipeline_checksumQueue);
+    queueDestroy(&pipeline_writeQueue);
+    return false;
+  }
+  pipeline_async = true;
+  LOGMSG(l_DEBUG, "Pipeline initialized with up to %" PRIu32 " files in flight", maxInFlight);
+  return true;
+}
+
+void pipeline_destroy(void) {
+  if (!pipeline_async) {
+    return;
+  }
+
+  // Closing is propagated stage by stage once each queue drains
+  queueClose(&pipeline_checksumQueue);
+  pthread_join(pipeline_checksumThread, NULL);
+  pthread_join(pipeline_writeThread, NULL);
+  queueDestroy(&pipeline_checksumQueue);
+  queueDestroy(&pipeline_writeQueue);
+  pipeline_async = false;
+}
+
+pipeline_file_t *pipeline_mapFile(const char *fileName,
+                                  bool readOnly,
+                                  pipeline_doneCb doneCb,
+                                  void *cbArg) {
+  pthread_mutex_lock(&pipeline_slotsLock);
+  while (pipeline_inFlight >= pipeline_maxInFlight) {
+    pthread_cond_wait(&pipeline_slotsCond, &pipeline_slotsLock);
+  }
+  pipeline_inFlight++;
+  pthread_mutex_unlock(&pipeline_slotsLock);
+
+  pipeline_file_t *pFile = utils_malloc(sizeof(pipeline_file_t));
+  pFile->buf = readOnly ? utils_mapFileReadOnly(fileName, &pFile->fileSz, &pFile->fd)
+                       : utils_mapFileToRead(fileName, &pFile->fileSz, &pFile->fd);
+  if (pFile->buf == NULL) {
+    free(pFile);
+    pthread_mutex_lock(&pipeline_slotsLock);
+    pipeline_inFlight--;
+    pthread_cond_signal(&pipeline_slotsCond);
+    pthread_mutex_unlock(&pipeline_slotsLock);
+    return NULL;
+  }
+
+  // Start reading the file in while the workers are busy with the ones ahead of it
+  if (pFile->fileSz > 0 && madvise(pFile->buf, pFile->fileSz, MADV_WILLNEED) != 0) {
+    LOGMSG_P(l_DEBUG, "madvise(MADV_WILLNEED) failed for '%s'", fileName);
+  }
+
+  pFile->fileName = fileName;
+  atomic_init(&pFile->refs, 1);
+  atomic_init(&pFile->failed, false);
+  pFile->dexCnt = -1;
+  pFile->doneCb = doneCb;
+  pFile->cbArg = cbArg;
+  return pFile;
+}
+
+void pipeline_emitDexFile(pipeline_file_t *pFile,
+                          const runArgs_t *pRunArgs,
+                          size_t dexIdx,
+                          u1 *buf,
+                          size_t bufSz,
+                          bool verifyChecksum,
+                          dexPatchList *pPatches) {
+  pipeline_dexFile_t *pItem = utils_malloc(sizeof(pipeline_dexFile_t));
+  pItem->pFile = pFile;
+  pItem->pRunArgs = pRunArgs;
+  pItem->dexIdx = dexIdx;
+  pItem->buf = buf;
+  pItem->bufSz = bufSz;
+  pItem->verifyChecksum = verifyChecksum;
+  pItem->pPatches = pPatches;
+  atomic_fetch_add(&pFile->refs, 1);
+
+  if (pipeline_async) {
+    queuePush(&pipeline_checksumQueue, pItem);
+    return;
+  }
+
+  if (checksumDexFile(pItem)) {
+    writeDexFiles(&pItem, 1);
+  } else {
+    atomic_store(&pFile->failed, true);
+    releaseFile(pFile);
+    freeDexFile(pItem);
+  }
+}
+
+void pipeline_fileProcessed(pipeline_file_t *pFile, int dexCnt) {
+  pFile->dexCnt = dexCnt;
+  if (dexCnt == -1) {
+    atomic_store(&pFile->failed, true);
+  }
+  releaseFile(pFile);
+}
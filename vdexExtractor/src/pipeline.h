@@ -0,0 +1,74 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#include "common.h"
+#include "dex_patch.h"
+
+// Input files flow through four stages: map & prefetch (the submitting thread), unquicken (the
+// worker pool), Dex checksum verification / repair and output writing. The last two stages run
+// on dedicated threads fed by bounded queues, so disk writes overlap with bytecode processing.
+// The number of files mapped at any time is capped, which blocks input submission when the
+// later stages fall behind and keeps memory usage bounded.
+
+struct pipeline_file_t;
+typedef void (*pipeline_doneCb)(struct pipeline_file_t *, void *);
+
+// An input file in flight. The mapping stays alive until the last stage referencing it is done,
+// at which point the completion callback runs (from whichever stage thread dropped it last).
+typedef struct pipeline_file_t {
+  const char *fileName;
+  u1 *buf;
+  off_t fileSz;
+  int fd;
+  atomic_uint refs;
+  atomic_bool failed;
+  int dexCnt;
+  pipeline_doneCb doneCb;
+  void *cbArg;
+} pipeline_file_t;
+
+// Spawns the checksum & writer stage threads when asynchronous stages are requested, otherwise
+// Dex files are verified and written inline by the emitting thread. Takes the max number of
+// files in flight and the async stages flag.
+bool pipeline_init(u4, bool);
+void pipeline_destroy(void);
+
+// Map & prefetch stage. Blocks while the max number of files are in flight. The file is mapped
+// read-only if requested (patch list mode). Returns NULL if the file can't be mapped.
+pipeline_file_t *pipeline_mapFile(const char *, bool, pipeline_doneCb, void *);
+
+// Hands a processed Dex file (located in the file mapping) to the checksum & writer stages.
+// Unquickened Dex files have their original checksum verified, otherwise it's repaired. If a
+// patch list is given (ownership is passed) it's applied to the output instead of the buffer.
+void pipeline_emitDexFile(
+    pipeline_file_t *, const runArgs_t *, size_t, u1 *, size_t, bool, dexPatchList *);
+
+// Marks the unquicken stage of a file as done with the number of Dex files found (-1 if failed)
+void pipeline_fileProcessed(pipeline_file_t *, int);
+
+#endif
@@ -0,0 +1,257 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <pthread.h>
+
+#include "cpu_features.h"
+#include "sha1.h"
+#include "utils.h"
+
+#if VDEX_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+typedef void (*sha1BlocksFn)(u4[5], const u1 *, size_t);
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1BlocksPortable(u4 state[5], const u1 *data, size_t blocks) {
+  for (; blocks > 0; --blocks, data += kSHA1BlockLen) {
+    u4 w[80];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = (u4)data[i * 4] << 24 | (u4)data[i * 4 + 1] << 16 | (u4)data[i * 4 + 2] << 8 |
+             data[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; ++i) {
+      w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    u4 a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; ++i) {
+      u4 f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5a827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ed9eba1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8f1bbcdc;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xca62c1d6;
+      }
+      u4 t = ROL32(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = ROL32(b, 30);
+      b = a;
+      a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+  }
+}
+
+#if VDEX_HAVE_X86_SIMD
+// Four rounds with message schedule: the current message words feed the rounds, finish the
+// schedule of the next ones (sha1msg2), start the one after the next (sha1msg1) & are xored into
+// the remaining one
+#define SHA1_QUAD(f, eIn, eOut, cur, next, after, prev) \
+  eIn = _mm_sha1nexte_epu32(eIn, cur);                  \
+  eOut = abcd;                                          \
+  next = _mm_sha1msg2_epu32(next, cur);                 \
+  abcd = _mm_sha1rnds4_epu32(abcd, eIn, f);             \
+  prev = _mm_sha1msg1_epu32(prev, cur);                 \
+  after = _mm_xor_si128(after, cur)
+
+__attribute__((target("sha,sse4.1"))) static void sha1BlocksSHANI(u4 state[5],
+                                                                  const u1 *data,
+                                                                  size_t blocks) {
+  const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+  __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1b);
+  __m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+  __m128i e1, msg0, msg1, msg2, msg3;
+
+  for (; blocks > 0; --blocks, data += kSHA1BlockLen) {
+    const __m128i abcdSave = abcd;
+    const __m128i e0Save = e0;
+
+    // Rounds 0-15 load the message while the schedule fills up
+    msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), mask);
+    e0 = _mm_add_epi32(e0, msg0);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+    msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), mask);
+    e1 = _mm_sha1nexte_epu32(e1, msg1);
+    e0 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+    msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+    msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), mask);
+    e0 = _mm_sha1nexte_epu32(e0, msg2);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+    msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+    msg0 = _mm_xor_si128(msg0, msg2);
+
+    msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), mask);
+    SHA1_QUAD(0, e1, e0, msg3, msg0, msg1, msg2);
+
+    // Rounds 16-67
+    SHA1_QUAD(0, e0, e1, msg0, msg1, msg2, msg3);
+    SHA1_QUAD(1, e1, e0, msg1, msg2, msg3, msg0);
+    SHA1_QUAD(1, e0, e1, msg2, msg3, msg0, msg1);
+    SHA1_QUAD(1, e1, e0, msg3, msg0, msg1, msg2);
+    SHA1_QUAD(1, e0, e1, msg0, msg1, msg2, msg3);
+    SHA1_QUAD(1, e1, e0, msg1, msg2, msg3, msg0);
+    SHA1_QUAD(2, e0, e1, msg2, msg3, msg0, msg1);
+    SHA1_QUAD(2, e1, e0, msg3, msg0, msg1, msg2);
+    SHA1_QUAD(2, e0, e1, msg0, msg1, msg2, msg3);
+    SHA1_QUAD(2, e1, e0, msg1, msg2, msg3, msg0);
+    SHA1_QUAD(2, e0, e1, msg2, msg3, msg0, msg1);
+    SHA1_QUAD(3, e1, e0, msg3, msg0, msg1, msg2);
+    SHA1_QUAD(3, e0, e1, msg0, msg1, msg2, msg3);
+
+    // Rounds 68-79 drain the schedule
+    e1 = _mm_sha1nexte_epu32(e1, msg1);
+    e0 = abcd;
+    msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+    msg3 = _mm_xor_si128(msg3, msg1);
+
+    e0 = _mm_sha1nexte_epu32(e0, msg2);
+    e1 = abcd;
+    msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+    e1 = _mm_sha1nexte_epu32(e1, msg3);
+    e0 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+    e0 = _mm_sha1nexte_epu32(e0, e0Save);
+    abcd = _mm_add_epi32(abcd, abcdSave);
+  }
+
+  _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+  state[4] = (u4)_mm_extract_epi32(e0, 3);
+}
+#endif
+
+static sha1BlocksFn sha1Blocks = sha1BlocksPortable;
+static pthread_once_t sha1Once = PTHREAD_ONCE_INIT;
+
+// Picks the SHA extensions kernel if supported & it agrees with the portable one on a probe
+static void selectSha1Blocks(void) {
+  const char *name = "portable";
+#if VDEX_HAVE_X86_SIMD
+  if (cpu_hasSHA()) {
+    u1 probe[3 * kSHA1BlockLen];
+    for (size_t i = 0; i < sizeof(probe); ++i) {
+      probe[i] = (u1)(i * 167 + 13);
+    }
+    u4 ref[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    u4 hw[5];
+    memcpy(hw, ref, sizeof(hw));
+    sha1BlocksPortable(ref, probe, 3);
+    sha1BlocksSHANI(hw, probe, 3);
+    if (memcmp(ref, hw, sizeof(hw)) == 0) {
+      sha1Blocks = sha1BlocksSHANI;
+      name = "sha-ni";
+    } else {
+      LOGMSG(l_WARN, "SHA extensions SHA-1 kernel disagrees with the portable one - not used");
+    }
+  }
+#endif
+  LOGMSG(l_DEBUG, "Using %s SHA-1 kernel", name);
+}
+
+size_t sha1_getBlockKernels(sha1_kernel_t kernels[kSHA1MaxKernels]) {
+  size_t cnt = 0;
+  kernels[cnt++] = (sha1_kernel_t){ "portable", sha1BlocksPortable };
+#if VDEX_HAVE_X86_SIMD
+  if (cpu_hasSHA()) kernels[cnt++] = (sha1_kernel_t){ "sha-ni", sha1BlocksSHANI };
+#endif
+  return cnt;
+}
+
+void sha1_init(sha1_ctx_t *pCtx) {
+  pthread_once(&sha1Once, selectSha1Blocks);
+  pCtx->state[0] = 0x67452301;
+  pCtx->state[1] = 0xefcdab89;
+  pCtx->state[2] = 0x98badcfe;
+  pCtx->state[3] = 0x10325476;
+  pCtx->state[4] = 0xc3d2e1f0;
+  pCtx->totalLen = 0;
+  pCtx->blockLen = 0;
+}
+
+void sha1_update(sha1_ctx_t *pCtx, const u1 *data, size_t len) {
+  pCtx->totalLen += len;
+  if (pCtx->blockLen > 0) {
+    size_t fill = kSHA1BlockLen - pCtx->blockLen;
+    if (fill > len) fill = len;
+    memcpy(pCtx->block + pCtx->blockLen, data, fill);
+    pCtx->blockLen += fill;
+    data += fill;
+    len -= fill;
+    if (pCtx->blockLen < kSHA1BlockLen) return;
+    sha1Blocks(pCtx->state, pCtx->block, 1);
+    pCtx->blockLen = 0;
+  }
+
+  size_t blocks = len / kSHA1BlockLen;
+  if (blocks > 0) {
+    sha1Blocks(pCtx->state, data, blocks);
+    data += blocks * kSHA1BlockLen;
+    len -= blocks * kSHA1BlockLen;
+  }
+  memcpy(pCtx->block, data, len);
+  pCtx->blockLen = len;
+}
+
+void sha1_final(sha1_ctx_t *pCtx, u1 digest[kSHA1DigestLen]) {
+  u8 bitLen = pCtx->totalLen * 8;
+  pCtx->block[pCtx->blockLen++] = 0x80;
+  if (pCtx->blockLen > kSHA1BlockLen - sizeof(u8)) {
+    memset(pCtx->block + pCtx->blockLen, 0, kSHA1BlockLen - pCtx->blockLen);
+    sha1Blocks(pCtx->state, pCtx->block, 1);
+    pCtx->blockLen = 0;
+  }
+  memset(pCtx->block + pCtx->blockLen, 0, kSHA1BlockLen - sizeof(u8) - pCtx->blockLen);
+  for (size_t i = 0; i < sizeof(u8); ++i) {
+    pCtx->block[kSHA1BlockLen - 1 - i] = (u1)(bitLen >> (i * 8));
+  }
+  sha1Blocks(pCtx->state, pCtx->block, 1);
+
+  for (size_t i = 0; i < 5; ++i) {
+    digest[i * 4] = (u1)(pCtx->state[i] >> 24);
+    digest[i * 4 + 1] = (u1)(pCtx->state[i] >> 16);
+    digest[i * 4 + 2] = (u1)(pCtx->state[i] >> 8);
+    digest[i * 4 + 3] = (u1)pCtx->state[i];
+  }
+}
@@ -0,0 +1,54 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _SHA1_H_
+#define _SHA1_H_
+
+#include "common.h"
+
+#define kSHA1DigestLen 20
+#define kSHA1BlockLen 64
+
+// Incremental SHA-1. Whole blocks are compressed with the SHA extensions when the CPU has them,
+// otherwise with the portable implementation.
+typedef struct {
+  u4 state[5];
+  u8 totalLen;
+  u1 block[kSHA1BlockLen];
+  size_t blockLen;
+} sha1_ctx_t;
+
+void sha1_init(sha1_ctx_t *);
+void sha1_update(sha1_ctx_t *, const u1 *, size_t);
+void sha1_final(sha1_ctx_t *, u1[kSHA1DigestLen]);
+
+// Block kernels usable on the running CPU, the portable reference one first, so that the SHA
+// extensions one can be cross-checked & benchmarked against it. Returns the number stored.
+typedef struct {
+  const char *name;
+  void (*blocks)(u4[5], const u1 *, size_t);
+} sha1_kernel_t;
+
+#define kSHA1MaxKernels 2
+size_t sha1_getBlockKernels(sha1_kernel_t[kSHA1MaxKernels]);
+
+#endif
@@ -0,0 +1,174 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <pthread.h>
+
+#include "stats.h"
+#include "utils.h"
+
+typedef struct {
+  off_t size;
+  long nanos;
+} statsFile_t;
+
+static bool stats_enabled;
+
+static pthread_mutex_t stats_filesLock = PTHREAD_MUTEX_INITIALIZER;
+static statsFile_t *stats_files;
+static size_t stats_filesCnt;
+static u8 stats_instructions;
+static u8 stats_skippedMethods;
+static u8 stats_dupCodeItems;
+static long stats_bytecodeNanos;
+static u8 stats_digestedDexFiles;
+static u8 stats_digestedBytes;
+static long stats_digestNanos;
+static u8 stats_validatedDexFiles;
+static u8 stats_validatedBytes;
+static long stats_validationNanos;
+
+void stats_setEnabled(bool status) { stats_enabled = status; }
+
+bool stats_isEnabled(void) { return stats_enabled; }
+
+void stats_addFile(off_t size, long nanos) {
+  if (!stats_enabled) return;
+
+  pthread_mutex_lock(&stats_filesLock);
+  if ((stats_filesCnt & (stats_filesCnt - 1)) == 0) {
+    stats_files = utils_realloc(stats_files, sizeof(statsFile_t) * (stats_filesCnt * 2 + 1));
+  }
+  stats_files[stats_filesCnt].size = size;
+  stats_files[stats_filesCnt].nanos = nanos;
+  stats_filesCnt++;
+  pthread_mutex_unlock(&stats_filesLock);
+}
+
+void stats_addBytecode(u8 instructions, u8 skippedMethods, u8 dupCodeItems, long nanos) {
+  if (!stats_enabled) return;
+
+  pthread_mutex_lock(&stats_filesLock);
+  stats_instructions += instructions;
+  stats_skippedMethods += skippedMethods;
+  stats_dupCodeItems += dupCodeItems;
+  stats_bytecodeNanos += nanos;
+  pthread_mutex_unlock(&stats_filesLock);
+}
+
+void stats_addDigests(u8 bytes, long nanos) {
+  if (!stats_enabled) return;
+
+  pthread_mutex_lock(&stats_filesLock);
+  stats_digestedDexFiles++;
+  stats_digestedBytes += bytes;
+  stats_digestNanos += nanos;
+  pthread_mutex_unlock(&stats_filesLock);
+}
+
+void stats_addValidation(u8 bytes, long nanos) {
+  if (!stats_enabled) return;
+
+  pthread_mutex_lock(&stats_filesLock);
+  stats_validatedDexFiles++;
+  stats_validatedBytes += bytes;
+  stats_validationNanos += nanos;
+  pthread_mutex_unlock(&stats_filesLock);
+}
+
+static int statsFileSizeCmp(const void *a, const void *b) {
+  off_t sA = ((const statsFile_t *)a)->size;
+  off_t sB = ((const statsFile_t *)b)->size;
+  return sA < sB ? 1 : (sA > sB ? -1 : 0);
+}
+
+// Greedy longest processing time first assignment of the files to the workers. File cost is
+// modeled as linear to its size using the throughput measured over the whole batch.
+static double predictMakespan(u4 workers, double nsPerByte) {
+  qsort(stats_files, stats_filesCnt, sizeof(statsFile_t), statsFileSizeCmp);
+
+  double *load = utils_calloc(workers * sizeof(double));
+  for (size_t i = 0; i < stats_filesCnt; ++i) {
+    u4 minWorker = 0;
+    for (u4 w = 1; w < workers; ++w) {
+      if (load[w] < load[minWorker]) minWorker = w;
+    }
+    load[minWorker] += stats_files[i].size * nsPerByte;
+  }
+
+  double makespan = 0;
+  for (u4 w = 0; w < workers; ++w) {
+    if (load[w] > makespan) makespan = load[w];
+  }
+  free(load);
+  return makespan;
+}
+
+void stats_dump(long wallNanos, u4 workers) {
+  if (!stats_enabled) return;
+
+  pthread_mutex_lock(&stats_filesLock);
+  u8 totalBytes = 0;
+  double totalNanos = 0, maxNanos = 0;
+  for (size_t i = 0; i < stats_filesCnt; ++i) {
+    totalBytes += stats_files[i].size;
+    totalNanos += stats_files[i].nanos;
+    if (stats_files[i].nanos > maxNanos) maxNanos = stats_files[i].nanos;
+  }
+
+  DISPLAY(l_INFO, "------ Statistics ------");
+  DISPLAY(l_INFO, "input files      : %zu (%.2f MiB)", stats_filesCnt,
+          totalBytes / (1024.0 * 1024.0));
+  DISPLAY(l_INFO, "worker time      : %.2f ms", totalNanos / 1e6);
+  if (stats_bytecodeNanos != 0) {
+    DISPLAY(l_INFO, "bytecode         : %" PRIu64 " instructions in %.2f ms (%.2f M insns/s)",
+            stats_instructions, stats_bytecodeNanos / 1e6,
+            stats_instructions / (stats_bytecodeNanos / 1e3));
+    DISPLAY(l_INFO, "skipped methods  : %" PRIu64 " (no quickened opcode candidate)",
+            stats_skippedMethods);
+    DISPLAY(l_INFO, "dup code items   : %" PRIu64 " (methods sharing a processed code item)",
+            stats_dupCodeItems);
+  }
+  if (stats_validationNanos != 0) {
+    DISPLAY(l_INFO, "validation       : %" PRIu64 " Dex files (%.2f MiB) in %.2f ms (%.2f MiB/s)",
+            stats_validatedDexFiles, stats_validatedBytes / (1024.0 * 1024.0),
+            stats_validationNanos / 1e6,
+            stats_validatedBytes / (1024.0 * 1024.0) / (stats_validationNanos / 1e9));
+  }
+  if (stats_digestNanos != 0) {
+    DISPLAY(l_INFO, "digests          : %" PRIu64 " Dex files (%.2f MiB) in %.2f ms (%.2f MiB/s)",
+            stats_digestedDexFiles, stats_digestedBytes / (1024.0 * 1024.0),
+            stats_digestNanos / 1e6,
+            stats_digestedBytes / (1024.0 * 1024.0) / (stats_digestNanos / 1e9));
+  }
+  if (totalBytes != 0) {
+    double nsPerByte = totalNanos / totalBytes;
+    double lowerBound = totalNanos / workers > maxNanos ? totalNanos / workers : maxNanos;
+    DISPLAY(l_INFO, "throughput       : %.2f MiB/s",
+            totalBytes / (1024.0 * 1024.0) / (totalNanos / 1e9));
+    DISPLAY(l_INFO, "makespan         : %.2f ms actual, %.2f ms predicted (LPT, %" PRIu32
+            " workers), %.2f ms lower bound",
+            wallNanos / 1e6, predictMakespan(workers, nsPerByte) / 1e6, workers, lowerBound / 1e6);
+    DISPLAY(l_INFO, "utilization      : %.1f%%",
+            100.0 * totalNanos / ((double)wallNanos * workers));
+  }
+  pthread_mutex_unlock(&stats_filesLock);
+}
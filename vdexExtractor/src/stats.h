@@ -0,0 +1,51 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include "common.h"
+
+// Run statistics collected by workers when enabled (--stats) and reported once at exit
+void stats_setEnabled(bool);
+bool stats_isEnabled(void);
+
+// Accounts the size & processing time (ns) of an input file
+void stats_addFile(off_t, long);
+
+// Accounts the number of bytecode instructions visited, the methods skipped without visiting
+// them, the methods skipped as sharing an already processed code item & the time (ns) spent
+// unquickening
+void stats_addBytecode(u8, u8, u8, long);
+
+// Accounts the size of a Dex file & the time (ns) spent computing its fused digests
+void stats_addDigests(u8, long);
+
+// Accounts the size of a Dex file & the time (ns) spent on its one-time structural validation
+void stats_addValidation(u8, long);
+
+// Reports the collected statistics. Takes the wall clock time (ns) of the batch and the number of
+// workers, so that the batch makespan can be compared against the one predicted by scheduling
+// the input files longest first.
+void stats_dump(long, u4);
+
+#endif
@@ -0,0 +1,827 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "../checksum.h"
+#include "../common.h"
+#include "../dex.h"
+#include "../dex_instruction.h"
+#include "../dex_unquicken.h"
+#include "../log.h"
+#include "../utils.h"
+
+// Cross-checks the table driven & vector paths of vdexExtractor against the reference
+// implementations they replaced. Exits with a failure if any of them disagrees. With --bench, the
+// throughput of both is measured over the code items of the given Dex files instead.
+
+static size_t failures;
+
+#define EXPECT(cond, ...)         \
+  do {                            \
+    if (!(cond)) {                \
+      failures++;                 \
+      LOGMSG(l_ERROR, __VA_ARGS__); \
+    }                             \
+  } while (0)
+
+void exitWrapper(int errCode) {
+  log_closeLogFile();
+  exit(errCode);
+}
+
+// The opcode switch the v6 & v10 decompilers used before the remap table
+typedef struct {
+  Code quick;
+  Code code;
+  dexUnquickenOperand operand;
+} refRemap_t;
+
+static const refRemap_t kRefRemap[] = {
+  { NOP, CHECK_CAST, kUnquickenNop },
+  { RETURN_VOID_NO_BARRIER, RETURN_VOID, kUnquickenReturnVoid },
+  { IGET_QUICK, IGET, kUnquickenVRegC_22c },
+  { IGET_WIDE_QUICK, IGET_WIDE, kUnquickenVRegC_22c },
+  { IGET_OBJECT_QUICK, IGET_OBJECT, kUnquickenVRegC_22c },
+  { IGET_BOOLEAN_QUICK, IGET_BOOLEAN, kUnquickenVRegC_22c },
+  { IGET_BYTE_QUICK, IGET_BYTE, kUnquickenVRegC_22c },
+  { IGET_CHAR_QUICK, IGET_CHAR, kUnquickenVRegC_22c },
+  { IGET_SHORT_QUICK, IGET_SHORT, kUnquickenVRegC_22c },
+  { IPUT_QUICK, IPUT, kUnquickenVRegC_22c },
+  { IPUT_WIDE_QUICK, IPUT_WIDE, kUnquickenVRegC_22c },
+  { IPUT_OBJECT_QUICK, IPUT_OBJECT, kUnquickenVRegC_22c },
+  { IPUT_BOOLEAN_QUICK, IPUT_BOOLEAN, kUnquickenVRegC_22c },
+  { IPUT_BYTE_QUICK, IPUT_BYTE, kUnquickenVRegC_22c },
+  { IPUT_CHAR_QUICK, IPUT_CHAR, kUnquickenVRegC_22c },
+  { IPUT_SHORT_QUICK, IPUT_SHORT, kUnquickenVRegC_22c },
+  { INVOKE_VIRTUAL_QUICK, INVOKE_VIRTUAL, kUnquickenVRegB_35c },
+  { INVOKE_VIRTUAL_RANGE_QUICK, INVOKE_VIRTUAL_RANGE, kUnquickenVRegB_3rc },
+};
+
+static void checkUnquickenRemap(void) {
+  for (u4 op = 0; op < 256; ++op) {
+    const dexUnquickenRemap *pRemap = &kDexUnquickenRemap[op];
+    const refRemap_t *pRef = NULL;
+    for (size_t i = 0; i < sizeof(kRefRemap) / sizeof(kRefRemap[0]); ++i) {
+      if (kRefRemap[i].quick == op) pRef = &kRefRemap[i];
+    }
+
+    if (pRef == NULL) {
+      EXPECT(pRemap->operand == kUnquickenNone, "%s (0x%02x) is not quickened but is remapped",
+             kInstructionNames[op], op);
+      continue;
+    }
+    EXPECT(pRemap->opcode == pRef->code && pRemap->operand == pRef->operand,
+           "%s (0x%02x) remapped to {0x%02x, %u} instead of {0x%02x, %u}", kInstructionNames[op],
+           op, pRemap->opcode, pRemap->operand, pRef->code, pRef->operand);
+  }
+}
+
+// Instruction size & predicates as computed from the wide descriptors before the dense tables
+static u4 refSizeInCodeUnits(u2 *code_ptr) {
+  s1 result = kInstructionDescriptors[dexInstr_getOpcode(code_ptr)].size_in_code_units;
+  return result < 0 ? dexInstr_SizeInCodeUnitsComplex(code_ptr) : (u4)result;
+}
+
+static bool refIsInvoke(u2 *code_ptr) {
+  return (kInstructionDescriptors[dexInstr_getOpcode(code_ptr)].flags & kInvoke) != 0;
+}
+
+static bool refIsBranch(u2 *code_ptr) {
+  return (kInstructionDescriptors[dexInstr_getOpcode(code_ptr)].flags & kBranch) != 0;
+}
+
+static void checkInstructionTables(void) {
+  for (u4 op = 0; op < 256; ++op) {
+    const instrDesc_t *pDesc = &kInstructionDescriptors[op];
+    u2 insn[8] = { (u2)op };
+    const char *name = kInstructionNames[op];
+
+    EXPECT(kInstructionSizes[op] == pDesc->size_in_code_units, "%s (0x%02x) size %d instead of %d",
+           name, op, kInstructionSizes[op], pDesc->size_in_code_units);
+    EXPECT(dexInstr_SizeInCodeUnits(insn) == refSizeInCodeUnits(insn),
+           "%s (0x%02x) is %u code units instead of %u", name, op, dexInstr_SizeInCodeUnits(insn),
+           refSizeInCodeUnits(insn));
+
+    EXPECT(dexInstr_isBranch(insn) == ((pDesc->flags & kBranch) != 0), "%s branch class", name);
+    EXPECT(dexInstr_isUnconditional(insn) == ((pDesc->flags & kUnconditional) != 0),
+           "%s unconditional class", name);
+    EXPECT(dexInstr_isSwitch(insn) == ((pDesc->flags & kSwitch) != 0), "%s switch class", name);
+    EXPECT(dexInstr_isThrow(insn) == ((pDesc->flags & kThrow) != 0), "%s throw class", name);
+    EXPECT(dexInstr_isReturn(insn) == ((pDesc->flags & kReturn) != 0), "%s return class", name);
+    EXPECT(dexInstr_isInvoke(insn) == ((pDesc->flags & kInvoke) != 0), "%s invoke class", name);
+    EXPECT(dexInstr_isQuickened(insn) == (pDesc->index_type == kIndexFieldOffset ||
+                                          pDesc->index_type == kIndexVtableOffset),
+           "%s quickened class", name);
+    EXPECT(((kInstructionClasses[op] & kClassIndexed) != 0) == (pDesc->index_type != kIndexNone),
+           "%s indexed class", name);
+  }
+
+  // Payloads: packed switch of 3 targets, sparse switch of 3 keys, 5 x 3 byte array data
+  u2 packed[] = { kPackedSwitchSignature, 3 };
+  u2 sparse[] = { kSparseSwitchSignature, 3 };
+  u2 array[] = { kArrayDataSignature, 3, 5, 0 };
+  EXPECT(dexInstr_SizeInCodeUnits(packed) == 4 + 3 * 2, "packed-switch payload size");
+  EXPECT(dexInstr_SizeInCodeUnits(sparse) == 2 + 3 * 4, "sparse-switch payload size");
+  EXPECT(dexInstr_SizeInCodeUnits(array) == 4 + (3 * 5 + 1) / 2, "fill-array-data payload size");
+}
+
+// xorshift32 with a fixed seed, so that failures reproduce
+static u4 rngState = 0x2545f491;
+
+static u4 rng(void) {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+// Spans several runs of the largest length before a modulo (5552) plus alignment slack
+static u1 checksumBuf[4 * 5552 + 128];
+
+typedef struct {
+  size_t checked;
+  size_t mismatches;
+  u4 seed;
+  size_t off;
+  size_t len;
+} checksumResult_t;
+
+static void expectChecksum(u4 (*kernel)(u4, const u1 *, size_t),
+                           u4 (*ref)(u4, const u1 *, size_t),
+                           u4 seed,
+                           size_t off,
+                           size_t len,
+                           checksumResult_t *pResult) {
+  pResult->checked++;
+  if (kernel(seed, checksumBuf + off, len) != ref(seed, checksumBuf + off, len) &&
+      pResult->mismatches++ == 0) {
+    pResult->seed = seed;
+    pResult->off = off;
+    pResult->len = len;
+  }
+}
+
+static u4 adler32Ref(u4 adler, const u1 *buf, size_t len) { return adler32(adler, buf, len); }
+
+static u4 crc32Ref(u4 crc, const u1 *buf, size_t len) { return (u4)crc32_z(crc, buf, len); }
+
+// Every length below 2000 from 4 alignments & 2 seeds, random lengths spanning several modulo runs
+// from random alignments & seeds, then all 0xff input, the worst case of the deferred modulo.
+// Seeds are valid Adler32 values, which any CRC32 is too.
+static void checkChecksumKernel(u4 (*kernel)(u4, const u1 *, size_t),
+                                u4 (*ref)(u4, const u1 *, size_t),
+                                size_t minLen,
+                                checksumResult_t *pResult) {
+  for (size_t i = 0; i < sizeof(checksumBuf); ++i) {
+    checksumBuf[i] = (u1)rng();
+  }
+  for (size_t len = minLen; len < 2000; ++len) {
+    for (size_t off = 0; off < 4; ++off) {
+      expectChecksum(kernel, ref, 1, off, len, pResult);
+      expectChecksum(kernel, ref, 0xfff0fff0, off, len, pResult);
+    }
+  }
+  for (int i = 0; i < 20000; ++i) {
+    size_t off = rng() % 64;
+    size_t len = minLen + rng() % (sizeof(checksumBuf) - 64 - minLen);
+    u4 seed = (rng() % 65521) << 16 | (rng() % 65521);
+    expectChecksum(kernel, ref, seed, off, len, pResult);
+  }
+  memset(checksumBuf, 0xff, sizeof(checksumBuf));
+  for (size_t len = sizeof(checksumBuf) - 128; len < sizeof(checksumBuf); ++len) {
+    expectChecksum(kernel, ref, 0xfff0fff0, len % 64, len - 64, pResult);
+  }
+}
+
+// Each vector kernel & the dispatcher, which sends short buffers to zlib
+static void checkChecksumKernels(const char *digest,
+                                 size_t (*getKernels)(checksum_kernel_t[kChecksumMaxKernels]),
+                                 u4 (*dispatcher)(u4, const u1 *, size_t),
+                                 u4 (*ref)(u4, const u1 *, size_t)) {
+  checksum_kernel_t kernels[kChecksumMaxKernels + 1];
+  size_t kernelsCnt = getKernels(kernels);
+  kernels[kernelsCnt++] = (checksum_kernel_t){ "dispatcher", dispatcher, 0 };
+
+  for (size_t i = 1; i < kernelsCnt; ++i) {
+    checksumResult_t result = { 0 };
+    checkChecksumKernel(kernels[i].update, ref, kernels[i].minLen, &result);
+    EXPECT(result.mismatches == 0,
+           "%s %s kernel disagrees with zlib on %zu of %zu buffers, first from seed 0x%08x at "
+           "offset %zu of length %zu",
+           kernels[i].name, digest, result.mismatches, result.checked, result.seed, result.off,
+           result.len);
+  }
+}
+
+static void checkSha1Kernels(void) {
+  sha1_kernel_t kernels[kSHA1MaxKernels];
+  size_t kernelsCnt = sha1_getBlockKernels(kernels);
+
+  // Random states & runs of up to 64 blocks from random alignments
+  for (size_t k = 1; k < kernelsCnt; ++k) {
+    size_t mismatches = 0;
+    for (int i = 0; i < 2000; ++i) {
+      for (size_t j = 0; j < sizeof(checksumBuf); ++j) {
+        checksumBuf[j] = (u1)rng();
+      }
+      u4 ref[5], state[5];
+      for (size_t j = 0; j < 5; ++j) {
+        ref[j] = state[j] = rng();
+      }
+      size_t off = rng() % 64;
+      size_t blocks = rng() % 65;
+      kernels[0].blocks(ref, checksumBuf + off, blocks);
+      kernels[k].blocks(state, checksumBuf + off, blocks);
+      mismatches += memcmp(ref, state, sizeof(ref)) != 0;
+    }
+    EXPECT(mismatches == 0, "%s SHA-1 kernel disagrees with the portable one on %zu of 2000 runs",
+           kernels[k].name, mismatches);
+  }
+
+  // Known answers of FIPS 180, through the selected kernel
+  static const struct {
+    const char *msg;
+    const char *digest;
+  } kKnownAnswers[] = {
+    { "", "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+    { "abc", "a9993e364706816aba3e25717850c26c9cd0d89d" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+      "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+  };
+  for (size_t i = 0; i < sizeof(kKnownAnswers) / sizeof(kKnownAnswers[0]); ++i) {
+    sha1_ctx_t ctx;
+    u1 digest[kSHA1DigestLen];
+    sha1_init(&ctx);
+    sha1_update(&ctx, (const u1 *)kKnownAnswers[i].msg, strlen(kKnownAnswers[i].msg));
+    sha1_final(&ctx, digest);
+    char *hex = utils_bin2hex(digest, kSHA1DigestLen);
+    EXPECT(strcmp(hex, kKnownAnswers[i].digest) == 0, "SHA-1 of '%s' is %s instead of %s",
+           kKnownAnswers[i].msg, hex, kKnownAnswers[i].digest);
+    free(hex);
+  }
+}
+
+// Benchmarked Dex files, privately mapped so that they can be quickened again
+typedef struct {
+  u1 **bufs;
+  off_t *sizes;
+  int filesCnt;
+  off_t totalSize;
+} benchFiles_t;
+
+// Indices stripped from an instruction when quickening it again, restored by unquickening it
+typedef struct {
+  u4 pc;
+  bool nop;
+  u2 indices[2];
+} benchQuickIndex_t;
+
+// Instructions of all code items of the benchmarked Dex files. These must be unquickened, since a
+// nop hiding a check-cast is followed by its type index rather than an instruction. Code items
+// shared by several methods are flagged, so that they are quickened once.
+typedef struct {
+  const u1 *dexFileBuf;
+  u4 codeOff;
+  u2 *insns;
+  u4 insnsSize;
+  bool shared;
+  u4 firstIndex;
+  u4 indicesCnt;
+} benchCode_t;
+
+typedef struct {
+  benchCode_t *codes;
+  size_t codesCnt;
+  size_t codesCap;
+  size_t insnsCnt;
+  benchQuickIndex_t *indices;
+  size_t indicesCnt;
+  size_t indicesCap;
+} benchCodes_t;
+
+static void collectCodeItems(const u1 *dexFileBuf, benchCodes_t *pCodes) {
+  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+  for (u4 i = 0; i < pDexHeader->classDefsSize; ++i) {
+    const dexClassDef *pDexClassDef = dex_getClassDefUnchecked(dexFileBuf, i);
+    if (pDexClassDef->classDataOff == 0) continue;
+
+    const u1 *curClassDataCursor = dexFileBuf + pDexClassDef->classDataOff;
+    dexClassDataHeader pDexClassDataHeader;
+    dex_readClassDataHeader(&curClassDataCursor, &pDexClassDataHeader);
+    for (u4 j = 0;
+         j < pDexClassDataHeader.staticFieldsSize + pDexClassDataHeader.instanceFieldsSize; ++j) {
+      dexField pDexField;
+      dex_readClassDataField(&curClassDataCursor, &pDexField);
+    }
+
+    u4 methodsSize = pDexClassDataHeader.directMethodsSize + pDexClassDataHeader.virtualMethodsSize;
+    for (u4 j = 0; j < methodsSize; ++j) {
+      dexMethod curDexMethod;
+      dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
+      if (curDexMethod.codeOff == 0) continue;
+
+      const dexCode *pDexCode = (const dexCode *)(dexFileBuf + curDexMethod.codeOff);
+      if (pCodes->codesCnt == pCodes->codesCap) {
+        pCodes->codesCap = pCodes->codesCap ? pCodes->codesCap * 2 : 1024;
+        pCodes->codes = utils_realloc(pCodes->codes, pCodes->codesCap * sizeof(benchCode_t));
+      }
+      pCodes->codes[pCodes->codesCnt++] = (benchCode_t){
+        .dexFileBuf = dexFileBuf,
+        .codeOff = curDexMethod.codeOff,
+        .insns = (u2 *)(dexFileBuf + dex_getFirstInstrOff(&curDexMethod)),
+        .insnsSize = pDexCode->insns_size,
+      };
+    }
+  }
+}
+
+// Walks all code items, returning the number of instructions visited. Each walk must land exactly
+// on the end of its code item. Generated per implementation so that their calls can be inlined.
+#define WALK_CODE_ITEMS(name, size, isInvoke, isBranch)                                     \
+  static size_t name(const benchCodes_t *pCodes, bool predicates, size_t *pMatches) {       \
+    size_t insns = 0;                                                                       \
+    for (size_t i = 0; i < pCodes->codesCnt; ++i) {                                         \
+      u2 *code = pCodes->codes[i].insns;                                                    \
+      u4 pc = 0;                                                                            \
+      while (pc < pCodes->codes[i].insnsSize) {                                             \
+        if (predicates) *pMatches += isInvoke(code + pc) + isBranch(code + pc);             \
+        pc += size(code + pc);                                                              \
+        insns++;                                                                            \
+      }                                                                                     \
+      EXPECT(pc == pCodes->codes[i].insnsSize, "Code item walk overruns its %u code units", \
+             pCodes->codes[i].insnsSize);                                                   \
+    }                                                                                       \
+    return insns;                                                                           \
+  }
+
+WALK_CODE_ITEMS(walkDescriptors, refSizeInCodeUnits, refIsInvoke, refIsBranch)
+WALK_CODE_ITEMS(walkTables, dexInstr_SizeInCodeUnits, dexInstr_isInvoke, dexInstr_isBranch)
+
+typedef size_t (*walkFn)(const benchCodes_t *, bool, size_t *);
+
+// Best of 15 rounds, each walking all code items 20 times
+static double benchWalk(const benchCodes_t *pCodes, walkFn walk, bool predicates) {
+  long best = -1;
+  size_t insns = 0, matches = 0;
+  for (int round = 0; round < 15; ++round) {
+    struct timespec timer;
+    utils_startTimer(&timer);
+    insns = 0;
+    for (int pass = 0; pass < 20; ++pass) {
+      insns += walk(pCodes, predicates, &matches);
+    }
+    long elapsed = utils_endTimer(&timer);
+    if (best < 0 || elapsed < best) best = elapsed;
+  }
+  return best > 0 ? (double)insns * 1000.0 / best : 0.0;
+}
+
+static void benchInstructionTables(const benchCodes_t *pCodes) {
+  DISPLAY(l_INFO, "instruction walk over %zu code items (%zu instructions), M insns/s:",
+          pCodes->codesCnt, pCodes->insnsCnt);
+  DISPLAY(l_INFO, "  %-26s %12s %12s", "", "descriptors", "tables");
+  DISPLAY(l_INFO, "  %-26s %12.1f %12.1f", "size", benchWalk(pCodes, walkDescriptors, false),
+          benchWalk(pCodes, walkTables, false));
+  DISPLAY(l_INFO, "  %-26s %12.1f %12.1f", "size + isInvoke/isBranch",
+          benchWalk(pCodes, walkDescriptors, true), benchWalk(pCodes, walkTables, true));
+}
+
+// Quickened opcode of each opcode the switch below restores, from the reference remap
+static u1 kRequicken[256];
+
+static void initRequicken(void) {
+  for (size_t i = 0; i < sizeof(kRefRemap) / sizeof(kRefRemap[0]); ++i) {
+    kRequicken[kRefRemap[i].code] = kRefRemap[i].quick;
+  }
+}
+
+static int compareCodes(const void *a, const void *b) {
+  const benchCode_t *pA = *(const benchCode_t *const *)a;
+  const benchCode_t *pB = *(const benchCode_t *const *)b;
+  return pA->insns < pB->insns ? -1 : pA->insns > pB->insns;
+}
+
+static void flagSharedCodes(benchCodes_t *pCodes) {
+  benchCode_t **sorted = utils_malloc(pCodes->codesCnt * sizeof(benchCode_t *));
+  for (size_t i = 0; i < pCodes->codesCnt; ++i) {
+    sorted[i] = &pCodes->codes[i];
+  }
+  qsort(sorted, pCodes->codesCnt, sizeof(benchCode_t *), compareCodes);
+  for (size_t i = 1; i < pCodes->codesCnt; ++i) {
+    sorted[i]->shared = sorted[i]->insns == sorted[i - 1]->insns;
+  }
+  free(sorted);
+}
+
+static void addQuickIndex(benchCodes_t *pCodes, benchQuickIndex_t index) {
+  if (pCodes->indicesCnt == pCodes->indicesCap) {
+    pCodes->indicesCap = pCodes->indicesCap ? pCodes->indicesCap * 2 : 4096;
+    pCodes->indices =
+        utils_realloc(pCodes->indices, pCodes->indicesCap * sizeof(benchQuickIndex_t));
+  }
+  pCodes->indices[pCodes->indicesCnt++] = index;
+}
+
+// Quickens a code item the way the compiler does, as far as unquickening can tell: field & vtable
+// operands are replaced by offsets (0 here), check-casts by nops & return-voids lose the barrier.
+// The indices stripped are recorded in order, like the quickening info of a Vdex file.
+static void quickenCode(benchCodes_t *pCodes, benchCode_t *pCode) {
+  pCode->firstIndex = pCodes->indicesCnt;
+  for (u4 pc = 0; pc < pCode->insnsSize;) {
+    u2 *insn = pCode->insns + pc;
+    u4 size = dexInstr_SizeInCodeUnits(insn);
+    Code op = dexInstr_getOpcode(insn);
+    u1 quick = kRequicken[op];
+    if (op == RETURN_VOID) {
+      dexInstr_SetOpcode(insn, RETURN_VOID_NO_BARRIER);
+    } else if (op == CHECK_CAST) {
+      addQuickIndex(pCodes, (benchQuickIndex_t){ pc, true, { dexInstr_getVRegA_21c(insn),
+                                                             dexInstr_getVRegB_21c(insn) } });
+      insn[0] = NOP;
+    } else if (quick != 0) {
+      const dexUnquickenRemap *pRemap = &kDexUnquickenRemap[quick];
+      u2 index = pRemap->operand == kUnquickenVRegC_22c   ? dexInstr_getVRegC_22c(insn)
+                 : pRemap->operand == kUnquickenVRegB_35c ? dexInstr_getVRegB_35c(insn)
+                                                          : dexInstr_getVRegB_3rc(insn);
+      addQuickIndex(pCodes, (benchQuickIndex_t){ pc, false, { index, 0 } });
+      dexInstr_SetOpcode(insn, quick);
+      if (pRemap->operand == kUnquickenVRegC_22c) dexInstr_SetVRegC_22c(insn, 0);
+      if (pRemap->operand == kUnquickenVRegB_35c) dexInstr_SetVRegB_35c(insn, 0);
+      if (pRemap->operand == kUnquickenVRegB_3rc) dexInstr_SetVRegB_3rc(insn, 0);
+    }
+    pc += size;
+  }
+  pCode->indicesCnt = pCodes->indicesCnt - pCode->firstIndex;
+}
+
+// Replays the recorded indices of a code item
+typedef struct {
+  const benchQuickIndex_t *next;
+  const benchQuickIndex_t *end;
+} benchIndexCursor_t;
+
+static u2 benchNextIndex(void *arg, u4 dex_pc) {
+  benchIndexCursor_t *pCursor = (benchIndexCursor_t *)arg;
+  (void)dex_pc;
+  return pCursor->next < pCursor->end ? (pCursor->next++)->indices[0] : 0;
+}
+
+static dexUnquickenNop benchNopIndices(void *arg, u4 dex_pc, u2 *indices) {
+  benchIndexCursor_t *pCursor = (benchIndexCursor_t *)arg;
+  if (pCursor->next == pCursor->end || pCursor->next->pc != dex_pc || !pCursor->next->nop) {
+    return kNopPlain;
+  }
+  indices[0] = pCursor->next->indices[0];
+  indices[1] = pCursor->next->indices[1];
+  pCursor->next++;
+  return kNopCheckCast;
+}
+
+static void refUnquickenIndexed(u2 *insns, Code code, const dexUnquickenIndexSource *pSource,
+                                u4 dex_pc) {
+  u2 index = pSource->nextIndex(pSource->arg, dex_pc);
+  dexInstr_SetOpcode(insns, code);
+  switch (kDexUnquickenRemap[kRequicken[code]].operand) {
+    case kUnquickenVRegC_22c:
+      dexInstr_SetVRegC_22c(insns, index);
+      break;
+    case kUnquickenVRegB_35c:
+      dexInstr_SetVRegB_35c(insns, index);
+      break;
+    default:
+      dexInstr_SetVRegB_3rc(insns, index);
+      break;
+  }
+}
+
+// The unquicken loop of the v10 decompiler before the remap table, over the same index source
+static void refUnquickenMethod(const u1 *dexFileBuf,
+                               dexMethod *pDexMethod,
+                               const dexUnquickenIndexSource *pSource) {
+  dexCode *pDexCode = (dexCode *)(dexFileBuf + pDexMethod->codeOff);
+  u2 *code_ptr = pDexCode->insns;
+  u2 *code_end = pDexCode->insns + pDexCode->insns_size;
+  u4 dex_pc = 0;
+  u4 cur_code_off = dex_getFirstInstrOff(pDexMethod);
+
+  while (code_ptr < code_end) {
+    bool hasCodeChange = true;
+    u2 *insns = code_ptr;
+    u2 indices[2];
+    dex_dumpInstruction(dexFileBuf, code_ptr, cur_code_off, dex_pc, false);
+    switch (dexInstr_getOpcode(insns)) {
+      case RETURN_VOID_NO_BARRIER:
+        dexInstr_SetOpcode(insns, RETURN_VOID);
+        break;
+      case NOP:
+        hasCodeChange = pSource->nopIndices(pSource->arg, dex_pc, indices) == kNopCheckCast;
+        if (hasCodeChange) {
+          dexInstr_SetOpcode(insns, CHECK_CAST);
+          dexInstr_SetVRegA_21c(insns, indices[0]);
+          dexInstr_SetVRegB_21c(insns, indices[1]);
+        }
+        break;
+      case IGET_QUICK:
+        refUnquickenIndexed(insns, IGET, pSource, dex_pc);
+        break;
+      case IGET_WIDE_QUICK:
+        refUnquickenIndexed(insns, IGET_WIDE, pSource, dex_pc);
+        break;
+      case IGET_OBJECT_QUICK:
+        refUnquickenIndexed(insns, IGET_OBJECT, pSource, dex_pc);
+        break;
+      case IGET_BOOLEAN_QUICK:
+        refUnquickenIndexed(insns, IGET_BOOLEAN, pSource, dex_pc);
+        break;
+      case IGET_BYTE_QUICK:
+        refUnquickenIndexed(insns, IGET_BYTE, pSource, dex_pc);
+        break;
+      case IGET_CHAR_QUICK:
+        refUnquickenIndexed(insns, IGET_CHAR, pSource, dex_pc);
+        break;
+      case IGET_SHORT_QUICK:
+        refUnquickenIndexed(insns, IGET_SHORT, pSource, dex_pc);
+        break;
+      case IPUT_QUICK:
+        refUnquickenIndexed(insns, IPUT, pSource, dex_pc);
+        break;
+      case IPUT_BOOLEAN_QUICK:
+        refUnquickenIndexed(insns, IPUT_BOOLEAN, pSource, dex_pc);
+        break;
+      case IPUT_BYTE_QUICK:
+        refUnquickenIndexed(insns, IPUT_BYTE, pSource, dex_pc);
+        break;
+      case IPUT_CHAR_QUICK:
+        refUnquickenIndexed(insns, IPUT_CHAR, pSource, dex_pc);
+        break;
+      case IPUT_SHORT_QUICK:
+        refUnquickenIndexed(insns, IPUT_SHORT, pSource, dex_pc);
+        break;
+      case IPUT_WIDE_QUICK:
+        refUnquickenIndexed(insns, IPUT_WIDE, pSource, dex_pc);
+        break;
+      case IPUT_OBJECT_QUICK:
+        refUnquickenIndexed(insns, IPUT_OBJECT, pSource, dex_pc);
+        break;
+      case INVOKE_VIRTUAL_QUICK:
+        refUnquickenIndexed(insns, INVOKE_VIRTUAL, pSource, dex_pc);
+        break;
+      case INVOKE_VIRTUAL_RANGE_QUICK:
+        refUnquickenIndexed(insns, INVOKE_VIRTUAL_RANGE, pSource, dex_pc);
+        break;
+      default:
+        hasCodeChange = false;
+        break;
+    }
+    if (hasCodeChange) {
+      dex_dumpInstruction(dexFileBuf, insns, cur_code_off, dex_pc, true);
+    }
+    u4 instruction_size = dexInstr_SizeInCodeUnits(insns);
+    code_ptr += instruction_size;
+    dex_pc += instruction_size;
+    cur_code_off += instruction_size * sizeof(u2);
+  }
+}
+
+// Unquickens all code items once, through the switch or the remap table
+static void unquickenCodes(const benchCodes_t *pCodes, dexCodeIter *pIter, bool table) {
+  for (size_t i = 0; i < pCodes->codesCnt; ++i) {
+    const benchCode_t *pCode = &pCodes->codes[i];
+    if (pCode->shared) continue;
+    benchIndexCursor_t cursor = {
+      .next = pCodes->indices + pCode->firstIndex,
+      .end = pCodes->indices + pCode->firstIndex + pCode->indicesCnt,
+    };
+    dexUnquickenIndexSource source = { benchNextIndex, benchNopIndices, &cursor };
+    dexMethod method = { .codeOff = pCode->codeOff };
+    if (table) {
+      dexUnquicken_method(pIter, pCode->dexFileBuf, &method, &source, true);
+    } else {
+      refUnquickenMethod(pCode->dexFileBuf, &method, &source);
+    }
+  }
+}
+
+// Best of 15 rounds, each unquickening all code items after restoring their quickened copy. The
+// files must be restored to their original contents.
+static double benchUnquickenPath(const benchCodes_t *pCodes,
+                                 const benchFiles_t *pFiles,
+                                 u1 **quickened,
+                                 u1 **original,
+                                 size_t insnsCnt,
+                                 bool table) {
+  dexCodeIter iter;
+  dexUnquicken_initIter(&iter, NULL);
+  long best = -1;
+  for (int round = 0; round < 15; ++round) {
+    for (int i = 0; i < pFiles->filesCnt; ++i) {
+      memcpy(pFiles->bufs[i], quickened[i], pFiles->sizes[i]);
+    }
+    struct timespec timer;
+    utils_startTimer(&timer);
+    unquickenCodes(pCodes, &iter, table);
+    long elapsed = utils_endTimer(&timer);
+    if (best < 0 || elapsed < best) best = elapsed;
+  }
+  dexUnquicken_destroyIter(&iter);
+
+  for (int i = 0; i < pFiles->filesCnt; ++i) {
+    EXPECT(memcmp(pFiles->bufs[i], original[i], pFiles->sizes[i]) == 0,
+           "Unquickening through the %s doesn't restore Dex file #%d", table ? "table" : "switch",
+           i);
+  }
+  return best > 0 ? (double)insnsCnt * 1000.0 / best : 0.0;
+}
+
+static void benchUnquicken(benchCodes_t *pCodes, const benchFiles_t *pFiles) {
+  u1 **original = utils_calloc(pFiles->filesCnt * sizeof(u1 *));
+  u1 **quickened = utils_calloc(pFiles->filesCnt * sizeof(u1 *));
+  for (int i = 0; i < pFiles->filesCnt; ++i) {
+    original[i] = utils_malloc(pFiles->sizes[i]);
+    memcpy(original[i], pFiles->bufs[i], pFiles->sizes[i]);
+  }
+
+  initRequicken();
+  flagSharedCodes(pCodes);
+  size_t insnsCnt = 0, codesCnt = 0;
+  for (size_t i = 0; i < pCodes->codesCnt; ++i) {
+    if (pCodes->codes[i].shared) continue;
+    codesCnt++;
+    insnsCnt += walkTables(&(benchCodes_t){ .codes = &pCodes->codes[i], .codesCnt = 1 }, false,
+                           NULL);
+    quickenCode(pCodes, &pCodes->codes[i]);
+  }
+  for (int i = 0; i < pFiles->filesCnt; ++i) {
+    quickened[i] = utils_malloc(pFiles->sizes[i]);
+    memcpy(quickened[i], pFiles->bufs[i], pFiles->sizes[i]);
+  }
+
+  DISPLAY(l_INFO, "unquicken over %zu code items (%zu instructions, %zu quickened), M insns/s:",
+          codesCnt, insnsCnt, pCodes->indicesCnt);
+  DISPLAY(l_INFO, "  %-26s %12s %12s", "", "switch", "table");
+  DISPLAY(l_INFO, "  %-26s %12.1f %12.1f", "unquicken",
+          benchUnquickenPath(pCodes, pFiles, quickened, original, insnsCnt, false),
+          benchUnquickenPath(pCodes, pFiles, quickened, original, insnsCnt, true));
+
+  for (int i = 0; i < pFiles->filesCnt; ++i) {
+    free(original[i]);
+    free(quickened[i]);
+  }
+  free(original);
+  free(quickened);
+}
+
+// Hashes all files with the kernel of the given index
+typedef void (*hashFilesFn)(const benchFiles_t *, size_t);
+
+// Best of 15 rounds, each hashing all files, in GB/s
+static double benchHash(const benchFiles_t *pFiles, hashFilesFn hash, size_t kernel) {
+  long best = -1;
+  for (int round = 0; round < 15; ++round) {
+    struct timespec timer;
+    utils_startTimer(&timer);
+    hash(pFiles, kernel);
+    long elapsed = utils_endTimer(&timer);
+    if (best < 0 || elapsed < best) best = elapsed;
+  }
+  return best > 0 ? (double)pFiles->totalSize / best : 0.0;
+}
+
+static checksum_kernel_t benchKernels[kChecksumMaxKernels];
+static sha1_kernel_t benchSha1Kernels[kSHA1MaxKernels];
+
+static void hashChecksum(const benchFiles_t *pFiles, size_t kernel) {
+  for (int i = 0; i < pFiles->filesCnt; ++i) {
+    benchKernels[kernel].update(1, pFiles->bufs[i], pFiles->sizes[i]);
+  }
+}
+
+// Whole blocks only, the padding of the tail is the same for all kernels
+static void hashSha1(const benchFiles_t *pFiles, size_t kernel) {
+  for (int i = 0; i < pFiles->filesCnt; ++i) {
+    u4 state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    benchSha1Kernels[kernel].blocks(state, pFiles->bufs[i], pFiles->sizes[i] / kSHA1BlockLen);
+  }
+}
+
+static void hashFused(const benchFiles_t *pFiles, size_t kernel) {
+  (void)kernel;
+  for (int i = 0; i < pFiles->filesCnt; ++i) {
+    checksum_multi_t multi;
+    u1 digest[kSHA1DigestLen];
+    checksum_multiInit(&multi);
+    checksum_multiUpdate(&multi, pFiles->bufs[i], pFiles->sizes[i]);
+    checksum_multiFinal(&multi, digest);
+  }
+}
+
+static void benchChecksumKernels(const benchFiles_t *pFiles) {
+  DISPLAY(l_INFO, "digests over %d Dex files (%.2f MiB), GB/s:", pFiles->filesCnt,
+          pFiles->totalSize / (1024.0 * 1024.0));
+
+  size_t kernelsCnt = checksum_getAdler32Kernels(benchKernels);
+  for (size_t k = 0; k < kernelsCnt; ++k) {
+    DISPLAY(l_INFO, "  %-7s %-18s %12.2f", "adler32", benchKernels[k].name,
+            benchHash(pFiles, hashChecksum, k));
+  }
+  kernelsCnt = checksum_getCrc32Kernels(benchKernels);
+  for (size_t k = 0; k < kernelsCnt; ++k) {
+    DISPLAY(l_INFO, "  %-7s %-18s %12.2f", "crc32", benchKernels[k].name,
+            benchHash(pFiles, hashChecksum, k));
+  }
+  kernelsCnt = sha1_getBlockKernels(benchSha1Kernels);
+  for (size_t k = 0; k < kernelsCnt; ++k) {
+    DISPLAY(l_INFO, "  %-7s %-18s %12.2f", "sha1", benchSha1Kernels[k].name,
+            benchHash(pFiles, hashSha1, k));
+  }
+  DISPLAY(l_INFO, "  %-7s %-18s %12.2f", "fused", "adler32/sha1/crc32",
+          benchHash(pFiles, hashFused, 0));
+}
+
+static int bench(int filesCnt, char **files) {
+  benchCodes_t codes = { 0 };
+  benchFiles_t benchFiles = {
+    .bufs = utils_calloc(filesCnt * sizeof(u1 *)),
+    .sizes = utils_calloc(filesCnt * sizeof(off_t)),
+    .filesCnt = filesCnt,
+  };
+
+  for (int i = 0; i < filesCnt; ++i) {
+    int fd = -1;
+    benchFiles.bufs[i] = utils_mapFileToRead(files[i], &benchFiles.sizes[i], &fd);
+    if (benchFiles.bufs[i] == NULL) {
+      LOGMSG(l_ERROR, "Failed to map '%s'", files[i]);
+      return EXIT_FAILURE;
+    }
+    close(fd);
+    if (!dex_isValidDexMagic((const dexHeader *)benchFiles.bufs[i])) {
+      LOGMSG(l_ERROR, "'%s' is not a Dex file", files[i]);
+      return EXIT_FAILURE;
+    }
+    collectCodeItems(benchFiles.bufs[i], &codes);
+    benchFiles.totalSize += benchFiles.sizes[i];
+  }
+  codes.insnsCnt = walkDescriptors(&codes, false, NULL);
+
+  benchInstructionTables(&codes);
+  benchUnquicken(&codes, &benchFiles);
+  benchChecksumKernels(&benchFiles);
+
+  for (int i = 0; i < filesCnt; ++i) {
+    munmap(benchFiles.bufs[i], benchFiles.sizes[i]);
+  }
+  free(codes.codes);
+  free(codes.indices);
+  free(benchFiles.bufs);
+  free(benchFiles.sizes);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    if (argc == 2) {
+      LOGMSG(l_ERROR, "usage: %s --bench <dex files>", argv[0]);
+      return EXIT_FAILURE;
+    }
+    return bench(argc - 2, argv + 2);
+  }
+
+  checkUnquickenRemap();
+  checkInstructionTables();
+  checkChecksumKernels("adler32", checksum_getAdler32Kernels, checksum_adler32Update, adler32Ref);
+  checkChecksumKernels("crc32", checksum_getCrc32Kernels, checksum_crc32Update, crc32Ref);
+  checkSha1Kernels();
+
+  if (failures) {
+    LOGMSG(l_ERROR, "%zu checks failed", failures);
+    return EXIT_FAILURE;
+  }
+  DISPLAY(l_INFO, "All checks passed");
+  return EXIT_SUCCESS;
+}
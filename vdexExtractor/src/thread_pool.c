@@ -0,0 +1,202 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <pthread.h>
+
+#include "thread_pool.h"
+#include "utils.h"
+
+typedef struct threadPool_task {
+  threadPool_taskFn fn;
+  void *arg;
+  threadPool_group_t *group;
+  struct threadPool_task *next;
+} threadPool_task_t;
+
+typedef struct {
+  threadPool_task_t *head;
+  threadPool_task_t *tail;
+} threadPool_queue_t;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_taskCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_doneCond = PTHREAD_COND_INITIALIZER;
+
+// Tasks submitted from inside other tasks go to the nested queue which workers drain first
+static threadPool_queue_t pool_topQueue;
+static threadPool_queue_t pool_nestedQueue;
+
+static pthread_t *pool_threads;
+static u4 pool_threadsNum = 1;
+static bool pool_shutdown;
+
+// Number of pool tasks currently executing on this thread's stack
+static _Thread_local u4 pool_taskDepth;
+
+static void queuePush(threadPool_queue_t *pQueue, threadPool_task_t *pTask) {
+  pTask->next = NULL;
+  if (pQueue->tail) {
+    pQueue->tail->next = pTask;
+  } else {
+    pQueue->head = pTask;
+  }
+  pQueue->tail = pTask;
+}
+
+// Pop the first task of the queue, or the first one belonging to pGroup if not NULL
+static threadPool_task_t *queuePop(threadPool_queue_t *pQueue, const threadPool_group_t *pGroup) {
+  threadPool_task_t *prev = NULL;
+  for (threadPool_task_t *cur = pQueue->head; cur != NULL; prev = cur, cur = cur->next) {
+    if (pGroup != NULL && cur->group != pGroup) {
+      continue;
+    }
+    if (prev) {
+      prev->next = cur->next;
+    } else {
+      pQueue->head = cur->next;
+    }
+    if (pQueue->tail == cur) {
+      pQueue->tail = prev;
+    }
+    return cur;
+  }
+  return NULL;
+}
+
+// Expects pool_lock to be held, which is released while the task function executes
+static void runTask(threadPool_task_t *pTask) {
+  pthread_mutex_unlock(&pool_lock);
+  pool_taskDepth++;
+  pTask->fn(pTask->arg);
+  pool_taskDepth--;
+  pthread_mutex_lock(&pool_lock);
+
+  if (--pTask->group->pending == 0) {
+    pthread_cond_broadcast(&pool_doneCond);
+  }
+  free(pTask);
+}
+
+static void *workerMain(void *unused) {
+  (void)unused;
+  pthread_mutex_lock(&pool_lock);
+  for (;;) {
+    threadPool_task_t *pTask = queuePop(&pool_nestedQueue, NULL);
+    if (pTask == NULL) {
+      pTask = queuePop(&pool_topQueue, NULL);
+    }
+    if (pTask) {
+      runTask(pTask);
+    } else if (pool_shutdown) {
+      break;
+    } else {
+      pthread_cond_wait(&pool_taskCond, &pool_lock);
+    }
+  }
+  pthread_mutex_unlock(&pool_lock);
+  return NULL;
+}
+
+bool threadPool_init(u4 nThreads) {
+  if (nThreads <= 1) {
+    pool_threadsNum = 1;
+    return true;
+  }
+
+  pool_threads = utils_calloc(sizeof(pthread_t) * (nThreads - 1));
+  pool_shutdown = false;
+  for (u4 i = 0; i < nThreads - 1; ++i) {
+    int ret = pthread_create(&pool_threads[i], NULL, workerMain, NULL);
+    if (ret != 0) {
+      errno = ret;
+      LOGMSG_P(l_ERROR, "Couldn't create worker thread #%" PRIu32, i);
+      pool_threadsNum = i + 1;
+      threadPool_destroy();
+      return false;
+    }
+  }
+  pool_threadsNum = nThreads;
+  LOGMSG(l_DEBUG, "Thread pool initialized with %" PRIu32 " threads", nThreads);
+  return true;
+}
+
+void threadPool_destroy(void) {
+  if (pool_threads == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&pool_lock);
+  pool_shutdown = true;
+  pthread_cond_broadcast(&pool_taskCond);
+  pthread_mutex_unlock(&pool_lock);
+
+  for (u4 i = 0; i < pool_threadsNum - 1; ++i) {
+    pthread_join(pool_threads[i], NULL);
+  }
+  free(pool_threads);
+  pool_threads = NULL;
+  pool_threadsNum = 1;
+}
+
+u4 threadPool_getThreadsNum(void) { return pool_threadsNum; }
+
+static void submitTask(threadPool_group_t *pGroup, threadPool_taskFn fn, void *arg, bool nested) {
+  if (pool_threadsNum <= 1) {
+    fn(arg);
+    return;
+  }
+
+  threadPool_task_t *pTask = utils_malloc(sizeof(threadPool_task_t));
+  pTask->fn = fn;
+  pTask->arg = arg;
+  pTask->group = pGroup;
+
+  pthread_mutex_lock(&pool_lock);
+  pGroup->pending++;
+  queuePush(nested ? &pool_nestedQueue : &pool_topQueue, pTask);
+  pthread_cond_signal(&pool_taskCond);
+  pthread_mutex_unlock(&pool_lock);
+}
+
+void threadPool_submit(threadPool_group_t *pGroup, threadPool_taskFn fn, void *arg) {
+  submitTask(pGroup, fn, arg, pool_taskDepth > 0);
+}
+
+void threadPool_submitNested(threadPool_group_t *pGroup, threadPool_taskFn fn, void *arg) {
+  submitTask(pGroup, fn, arg, true);
+}
+
+void threadPool_wait(threadPool_group_t *pGroup) {
+  pthread_mutex_lock(&pool_lock);
+  while (pGroup->pending > 0) {
+    threadPool_task_t *pTask = queuePop(&pool_nestedQueue, pGroup);
+    if (pTask == NULL) {
+      pTask = queuePop(&pool_topQueue, pGroup);
+    }
+    if (pTask) {
+      runTask(pTask);
+    } else {
+      pthread_cond_wait(&pool_doneCond, &pool_lock);
+    }
+  }
+  pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,53 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include "common.h"
+
+typedef void (*threadPool_taskFn)(void *);
+
+// Tracks the completion of a set of submitted tasks. Must be zero initialized before first use.
+typedef struct {
+  size_t pending;
+} threadPool_group_t;
+
+// Spawn the process wide worker threads. The calling thread also runs tasks while waiting on a
+// group, so nThreads counts it too (nThreads = 1 means everything runs inline).
+bool threadPool_init(u4);
+void threadPool_destroy(void);
+u4 threadPool_getThreadsNum(void);
+
+// Queue a task as part of a group. Tasks submitted from inside a pool task are preferred over
+// top level ones, so nested work of files already in flight completes first.
+void threadPool_submit(threadPool_group_t *, threadPool_taskFn, void *);
+
+// Queue a task ahead of the top level ones from any thread, for work done on behalf of files
+// already in flight outside of the pool (e.g. by the pipeline stages).
+void threadPool_submitNested(threadPool_group_t *, threadPool_taskFn, void *);
+
+// Block until all tasks of the group have completed, running queued tasks of the same group
+// from the calling thread in the meantime (safe to call from inside a pool task).
+void threadPool_wait(threadPool_group_t *);
+
+#endif
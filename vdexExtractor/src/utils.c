@@ -21,109 +21,270 @@
 */
 
 #include <dirent.h>
+#include <sched.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 
 #include "utils.h"
 
-static bool utils_readdir(infiles_t *pFiles) {
-  DIR *dir = opendir(pFiles->inputFile);
-  if (!dir) {
-    LOGMSG_P(l_ERROR, "Couldn't open dir '%s'", pFiles->inputFile);
+// Maximum directory nesting followed by the input walker
+#define kMaxWalkDepth 32
+
+// Layout of the records returned by getdents64(2)
+struct linux_dirent64 {
+  u8 d_ino;
+  s8 d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// Identity of a walked directory
+typedef struct {
+  dev_t dev;
+  ino_t ino;
+} walkDirId_t;
+
+typedef struct {
+  const u1 *magic;
+  size_t magicSz;
+  bool recursive;
+  utils_inputCb cb;
+  void *cbArg;
+  size_t count;
+  // Open addressed set of the directories already walked, so that symlinks to an ancestor or to
+  // an already walked directory don't enumerate its files again
+  walkDirId_t *visited;
+  size_t visitedCnt;
+  size_t visitedCap;
+} walkCtx_t;
+
+static size_t utils_dirIdSlot(const walkDirId_t *pId, size_t cap) {
+  u8 h = ((u8)pId->dev * 0x9E3779B97F4A7C15ULL) ^ (u8)pId->ino;
+  h ^= h >> 29;
+  return (size_t)(h * 0xBF58476D1CE4E5B9ULL) & (cap - 1);
+}
+
+static void utils_insertDirId(walkDirId_t *visited, size_t cap, const walkDirId_t *pId) {
+  size_t slot = utils_dirIdSlot(pId, cap);
+  // Inode 0 marks a free slot, no directory has it
+  while (visited[slot].ino != 0) slot = (slot + 1) & (cap - 1);
+  visited[slot] = *pId;
+}
+
+// Records the directory open on the fd. Returns false if it was already walked.
+static bool utils_markDirVisited(int dirFd, walkCtx_t *pCtx) {
+  struct stat st;
+  if (fstat(dirFd, &st) == -1 || st.st_ino == 0) {
+    // Can't tell, walk it since the depth limit still bounds any loop
+    return true;
+  }
+  walkDirId_t id = { .dev = st.st_dev, .ino = st.st_ino };
+  if (pCtx->visitedCap != 0) {
+    for (size_t slot = utils_dirIdSlot(&id, pCtx->visitedCap); pCtx->visited[slot].ino != 0;
+         slot = (slot + 1) & (pCtx->visitedCap - 1)) {
+      if (pCtx->visited[slot].dev == id.dev && pCtx->visited[slot].ino == id.ino) return false;
+    }
+  }
+
+  // Keep the load factor under 1/2
+  if ((pCtx->visitedCnt + 1) * 2 > pCtx->visitedCap) {
+    size_t newCap = pCtx->visitedCap ? pCtx->visitedCap * 2 : 64;
+    walkDirId_t *newVisited = utils_calloc(newCap * sizeof(walkDirId_t));
+    for (size_t i = 0; i < pCtx->visitedCap; ++i) {
+      if (pCtx->visited[i].ino != 0) utils_insertDirId(newVisited, newCap, &pCtx->visited[i]);
+    }
+    free(pCtx->visited);
+    pCtx->visited = newVisited;
+    pCtx->visitedCap = newCap;
+  }
+  utils_insertDirId(pCtx->visited, pCtx->visitedCap, &id);
+  pCtx->visitedCnt++;
+  return true;
+}
+
+// Cheap filter that only opens the file to peek the magic bytes
+static bool utils_peekMagic(int dirFd, const char *name, const walkCtx_t *pCtx, off_t *fileSz) {
+  int fd = openat(dirFd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+  if (fd == -1) {
+    LOGMSG_P(l_DEBUG, "Couldn't open '%s'", name);
     return false;
   }
 
-  size_t count = 0;
+  bool ret = false;
+  struct stat st;
+  u1 magic[16];
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    *fileSz = st.st_size;
+    ret = pCtx->magicSz == 0 || (pCtx->magicSz <= sizeof(magic) &&
+                                 pread(fd, magic, pCtx->magicSz, 0) == (ssize_t)pCtx->magicSz &&
+                                 memcmp(magic, pCtx->magic, pCtx->magicSz) == 0);
+  }
+  close(fd);
+  return ret;
+}
+
+static bool utils_walkDir(int dirFd, char *path, size_t pathLen, u4 depth, walkCtx_t *pCtx) {
+  u1 dentsBuf[32 * 1024] __attribute__((aligned(8)));
   for (;;) {
-    errno = 0;
-    struct dirent *entry = readdir(dir);
-    if (entry == NULL && errno == EINTR) {
+    long nread = syscall(SYS_getdents64, dirFd, dentsBuf, sizeof(dentsBuf));
+    if (nread == -1 && errno == EINTR) {
       continue;
     }
-    if (entry == NULL && errno != 0) {
-      LOGMSG_P(l_ERROR, "readdir('%s')", pFiles->inputFile);
+    if (nread == -1) {
+      LOGMSG_P(l_ERROR, "getdents64('%s')", path);
       return false;
     }
-    if (entry == NULL) {
+    if (nread == 0) {
       break;
     }
 
-    char path[PATH_MAX];
-    snprintf(path, sizeof(path), "%s/%s", pFiles->inputFile, entry->d_name);
-
-    struct stat st;
-    if (stat(path, &st) == -1) {
-      LOGMSG(l_WARN, "Couldn't stat() the '%s' file", path);
-      continue;
-    }
-
-    if (!S_ISREG(st.st_mode)) {
-      LOGMSG(l_DEBUG, "'%s' is not a regular file, skipping", path);
-      continue;
-    }
-
-    if (st.st_size == 0) {
-      LOGMSG(l_DEBUG, "'%s' is empty", path);
-      continue;
+    for (long pos = 0; pos < nread;) {
+      struct linux_dirent64 *entry = (struct linux_dirent64 *)(dentsBuf + pos);
+      pos += entry->d_reclen;
+
+      const char *name = entry->d_name;
+      if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        continue;
+      }
+
+      unsigned char type = entry->d_type;
+      if (type == DT_UNKNOWN || type == DT_LNK) {
+        // Not all filesystems fill d_type & symlinks are followed as stat() did
+        struct stat st;
+        if (fstatat(dirFd, name, &st, 0) == -1) {
+          LOGMSG(l_WARN, "Couldn't stat() the '%s/%s' file", path, name);
+          continue;
+        }
+        type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+      }
+
+      size_t nameLen = strlen(name);
+      if (pathLen + 1 + nameLen >= PATH_MAX) {
+        LOGMSG(l_WARN, "Path too long - skipping '%s/%s'", path, name);
+        continue;
+      }
+      path[pathLen] = '/';
+      memcpy(path + pathLen + 1, name, nameLen + 1);
+
+      if (type == DT_DIR) {
+        if (pCtx->recursive && depth < kMaxWalkDepth) {
+          int subDirFd = openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+          if (subDirFd == -1) {
+            LOGMSG_P(l_WARN, "Couldn't open dir '%s'", path);
+          } else if (!utils_markDirVisited(subDirFd, pCtx)) {
+            LOGMSG(l_DEBUG, "'%s' was already walked, skipping", path);
+            close(subDirFd);
+          } else {
+            bool ret = utils_walkDir(subDirFd, path, pathLen + 1 + nameLen, depth + 1, pCtx);
+            close(subDirFd);
+            if (!ret) return false;
+          }
+        }
+      } else if (type == DT_REG) {
+        off_t fileSz = 0;
+        if (utils_peekMagic(dirFd, name, pCtx, &fileSz)) {
+          LOGMSG(l_DEBUG, "Found '%s'", path);
+          pCtx->count++;
+          if (!pCtx->cb(path, fileSz, pCtx->cbArg)) return false;
+        } else {
+          LOGMSG(l_DEBUG, "'%s' is not a Vdex file, skipping", path);
+        }
+      }
+      path[pathLen] = '\0';
     }
+  }
+  return true;
+}
 
-    if (!(pFiles->files = realloc(pFiles->files, sizeof(char *) * (count + 1)))) {
-      LOGMSG_P(l_ERROR, "Couldn't allocate memory");
-      closedir(dir);
-      return false;
-    }
+ssize_t utils_walkInputs(const char *inputPath,
+                         bool recursive,
+                         const u1 *magic,
+                         size_t magicSz,
+                         utils_inputCb cb,
+                         void *cbArg) {
+  struct stat st;
+  if (stat(inputPath, &st) == -1) {
+    LOGMSG_P(l_ERROR, "Couldn't stat the input file/dir '%s'", inputPath);
+    return -1;
+  }
 
-    pFiles->files[count] = strdup(path);
-    if (!pFiles->files[count]) {
-      LOGMSG_P(l_ERROR, "Couldn't allocate memory");
-      closedir(dir);
-      return false;
-    }
-    pFiles->fileCnt = ++count;
+  if (S_ISREG(st.st_mode)) {
+    // Explicitly requested files are always handed over
+    return cb(inputPath, st.st_size, cbArg) ? 1 : -1;
+  }
 
-    LOGMSG(l_DEBUG, "Added '%s' to the list of input files", path);
+  if (!S_ISDIR(st.st_mode)) {
+    LOGMSG(l_ERROR, "'%s' is not a regular file, nor a directory", inputPath);
+    return -1;
   }
 
-  closedir(dir);
-  if (count == 0) {
-    LOGMSG(l_ERROR, "Directory '%s' doesn't contain any regular files", pFiles->inputFile);
-    return false;
+  int dirFd = open(inputPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dirFd == -1) {
+    LOGMSG_P(l_ERROR, "Couldn't open dir '%s'", inputPath);
+    return -1;
   }
 
-  LOGMSG(l_INFO, "%u input files have been added to the list", pFiles->fileCnt);
-  return true;
+  walkCtx_t walkCtx = {
+    .magic = magic,
+    .magicSz = magicSz,
+    .recursive = recursive,
+    .cb = cb,
+    .cbArg = cbArg,
+    .count = 0,
+    .visited = NULL,
+    .visitedCnt = 0,
+    .visitedCap = 0,
+  };
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s", inputPath);
+  size_t pathLen = strlen(path);
+  while (pathLen > 1 && path[pathLen - 1] == '/') path[--pathLen] = '\0';
+
+  if (recursive) utils_markDirVisited(dirFd, &walkCtx);
+  bool ret = utils_walkDir(dirFd, path, pathLen, 0, &walkCtx);
+  close(dirFd);
+  free(walkCtx.visited);
+  return ret ? (ssize_t)walkCtx.count : -1;
 }
 
-bool utils_init(infiles_t *pFiles) {
-  pFiles->files = malloc(sizeof(char *));
-  if (!pFiles->files) {
+static bool utils_addInputFile(const char *path, off_t fileSz, void *arg) {
+  (void)fileSz;
+  infiles_t *pFiles = (infiles_t *)arg;
+
+  // Grow geometrically, the array is sized for the next power of two
+  if ((pFiles->fileCnt & (pFiles->fileCnt - 1)) == 0) {
+    pFiles->files = utils_realloc(pFiles->files, sizeof(char *) * (pFiles->fileCnt * 2 + 1));
+  }
+  pFiles->files[pFiles->fileCnt] = strdup(path);
+  if (!pFiles->files[pFiles->fileCnt]) {
     LOGMSG_P(l_ERROR, "Couldn't allocate memory");
     return false;
   }
+  pFiles->fileCnt++;
+  return true;
+}
 
+bool utils_init(infiles_t *pFiles, const u1 *magic, size_t magicSz) {
   if (!pFiles->inputFile) {
     LOGMSG(l_ERROR, "No input file/dir specified");
     return false;
   }
 
-  struct stat st;
-  if (stat(pFiles->inputFile, &st) == -1) {
-    LOGMSG_P(l_ERROR, "Couldn't stat the input file/dir '%s'", pFiles->inputFile);
+  pFiles->files = NULL;
+  pFiles->fileCnt = 0;
+  if (utils_walkInputs(pFiles->inputFile, pFiles->recursive, magic, magicSz, utils_addInputFile,
+                       pFiles) < 0) {
     return false;
   }
 
-  if (S_ISDIR(st.st_mode)) {
-    return utils_readdir(pFiles);
-  }
-
-  if (!S_ISREG(st.st_mode)) {
-    LOGMSG(l_ERROR, "'%s' is not a regular file, nor a directory", pFiles->inputFile);
+  if (pFiles->fileCnt == 0) {
+    LOGMSG(l_ERROR, "Directory '%s' doesn't contain any Vdex files", pFiles->inputFile);
     return false;
   }
 
-  pFiles->files[0] = pFiles->inputFile;
-  pFiles->fileCnt = 1;
-
+  LOGMSG(l_INFO, "%zu input files have been added to the list", pFiles->fileCnt);
   return true;
 }
 
@@ -141,9 +302,11 @@ bool utils_writeToFd(int fd, const u1 *buf, off_t fileSz) {
   return true;
 }
 
-u1 *utils_mapFileToRead(const char *fileName, off_t *fileSz, int *fd) {
-  if ((*fd = open(fileName, O_RDONLY)) == -1) {
-    LOGMSG_P(l_WARN, "Couldn't open() '%s' file in R/O mode", fileName);
+static u1 *mapFile(
+    const char *fileName, off_t *fileSz, int *fd, int openFlags, int prot, int mapFlags) {
+  if ((*fd = open(fileName, openFlags)) == -1) {
+    LOGMSG_P(l_WARN, "Couldn't open() '%s' file in %s mode", fileName,
+             openFlags == O_RDONLY ? "R/O" : "R/W");
     return NULL;
   }
 
@@ -155,7 +318,7 @@ u1 *utils_mapFileToRead(const char *fileName, off_t *fileSz, int *fd) {
   }
 
   u1 *buf;
-  if ((buf = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, *fd, 0)) == MAP_FAILED) {
+  if ((buf = mmap(NULL, st.st_size, prot, mapFlags, *fd, 0)) == MAP_FAILED) {
     LOGMSG_P(l_WARN, "Couldn't mmap() the '%s' file", fileName);
     close(*fd);
     return NULL;
@@ -165,6 +328,21 @@ u1 *utils_mapFileToRead(const char *fileName, off_t *fileSz, int *fd) {
   return buf;
 }
 
+// Private writable mapping, modifications are not carried to the file
+u1 *utils_mapFileToRead(const char *fileName, off_t *fileSz, int *fd) {
+  return mapFile(fileName, fileSz, fd, O_RDONLY, PROT_READ | PROT_WRITE, MAP_PRIVATE);
+}
+
+// Mapping pages are shared with the page cache since they are never copied on write
+u1 *utils_mapFileReadOnly(const char *fileName, off_t *fileSz, int *fd) {
+  return mapFile(fileName, fileSz, fd, O_RDONLY, PROT_READ, MAP_PRIVATE);
+}
+
+// Shared writable mapping, modifications are carried to the file
+u1 *utils_mapFileToWrite(const char *fileName, off_t *fileSz, int *fd) {
+  return mapFile(fileName, fileSz, fd, O_RDWR, PROT_READ | PROT_WRITE, MAP_SHARED);
+}
+
 void utils_hexDump(char *desc, const u1 *addr, int len) {
   int i;
   unsigned char buff[17];
@@ -309,17 +487,86 @@ void utils_pseudoStrAppend(const char **charBuf,
   *charBuf = buf;
 }
 
-void utils_startTimer(struct timespec *pTimeSpec) {
-  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, pTimeSpec);
-}
+// Wall clock is used since process CPU time accumulates across all worker threads
+void utils_startTimer(struct timespec *pTimeSpec) { clock_gettime(CLOCK_MONOTONIC, pTimeSpec); }
 
 long utils_endTimer(struct timespec *pTimeSpec) {
   struct timespec endTime;
-  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &endTime);
-  long diffInNanos = endTime.tv_nsec - pTimeSpec->tv_nsec;
+  clock_gettime(CLOCK_MONOTONIC, &endTime);
+  long diffInNanos =
+      (endTime.tv_sec - pTimeSpec->tv_sec) * 1000000000L + (endTime.tv_nsec - pTimeSpec->tv_nsec);
   return diffInNanos;
 }
 
+// Reads the CFS bandwidth limit of the cgroup the process belongs to. Returns 0 if unlimited or
+// not available.
+static u4 utils_getCgroupCpuLimit(void) {
+  long long quota = -1, period = 0;
+
+  // cgroup v2 - resolve process cgroup path from unified hierarchy entry ("0::<path>")
+  char cgPath[PATH_MAX] = "";
+  FILE *fp = fopen("/proc/self/cgroup", "r");
+  if (fp) {
+    char line[PATH_MAX];
+    while (fgets(line, sizeof(line), fp)) {
+      if (strncmp(line, "0::", 3) == 0) {
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(cgPath, sizeof(cgPath), "%s", line + 3);
+        break;
+      }
+    }
+    fclose(fp);
+  }
+
+  char path[PATH_MAX + 32];
+  snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", strcmp(cgPath, "/") == 0 ? "" : cgPath);
+  fp = fopen(path, "r");
+  if (fp == NULL) fp = fopen("/sys/fs/cgroup/cpu.max", "r");
+  if (fp) {
+    char quotaStr[32];
+    if (fscanf(fp, "%31s %lld", quotaStr, &period) == 2 && strcmp(quotaStr, "max") != 0) {
+      quota = strtoll(quotaStr, NULL, 10);
+    }
+    fclose(fp);
+  } else {
+    // cgroup v1
+    fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+    if (fp) {
+      if (fscanf(fp, "%lld", &quota) != 1) quota = -1;
+      fclose(fp);
+    }
+    fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+    if (fp) {
+      if (fscanf(fp, "%lld", &period) != 1) period = 0;
+      fclose(fp);
+    }
+  }
+
+  if (quota <= 0 || period <= 0) return 0;
+  long long cpus = (quota + period - 1) / period;
+  return cpus > 0 ? (u4)cpus : 1;
+}
+
+u4 utils_getCpuCount(void) {
+  u4 nCpus = 0;
+
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  if (sched_getaffinity(0, sizeof(cpuSet), &cpuSet) == 0) {
+    nCpus = (u4)CPU_COUNT(&cpuSet);
+  }
+  if (nCpus == 0) {
+    long onlineCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nCpus = onlineCpus > 0 ? (u4)onlineCpus : 1;
+  }
+
+  u4 cgroupCpus = utils_getCgroupCpuLimit();
+  if (cgroupCpus != 0 && cgroupCpus < nCpus) nCpus = cgroupCpus;
+
+  LOGMSG(l_DEBUG, "%" PRIu32 " CPU(s) available", nCpus);
+  return nCpus;
+}
+
 u4 *utils_processFileWithCsums(const char *filePath, int *nCsums) {
   u4 *ret = NULL;
   FILE *pFile = fopen(filePath, "rb");
@@ -355,6 +602,31 @@ fini:
   return ret;
 }
 
+bool utils_makeParentDirs(const char *filePath) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s", filePath);
+  char *sep = strrchr(path, '/');
+  if (sep == NULL || sep == path) {
+    return true;
+  }
+  *sep = '\0';
+
+  struct stat st;
+  if (stat(path, &st) == 0) {
+    return S_ISDIR(st.st_mode);
+  }
+
+  if (!utils_makeParentDirs(path)) {
+    return false;
+  }
+  // Concurrent workers might race creating the same directory
+  if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+    LOGMSG_P(l_ERROR, "Couldn't create directory '%s'", path);
+    return false;
+  }
+  return true;
+}
+
 char *utils_fileBasename(char const *path) {
   char *s = strrchr(path, '/');
   if (!s) {
@@ -26,8 +26,18 @@
 #include <stdint.h>
 #include "common.h"
 
-bool utils_init(infiles_t *);
+// Invoked for every discovered input file along with its size. Returning false aborts the walk.
+typedef bool (*utils_inputCb)(const char *, off_t, void *);
+
+// Walks a single input file or directory (one level deep unless recursive), calling back for every
+// regular file starting with the given magic. Returns the number of files found or -1 on error.
+ssize_t utils_walkInputs(const char *, bool, const u1 *, size_t, utils_inputCb, void *);
+
+// Collects all input files to pFiles->files
+bool utils_init(infiles_t *, const u1 *, size_t);
 u1 *utils_mapFileToRead(const char *, off_t *, int *);
+u1 *utils_mapFileReadOnly(const char *, off_t *, int *);
+u1 *utils_mapFileToWrite(const char *, off_t *, int *);
 bool utils_writeToFd(int, const u1 *, off_t);
 void utils_hexDump(char *, const u1 *, int);
 char *utils_bin2hex(const unsigned char *, const size_t);
@@ -42,8 +52,14 @@ void utils_pseudoStrAppend(const char **, size_t *, size_t *, const char *);
 void utils_startTimer(struct timespec *);
 long utils_endTimer(struct timespec *);
 
+// CPUs usable by the process (affinity mask capped by cgroup quota)
+u4 utils_getCpuCount(void);
+
 u4 *utils_processFileWithCsums(const char *, int *);
 
 char *utils_fileBasename(char const *);
 
+// Creates missing parent directories of a file path
+bool utils_makeParentDirs(const char *);
+
 #endif
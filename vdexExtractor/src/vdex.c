@@ -22,34 +22,36 @@
 
 #include <sys/mman.h>
 
+#include "dex_index.h"
+#include "dex_verify.h"
 #include "out_writer.h"
+#include "stats.h"
 #include "utils.h"
 #include "vdex.h"
 #include "vdex_backend_v10.h"
 #include "vdex_backend_v6.h"
 
-static void *(*initDepsInfoPtr)(const u1 *);
-static void (*destroyDepsInfoPtr)(const void *);
-static void (*dumpDepsInfoPtr)(const u1 *, const void *);
-static int (*processPtr)(const char *, const u1 *, const runArgs_t *);
-
-void vdex_backendInit(VdexBackend ver) {
-  switch (ver) {
-    case kBackendV6:
-      initDepsInfoPtr = &vdex_initDepsInfo_v6;
-      destroyDepsInfoPtr = &vdex_destroyDepsInfo_v6;
-      dumpDepsInfoPtr = &vdex_dumpDepsInfo_v6;
-      processPtr = &vdex_process_v6;
-      break;
-    case kBackendV10:
-      initDepsInfoPtr = &vdex_initDepsInfo_v10;
-      destroyDepsInfoPtr = &vdex_destroyDepsInfo_v10;
-      dumpDepsInfoPtr = &vdex_dumpDepsInfo_v10;
-      processPtr = &vdex_process_v10;
-      break;
-    default:
-      LOGMSG(l_FATAL, "Invalid Vdex backend version");
+static const vdexBackendOps kBackendOps[kBackendMax] = {
+  [kBackendV6] = {
+      .initDepsInfo = &vdex_initDepsInfo_v6,
+      .destroyDepsInfo = &vdex_destroyDepsInfo_v6,
+      .dumpDepsInfo = &vdex_dumpDepsInfo_v6,
+      .process = &vdex_process_v6,
+  },
+  [kBackendV10] = {
+      .initDepsInfo = &vdex_initDepsInfo_v10,
+      .destroyDepsInfo = &vdex_destroyDepsInfo_v10,
+      .dumpDepsInfo = &vdex_dumpDepsInfo_v10,
+      .process = &vdex_process_v10,
+  },
+};
+
+const vdexBackendOps *vdex_backendInit(VdexBackend ver) {
+  if (ver >= kBackendMax) {
+    LOGMSG(l_ERROR, "Invalid Vdex backend version");
+    return NULL;
   }
+  return &kBackendOps[ver];
 }
 
 bool vdex_isMagicValid(const u1 *cursor) {
@@ -100,46 +102,179 @@ u4 vdex_DexEndOffset(const u1 *cursor) {
   return vdex_DexBeginOffset(cursor) + pVdexHeader->dexSize;
 }
 
-// TODO: Cache embedded Dex file offsets so that we don't have to parse from scratch when we
-// want to iterate over all files.
-const u1 *vdex_GetNextDexFileData(const u1 *cursor, u4 *offset) {
-  if (*offset == 0) {
-    if (vdex_hasDexSection(cursor)) {
-      const u1 *dexBuf = vdex_DexBegin(cursor);
-      *offset = sizeof(vdexHeader) + vdex_GetSizeOfChecksumsSection(cursor);
-      LOGMSG(l_DEBUG, "Processing first Dex file at offset:0x%x", *offset);
-
-      // Adjust offset to point at the end of current Dex file
-      dexHeader *pDexHeader = (dexHeader *)(dexBuf);
-      *offset += pDexHeader->fileSize;
-      return dexBuf;
-    } else {
-      return NULL;
+// Quickening info of Vdex 010 ends with the start offsets of the per Dex file tables, each one
+// a list of (code item offset, data offset) pairs. Every blob must fit before the offsets table,
+// as the backend hands out the quickening data of code items unchecked.
+static bool indexQuickeningTable(vdexFile *pVdex) {
+  u4 tableSz = pVdex->numberOfDexFiles * sizeof(u4);
+  if (pVdex->quickeningInfoSize < tableSz) {
+    LOGMSG(l_ERROR, "Quickening info (%" PRIu32 " bytes) can't hold the Dex files table",
+           pVdex->quickeningInfoSize);
+    return false;
+  }
+  u4 tableOff = pVdex->quickeningInfoSize - tableSz;
+  const unaligned_u4 *table = (const unaligned_u4 *)(pVdex->quickeningInfo + tableOff);
+  for (u4 i = 0; i < pVdex->numberOfDexFiles; ++i) {
+    u4 end = i + 1 < pVdex->numberOfDexFiles ? table[i + 1] : tableOff;
+    if (table[i] > end || end > tableOff) {
+      LOGMSG(l_ERROR, "Invalid quickening table of Dex file #%" PRIu32, i);
+      return false;
     }
-  } else {
-    dexHeader *pDexHeader = (dexHeader *)(cursor + *offset);
-
-    // Check boundaries
-    const u1 *dexBuf = cursor + *offset;
-    const u1 *dexBufMax = dexBuf + pDexHeader->fileSize;
-    if (dexBufMax == vdex_DexEnd(cursor)) {
-      LOGMSG(l_DEBUG, "Processing last Dex file at offset:0x%x", *offset);
-    } else if (dexBufMax <= vdex_DexEnd(cursor)) {
-      LOGMSG(l_DEBUG, "Processing Dex file at offset:0x%x", *offset);
-    } else {
-      LOGMSG(l_ERROR, "Invalid cursor offset '0x%x'", *offset);
-      return NULL;
+    const unaligned_u4 *pairs = (const unaligned_u4 *)(pVdex->quickeningInfo + table[i]);
+    u4 numPairs = (end - table[i]) / (2 * sizeof(u4));
+    for (u4 j = 0; j < numPairs; ++j) {
+      u8 dataOff = pairs[j * 2 + 1];
+      if (dataOff + sizeof(u4) > tableOff ||
+          dataOff + sizeof(u4) +
+                  *(const unaligned_u4 *)(pVdex->quickeningInfo + dataOff) > tableOff) {
+        LOGMSG(l_ERROR, "Quickening data of code item 0x%" PRIx32 " in Dex file #%" PRIu32
+               " exceeds the quickening info", pairs[j * 2], i);
+        return false;
+      }
     }
+  }
+  pVdex->quickeningTable = table;
+  return true;
+}
+
+bool vdex_open(vdexFile *pVdex, const u1 *buf, size_t fileSz) {
+  memset(pVdex, 0, sizeof(vdexFile));
+  if (fileSz < sizeof(vdexHeader)) {
+    LOGMSG(l_ERROR, "File too small (%zu bytes) for a Vdex header", fileSz);
+    return false;
+  }
+
+  // Sections are laid out back to back, sizes are summed in 64 bits so they can't wrap around
+  const vdexHeader *pVdexHeader = (const vdexHeader *)buf;
+  u8 dexOff = sizeof(vdexHeader) + (u8)pVdexHeader->numberOfDexFiles * sizeof(VdexChecksum);
+  u8 depsOff = dexOff + pVdexHeader->dexSize;
+  u8 quickeningOff = depsOff + pVdexHeader->verifierDepsSize;
+  u8 sectionsEnd = quickeningOff + pVdexHeader->quickeningInfoSize;
+  if (sectionsEnd > fileSz) {
+    LOGMSG(l_ERROR, "Vdex sections (%" PRIu64 " bytes) exceed the file size (%zu bytes)",
+           sectionsEnd, fileSz);
+    return false;
+  }
+
+  pVdex->buf = buf;
+  pVdex->fileSz = fileSz;
+  pVdex->pHeader = pVdexHeader;
+  pVdex->numberOfDexFiles = pVdexHeader->numberOfDexFiles;
+  pVdex->locationChecksums = (const VdexChecksum *)(buf + sizeof(vdexHeader));
+  pVdex->dexBegin = buf + dexOff;
+  pVdex->dexSize = pVdexHeader->dexSize;
+  pVdex->verifierDeps = buf + depsOff;
+  pVdex->verifierDepsSize = pVdexHeader->verifierDepsSize;
+  pVdex->quickeningInfo = buf + quickeningOff;
+  pVdex->quickeningInfoSize = pVdexHeader->quickeningInfoSize;
+
+  if (pVdex->quickeningInfoSize != 0 &&
+      memcmp(pVdexHeader->version, kVdexMagicVersions[kBackendV10], kVdexVersionLen) == 0 &&
+      !indexQuickeningTable(pVdex)) {
+    return false;
+  }
+
+  // Without a Dex section the Dex files are left in the Apk & there's nothing to index
+  if (!vdex_hasDexSection(buf) || pVdex->numberOfDexFiles == 0) {
+    return true;
+  }
 
-    // Adjust offset to point at the end of current Dex file
-    *offset += pDexHeader->fileSize;
-    return dexBuf;
+  u4 *dexOffsets = utils_malloc(pVdex->numberOfDexFiles * sizeof(u4));
+  u8 cur = dexOff;
+  for (u4 i = 0; i < pVdex->numberOfDexFiles; ++i) {
+    const dexHeader *pDexHeader = (const dexHeader *)(buf + cur);
+    if (cur + sizeof(dexHeader) > depsOff || pDexHeader->fileSize < sizeof(dexHeader) ||
+        cur + pDexHeader->fileSize > depsOff) {
+      LOGMSG(l_ERROR, "Dex file #%" PRIu32 " at offset 0x%" PRIx64 " exceeds the Dex section", i,
+             cur);
+      free(dexOffsets);
+      return false;
+    }
+    LOGMSG(l_DEBUG, "Dex file #%" PRIu32 " at offset 0x%" PRIx64 " (%" PRIu32 " bytes)", i, cur,
+           pDexHeader->fileSize);
+
+    // Files with a bad magic are skipped by the backends, all others are validated once here so
+    // that their ids can be resolved unchecked later on
+    if (dex_isValidDexMagic(pDexHeader)) {
+      struct timespec timer;
+      utils_startTimer(&timer);
+      bool valid = dexVerify_dexFile(buf + cur, depsOff - cur);
+      stats_addValidation(pDexHeader->fileSize, utils_endTimer(&timer));
+      if (!valid) {
+        LOGMSG(l_ERROR, "Dex file #%" PRIu32 " failed structural validation", i);
+        free(dexOffsets);
+        return false;
+      }
+    }
+    dexOffsets[i] = (u4)cur;
+    cur += pDexHeader->fileSize;
   }
+  pVdex->dexOffsets = dexOffsets;
+  pVdex->classLookups = utils_calloc(pVdex->numberOfDexFiles * sizeof(dexClassLookup *));
+  pVdex->memberIndexes = utils_calloc(pVdex->numberOfDexFiles * sizeof(dexMemberIndex *));
+  return true;
 }
 
-u4 vdex_GetLocationChecksum(const u1 *cursor, u4 fileIdx) {
-  u4 *checksums = (u4 *)(cursor + sizeof(vdexHeader));
-  return checksums[fileIdx];
+void vdex_close(vdexFile *pVdex) {
+  if (pVdex->classLookups) {
+    for (u4 i = 0; i < pVdex->numberOfDexFiles; ++i) {
+      free(pVdex->classLookups[i]);
+    }
+    free(pVdex->classLookups);
+    pVdex->classLookups = NULL;
+  }
+  if (pVdex->memberIndexes) {
+    for (u4 i = 0; i < pVdex->numberOfDexFiles; ++i) {
+      dexIndex_destroyMemberIndex(pVdex->memberIndexes[i]);
+    }
+    free(pVdex->memberIndexes);
+    pVdex->memberIndexes = NULL;
+  }
+  free((void *)pVdex->dexOffsets);
+  pVdex->dexOffsets = NULL;
+
+  // Cached signatures are keyed by the Dex file buffers, which may be reused by the next mapping
+  dex_releaseSignatureCache();
+}
+
+const dexClassLookup *vdex_getClassLookup(const vdexFile *pVdex, u4 dexIdx) {
+  const u1 *dexFileBuf = vdex_getDexFile(pVdex, dexIdx);
+  if (dexFileBuf == NULL) return NULL;
+
+  // Files with a bad magic haven't been validated, thus can't be indexed
+  if (pVdex->classLookups[dexIdx] == NULL && dex_isValidDexMagic((const dexHeader *)dexFileBuf)) {
+    pVdex->classLookups[dexIdx] = dexIndex_createClassLookup(dexFileBuf);
+  }
+  return pVdex->classLookups[dexIdx];
+}
+
+u4 vdex_findClass(const vdexFile *pVdex, const char *descriptor, u4 fromDex, u4 *pClassDefIdx) {
+  for (u4 i = fromDex; i < pVdex->numberOfDexFiles; ++i) {
+    const dexClassLookup *pLookup = vdex_getClassLookup(pVdex, i);
+    if (pLookup == NULL) continue;
+    s4 classDefIdx = dexIndex_findClass(pLookup, vdex_getDexFile(pVdex, i), descriptor);
+    if (classDefIdx >= 0) {
+      *pClassDefIdx = (u4)classDefIdx;
+      return i;
+    }
+  }
+  return pVdex->numberOfDexFiles;
+}
+
+u4 vdex_findMethod(const vdexFile *pVdex,
+                   u4 dexIdx,
+                   const char *classDescriptor,
+                   const char *name,
+                   const char *signature) {
+  const u1 *dexFileBuf = vdex_getDexFile(pVdex, dexIdx);
+  if (dexFileBuf == NULL || !dex_isValidDexMagic((const dexHeader *)dexFileBuf)) {
+    return kDexNoIndex;
+  }
+  if (pVdex->memberIndexes[dexIdx] == NULL) {
+    pVdex->memberIndexes[dexIdx] = dexIndex_createMemberIndex(dexFileBuf);
+  }
+  return dexIndex_findMethod(pVdex->memberIndexes[dexIdx], dexFileBuf, classDescriptor, name,
+                             signature);
 }
 
 void vdex_SetLocationChecksum(const u1 *cursor, u4 fileIdx, u4 value) {
@@ -177,40 +312,45 @@ u4 vdex_GetQuickeningInfoSize(const u1 *cursor) {
   return pVdexHeader->quickeningInfoSize;
 }
 
-void vdex_dumpHeaderInfo(const u1 *cursor) {
-  const vdexHeader *pVdexHeader = (const vdexHeader *)cursor;
+void vdex_dumpHeaderInfo(const vdexFile *pVdex) {
+  const vdexHeader *pVdexHeader = pVdex->pHeader;
+  u4 depsOff = (u4)(pVdex->verifierDeps - pVdex->buf);
+  u4 quickeningOff = (u4)(pVdex->quickeningInfo - pVdex->buf);
 
   LOGMSG_RAW(l_DEBUG, "------ Vdex Header Info ------\n");
   LOGMSG_RAW(l_DEBUG, "magic header & version      : %.4s-%.4s\n", pVdexHeader->magic,
              pVdexHeader->version);
   LOGMSG_RAW(l_DEBUG, "number of dex files         : %" PRIx32 " (%" PRIu32 ")\n",
-             pVdexHeader->numberOfDexFiles, pVdexHeader->numberOfDexFiles);
+             pVdex->numberOfDexFiles, pVdex->numberOfDexFiles);
   LOGMSG_RAW(l_DEBUG, "dex size (overall)          : %" PRIx32 " (%" PRIu32 ")\n",
-             pVdexHeader->dexSize, pVdexHeader->dexSize);
+             pVdex->dexSize, pVdex->dexSize);
   LOGMSG_RAW(l_DEBUG, "verifier dependencies size  : %" PRIx32 " (%" PRIu32 ")\n",
-             vdex_GetVerifierDepsDataSize(cursor), vdex_GetVerifierDepsDataSize(cursor));
-  LOGMSG_RAW(l_DEBUG, "verifier dependencies offset: %" PRIx32 " (%" PRIu32 ")\n",
-             vdex_GetVerifierDepsDataOffset(cursor), vdex_GetVerifierDepsDataOffset(cursor));
+             pVdex->verifierDepsSize, pVdex->verifierDepsSize);
+  LOGMSG_RAW(l_DEBUG, "verifier dependencies offset: %" PRIx32 " (%" PRIu32 ")\n", depsOff,
+             depsOff);
   LOGMSG_RAW(l_DEBUG, "quickening info size        : %" PRIx32 " (%" PRIu32 ")\n",
-             vdex_GetQuickeningInfoSize(cursor), vdex_GetQuickeningInfoSize(cursor));
+             pVdex->quickeningInfoSize, pVdex->quickeningInfoSize);
   LOGMSG_RAW(l_DEBUG, "quickening info offset      : %" PRIx32 " (%" PRIu32 ")\n",
-             vdex_GetQuickeningInfoOffset(cursor), vdex_GetQuickeningInfoOffset(cursor));
+             quickeningOff, quickeningOff);
   LOGMSG_RAW(l_DEBUG, "dex files info              :\n");
 
-  for (u4 i = 0; i < pVdexHeader->numberOfDexFiles; ++i) {
+  for (u4 i = 0; i < pVdex->numberOfDexFiles; ++i) {
     LOGMSG_RAW(l_DEBUG, "  [%" PRIu32 "] location checksum : %" PRIx32 " (%" PRIu32 ")\n", i,
-               vdex_GetLocationChecksum(cursor, i), vdex_GetLocationChecksum(cursor, i));
+               pVdex->locationChecksums[i], pVdex->locationChecksums[i]);
   }
   LOGMSG_RAW(l_DEBUG, "---- EOF Vdex Header Info ----\n");
 }
 
-int vdex_process(const char *VdexFileName, const u1 *cursor, const runArgs_t *pRunArgs) {
+int vdex_process(const vdexBackendOps *pBackend,
+                 pipeline_file_t *pFile,
+                 const vdexFile *pVdex,
+                 const runArgs_t *pRunArgs) {
   // Measure time spend to process all Dex files of a Vdex file
   struct timespec timer;
   utils_startTimer(&timer);
 
   // Process Vdex file
-  int ret = (*processPtr)(VdexFileName, cursor, pRunArgs);
+  int ret = (*pBackend->process)(pFile, pVdex, pRunArgs);
 
   // Get elapsed time in ns
   long timeSpend = utils_endTimer(&timer);
@@ -219,12 +359,18 @@ int vdex_process(const char *VdexFileName, const u1 *cursor, const runArgs_t *pR
   return ret;
 }
 
-void *vdex_initDepsInfo(const u1 *vdexFileBuf) { return (*initDepsInfoPtr)(vdexFileBuf); }
+void *vdex_initDepsInfo(const vdexBackendOps *pBackend, const vdexFile *pVdex) {
+  return (*pBackend->initDepsInfo)(pVdex);
+}
 
-void vdex_destroyDepsInfo(const void *dataPtr) { (*destroyDepsInfoPtr)(dataPtr); }
+void vdex_destroyDepsInfo(const vdexBackendOps *pBackend, const void *dataPtr) {
+  (*pBackend->destroyDepsInfo)(dataPtr);
+}
 
-void vdex_dumpDepsInfo(const u1 *vdexFileBuf, const void *dataPtr) {
-  (*dumpDepsInfoPtr)(vdexFileBuf, dataPtr);
+void vdex_dumpDepsInfo(const vdexBackendOps *pBackend,
+                       const vdexFile *pVdex,
+                       const void *dataPtr) {
+  (*pBackend->dumpDepsInfo)(pVdex, dataPtr);
 }
 
 bool vdex_updateChecksums(const char *inVdexFileName,
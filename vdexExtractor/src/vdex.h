@@ -26,6 +26,8 @@
 #include <zlib.h>
 #include "common.h"
 #include "dex.h"
+#include "dex_index.h"
+#include "pipeline.h"
 
 #define kUnresolvedMarker (u2)(-1)
 
@@ -72,11 +74,36 @@ typedef struct __attribute__((packed)) {
 //     unalgined_uint32_t[D]       start offsets (from the start of QuickeningInfo) in previous
 //                                 table for each dex file
 
-typedef struct __attribute__((packed)) {
-  vdexHeader *pVdexHeader;
-  dexHeader *pDexFiles;
+// Parsed Vdex container, built once per input by vdex_open(). Section bounds & the offsets of the
+// embedded Dex files are validated against the file size, so that backends get random access to
+// any Dex file instead of re-walking the Dex section.
+typedef struct {
+  const u1 *buf;
+  size_t fileSz;
+  const vdexHeader *pHeader;
+  u4 numberOfDexFiles;
+  const VdexChecksum *locationChecksums;
+  const u1 *dexBegin;
+  u4 dexSize;
+  const u1 *verifierDeps;
+  u4 verifierDepsSize;
+  const u1 *quickeningInfo;
+  u4 quickeningInfoSize;
+  const unaligned_u4 *quickeningTable;  // Vdex 010 per Dex file table starts, NULL otherwise
+  const u4 *dexOffsets;                 // From the file start, NULL without a Dex section
+  dexClassLookup **classLookups;        // Per Dex file, built on demand by vdex_getClassLookup()
+  dexMemberIndex **memberIndexes;       // Per Dex file, built on demand by vdex_findMethod()
 } vdexFile;
 
+// Version specific backend operations. Tables are immutable so every worker can hold its own
+// reference for the file it processes.
+typedef struct {
+  void *(*initDepsInfo)(const vdexFile *);
+  void (*destroyDepsInfo)(const void *);
+  void (*dumpDepsInfo)(const vdexFile *, const void *);
+  int (*process)(pipeline_file_t *, const vdexFile *, const runArgs_t *);
+} vdexBackendOps;
+
 typedef struct __attribute__((packed)) {
   u4 numberOfStrings;
   const char **strings;
@@ -142,8 +169,6 @@ const u1 *vdex_DexBegin(const u1 *);
 u4 vdex_DexBeginOffset(const u1 *);
 const u1 *vdex_DexEnd(const u1 *);
 u4 vdex_DexEndOffset(const u1 *);
-const u1 *vdex_GetNextDexFileData(const u1 *, u4 *);
-u4 vdex_GetLocationChecksum(const u1 *, u4);
 void vdex_SetLocationChecksum(const u1 *, u4, u4);
 const u1 *vdex_GetVerifierDepsData(const u1 *);
 u4 vdex_GetVerifierDepsDataOffset(const u1 *);
@@ -152,14 +177,38 @@ const u1 *vdex_GetQuickeningInfo(const u1 *);
 u4 vdex_GetQuickeningInfoSize(const u1 *);
 u4 vdex_GetQuickeningInfoOffset(const u1 *);
 
-void vdex_dumpHeaderInfo(const u1 *);
+// Indexes a Vdex file of the given size. Returns false (with an error logged) if any section or
+// embedded Dex file is out of bounds.
+bool vdex_open(vdexFile *, const u1 *, size_t);
+void vdex_close(vdexFile *);
+
+// Dex file by index, NULL if the Vdex file has no Dex section
+static inline const u1 *vdex_getDexFile(const vdexFile *pVdex, u4 idx) {
+  return pVdex->dexOffsets ? pVdex->buf + pVdex->dexOffsets[idx] : NULL;
+}
+
+// Class lookup table of Dex file N, built on first use. Lookups of a Vdex file are meant for the
+// query paths, which run serially, so they're not synchronized.
+const dexClassLookup *vdex_getClassLookup(const vdexFile *, u4);
+
+// Resolves a class descriptor across the Dex files of a Vdex file, starting from Dex file N.
+// Returns the index of the first Dex file defining it (with its class def index stored) or the
+// number of Dex files if none does.
+u4 vdex_findClass(const vdexFile *, const char *, u4, u4 *);
+
+// Resolves a method of Dex file N from its class descriptor, name & signature through the member
+// index of the Dex file, built on first use. Returns the method id or kDexNoIndex.
+u4 vdex_findMethod(const vdexFile *, u4, const char *, const char *, const char *);
+
+// Dumps the header & location checksums of an opened Vdex file at debug level
+void vdex_dumpHeaderInfo(const vdexFile *);
 
-void *vdex_initDepsInfo(const u1 *);
-void vdex_destroyDepsInfo(const void *);
-void vdex_dumpDepsInfo(const u1 *, const void *);
+void *vdex_initDepsInfo(const vdexBackendOps *, const vdexFile *);
+void vdex_destroyDepsInfo(const vdexBackendOps *, const void *);
+void vdex_dumpDepsInfo(const vdexBackendOps *, const vdexFile *, const void *);
 
-void vdex_backendInit(VdexBackend);
-int vdex_process(const char *, const u1 *, const runArgs_t *);
+const vdexBackendOps *vdex_backendInit(VdexBackend);
+int vdex_process(const vdexBackendOps *, pipeline_file_t *, const vdexFile *, const runArgs_t *);
 
 bool vdex_updateChecksums(const char *, int, u4 *, const runArgs_t *);
 
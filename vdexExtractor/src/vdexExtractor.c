@@ -22,13 +22,55 @@
 
 #include <getopt.h>
 #include <libgen.h>
-#include <sys/mman.h>
+#include <stdatomic.h>
 
 #include "common.h"
+#include "dex.h"
+#include "dex_repair.h"
+#include "io_engine.h"
 #include "log.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "thread_pool.h"
 #include "utils.h"
 #include "vdex.h"
 
+// Shared state of a batch run. Files are submitted while inputs are still being discovered, so
+// the pipeline stages update the totals atomically as files complete.
+typedef struct {
+  const runArgs_t *pRunArgs;
+  bool captureDis;
+  threadPool_group_t group;
+  size_t fileCnt;
+  bool largestFirst;
+  struct fileTask_t **deferred;
+  atomic_size_t processedVdexCnt;
+  atomic_size_t processedDexCnt;
+} batch_t;
+
+// Per input file work item, owned by the task
+typedef struct fileTask_t {
+  batch_t *pBatch;
+  pipeline_file_t *pFile;
+  off_t fileSz;
+  char fileName[];
+} fileTask_t;
+
+// Batch of standalone Dex files repaired by the worker pool
+typedef struct {
+  const runArgs_t *pRunArgs;
+  threadPool_group_t group;
+  size_t fileCnt;
+  atomic_size_t repairedCnt;
+  atomic_size_t validCnt;
+} repairBatch_t;
+
+typedef struct {
+  repairBatch_t *pBatch;
+  off_t fileSz;
+  char fileName[];
+} repairTask_t;
+
 // exit() wrapper
 void exitWrapper(int errCode) {
   log_closeLogFile();
@@ -41,6 +83,7 @@ static void usage(bool exit_success) {
   LOGMSG_RAW(l_INFO, PROG_AUTHORS "\n\n");
   LOGMSG_RAW(l_INFO,"%s",
              " -i, --input=<path>   : input dir (1 max depth) or single file\n"
+             " -r, --recursive      : scan input dir recursively for Vdex files\n"
              " -o, --output=<path>  : output path (default is same as input)\n"
              " -f, --file-override  : allow output file override if already exists (default: false)\n"
              " --no-unquicken       : disable unquicken bytecode decompiler (don't de-odex)\n"
@@ -50,6 +93,27 @@ static void usage(bool exit_success) {
              " -v, --debug=LEVEL    : log level (0 - FATAL ... 4 - DEBUG), default: '3' (INFO)\n"
              " -l, --log-file=<path>: save disassembler and/or verified dependencies output to log "
                                      "file (default is STDOUT)\n"
+             " -j, --jobs=<N|auto>  : number of input files processed in parallel (default: 1)\n"
+             " --split-dex          : also process the Dex files & class chunks of a Vdex in parallel "
+                                     "(ignored with --dis)\n"
+             " --largest-first      : discover all input files first and process them in "
+                                     "descending size order\n"
+             " --stats              : report throughput & batch makespan statistics\n"
+             " --patch-list         : map inputs read-only & write unquickened Dex files from "
+                                     "recorded patches (ignored with --dis)\n"
+             " --digests            : compute Adler32, SHA-1 & CRC32 of output Dex files in a single "
+                                     "pass & report them\n"
+             " --repair-sig         : also repair the SHA-1 signature of Dex files whose checksum "
+                                     "is repaired (implies --digests)\n"
+             " --repair-dex         : repair checksum & signature of plain Dex inputs, in place or "
+                                     "under the output dir if given\n"
+             " --class=<descriptor> : unquicken & disassemble a single class (e.g. 'Lcom/foo/Bar;' or "
+                                     "'com.foo.Bar'), no Dex file is written\n"
+             " --method=<reference> : unquicken & disassemble a single method (e.g. "
+                                     "'Lcom/foo/Bar;->baz(ILjava/lang/String;)V'), no Dex file is "
+                                     "written\n"
+             " --io-uring           : batch output file syscalls through io_uring (falls back to "
+                                     "blocking I/O if unavailable)\n"
              " -h, --help           : this help\n");
 
   if (exit_success)
@@ -59,7 +123,44 @@ static void usage(bool exit_success) {
 }
 // clang-format on
 
-static bool selectVdexBackend(const u1 *cursor) {
+// Class queries accept either a type descriptor or a dotted Java class name
+static char *toClassDescriptor(const char *name) {
+  size_t len = strlen(name);
+  if (name[0] == '[' || (len > 2 && name[0] == 'L' && name[len - 1] == ';')) {
+    return strdup(name);
+  }
+
+  char *descriptor = utils_malloc(len + 3);
+  descriptor[0] = 'L';
+  for (size_t i = 0; i < len; ++i) {
+    descriptor[i + 1] = name[i] == '.' ? '/' : name[i];
+  }
+  descriptor[len + 1] = ';';
+  descriptor[len + 2] = '\0';
+  return descriptor;
+}
+
+// Method queries name the method as '<class>-><name>(<params>)<return>', the class part accepting
+// a dotted Java class name too. Returns false if the reference is malformed.
+static bool parseMethodReference(const char *ref, runArgs_t *pRunArgs) {
+  const char *arrow = strstr(ref, "->");
+  if (arrow == NULL || arrow == ref) return false;
+  const char *name = arrow + 2;
+  const char *signature = strchr(name, '(');
+  if (signature == NULL || signature == name || strchr(signature, ')') == NULL) return false;
+
+  free(pRunArgs->classQuery);
+  free(pRunArgs->methodQuery);
+  free(pRunArgs->methodSignature);
+  char *className = strndup(ref, (size_t)(arrow - ref));
+  pRunArgs->classQuery = toClassDescriptor(className);
+  free(className);
+  pRunArgs->methodQuery = strndup(name, (size_t)(signature - name));
+  pRunArgs->methodSignature = strdup(signature);
+  return true;
+}
+
+static const vdexBackendOps *selectVdexBackend(const u1 *cursor) {
   const vdexHeader *pVdexHeader = (const vdexHeader *)cursor;
 
   VdexBackend ver = kBackendMax;
@@ -73,9 +174,247 @@ static bool selectVdexBackend(const u1 *cursor) {
       break;
     default:
       LOGMSG(l_ERROR, "Invalid Vdex version");
-      return false;
+      return NULL;
+  }
+  return vdex_backendInit(ver);
+}
+
+// Unquicken stage of an input file already mapped by the pipeline. Returns the number of Dex
+// files handed to the output stages or -1 if the file was skipped.
+static int processVdexFile(pipeline_file_t *pFile, const runArgs_t *pRunArgs) {
+  const char *fileName = pFile->fileName;
+  const u1 *buf = pFile->buf;
+  int ret = -1;
+
+  LOGMSG(l_DEBUG, "Processing '%s'", fileName);
+
+  // Quick size checks for minimum valid file
+  if ((size_t)pFile->fileSz < (sizeof(vdexHeader) + sizeof(dexHeader))) {
+    LOGMSG(l_WARN, "Invalid input file - skipping '%s'", fileName);
+    return -1;
+  }
+
+  // Validate Vdex magic header
+  if (!vdex_isValidVdex(buf)) {
+    LOGMSG(l_WARN, "Invalid Vdex header - skipping '%s'", fileName);
+    return -1;
+  }
+
+  const vdexBackendOps *pBackend = selectVdexBackend(buf);
+  if (pBackend == NULL) {
+    LOGMSG(l_WARN, "Failed to initialize Vdex backend - skipping '%s'", fileName);
+    return -1;
+  }
+
+  // Index sections & embedded Dex files once, backends only access them through the handle
+  vdexFile vdex;
+  if (!vdex_open(&vdex, buf, (size_t)pFile->fileSz)) {
+    LOGMSG(l_WARN, "Invalid Vdex layout - skipping '%s'", fileName);
+    return -1;
+  }
+  vdex_dumpHeaderInfo(&vdex);
+
+  // Dump Vdex verified dependencies info
+  if (pRunArgs->dumpDeps) {
+    log_setDisStatus(true);
+    void *pDepsData = vdex_initDepsInfo(pBackend, &vdex);
+    if (pDepsData == NULL) {
+      LOGMSG(l_WARN, "Empty verified dependency data")
+    } else {
+      vdex_dumpDepsInfo(pBackend, &vdex, pDepsData);
+      vdex_destroyDepsInfo(pBackend, pDepsData);
+    }
+    log_setDisStatus(false);
+  }
+
+  // Class & method queries are resolved across the Dex files up front, so that inputs not
+  // defining them are skipped without walking them
+  u4 queryMatches = 0;
+  if (pRunArgs->classQuery) {
+    u4 classDefIdx;
+    u4 dexIdx = vdex_findClass(&vdex, pRunArgs->classQuery, 0, &classDefIdx);
+    while (dexIdx < vdex.numberOfDexFiles) {
+      LOGMSG(l_DEBUG, "Class '%s' is class def #%" PRIu32 " of 'classes%" PRIu32 ".dex'",
+             pRunArgs->classQuery, classDefIdx, dexIdx);
+      if (pRunArgs->methodQuery == NULL ||
+          vdex_findMethod(&vdex, dexIdx, pRunArgs->classQuery, pRunArgs->methodQuery,
+                          pRunArgs->methodSignature) != kDexNoIndex) {
+        queryMatches++;
+      }
+      dexIdx = vdex_findClass(&vdex, pRunArgs->classQuery, dexIdx + 1, &classDefIdx);
+    }
+    if (queryMatches == 0) {
+      vdex_close(&vdex);
+      return 0;
+    }
   }
-  vdex_backendInit(ver);
+
+  if (pRunArgs->enableDisassembler) {
+    log_setDisStatus(true);
+  }
+
+  // Unquicken Dex bytecode or simply walk optimized Dex files
+  ret = vdex_process(pBackend, pFile, &vdex, pRunArgs);
+  log_setDisStatus(false);
+  if (ret != -1 && pRunArgs->classQuery) ret = (int)queryMatches;
+  vdex_close(&vdex);
+  if (ret == -1) {
+    LOGMSG(l_ERROR, "Failed to process Dex files - skipping '%s'", fileName);
+  }
+  return ret;
+}
+
+static void processVdexFileTask(void *arg) {
+  fileTask_t *pTask = (fileTask_t *)arg;
+  batch_t *pBatch = pTask->pBatch;
+
+  struct timespec timer;
+  utils_startTimer(&timer);
+
+  // Keep disassembler & dependencies output of each file contiguous when running in parallel
+  if (pBatch->captureDis) log_disBeginCapture();
+  int dexCnt = processVdexFile(pTask->pFile, pBatch->pRunArgs);
+  if (pBatch->captureDis) log_disEndCapture();
+
+  stats_addFile(pTask->fileSz, utils_endTimer(&timer));
+
+  // Task is owned by the pipeline from this point
+  pipeline_fileProcessed(pTask->pFile, dexCnt);
+}
+
+// Pipeline completion callback, invoked once all Dex files of the input have been written
+static void vdexFileDone(pipeline_file_t *pFile, void *arg) {
+  fileTask_t *pTask = (fileTask_t *)arg;
+  batch_t *pBatch = pTask->pBatch;
+  if (pFile->dexCnt != -1) {
+    atomic_fetch_add(&pBatch->processedDexCnt, pFile->dexCnt);
+    atomic_fetch_add(&pBatch->processedVdexCnt, 1);
+  }
+  free(pTask);
+}
+
+// Map & prefetch stage, blocks while the pipeline is full
+static void dispatchVdexFile(fileTask_t *pTask) {
+  pTask->pFile = pipeline_mapFile(pTask->fileName, pTask->pBatch->pRunArgs->patchList,
+                                  vdexFileDone, pTask);
+  if (pTask->pFile == NULL) {
+    LOGMSG(l_ERROR, "Open & map failed - skipping '%s'", pTask->fileName);
+    free(pTask);
+    return;
+  }
+  threadPool_submit(&pTask->pBatch->group, processVdexFileTask, pTask);
+}
+
+// Input walker callback handing each discovered file to the worker pool. When scheduling largest
+// first the tasks are held back until discovery completes.
+static bool submitVdexFile(const char *path, off_t fileSz, void *arg) {
+  batch_t *pBatch = (batch_t *)arg;
+  size_t pathLen = strlen(path);
+  fileTask_t *pTask = utils_malloc(sizeof(fileTask_t) + pathLen + 1);
+  pTask->pBatch = pBatch;
+  pTask->fileSz = fileSz;
+  memcpy(pTask->fileName, path, pathLen + 1);
+
+  if (pBatch->largestFirst) {
+    if ((pBatch->fileCnt & (pBatch->fileCnt - 1)) == 0) {
+      pBatch->deferred =
+          utils_realloc(pBatch->deferred, sizeof(fileTask_t *) * (pBatch->fileCnt * 2 + 1));
+    }
+    pBatch->deferred[pBatch->fileCnt++] = pTask;
+    return true;
+  }
+
+  pBatch->fileCnt++;
+  dispatchVdexFile(pTask);
+  return true;
+}
+
+static int fileTaskSizeCmp(const void *a, const void *b) {
+  off_t sA = (*(fileTask_t *const *)a)->fileSz;
+  off_t sB = (*(fileTask_t *const *)b)->fileSz;
+  return sA < sB ? 1 : (sA > sB ? -1 : 0);
+}
+
+// Longest processing time first: with file cost roughly linear to its size, dispatching the
+// largest files first keeps a big file from starting last and stretching the batch makespan.
+static void submitDeferredFiles(batch_t *pBatch) {
+  qsort(pBatch->deferred, pBatch->fileCnt, sizeof(fileTask_t *), fileTaskSizeCmp);
+  for (size_t i = 0; i < pBatch->fileCnt; ++i) {
+    dispatchVdexFile(pBatch->deferred[i]);
+  }
+  free(pBatch->deferred);
+  pBatch->deferred = NULL;
+}
+
+static void repairDexFileTask(void *arg) {
+  repairTask_t *pTask = (repairTask_t *)arg;
+  repairBatch_t *pBatch = pTask->pBatch;
+
+  struct timespec timer;
+  utils_startTimer(&timer);
+  dexRepairStatus status = dexRepair_file(pTask->fileName, pBatch->pRunArgs);
+  stats_addFile(pTask->fileSz, utils_endTimer(&timer));
+
+  if (status == kDexRepairRepaired) {
+    atomic_fetch_add(&pBatch->repairedCnt, 1);
+  } else if (status == kDexRepairValid) {
+    atomic_fetch_add(&pBatch->validCnt, 1);
+  } else {
+    LOGMSG(l_ERROR, "Failed to repair '%s'", pTask->fileName);
+  }
+  free(pTask);
+}
+
+static bool submitRepairFile(const char *path, off_t fileSz, void *arg) {
+  repairBatch_t *pBatch = (repairBatch_t *)arg;
+  size_t pathLen = strlen(path);
+  repairTask_t *pTask = utils_malloc(sizeof(repairTask_t) + pathLen + 1);
+  pTask->pBatch = pBatch;
+  pTask->fileSz = fileSz;
+  memcpy(pTask->fileName, path, pathLen + 1);
+  pBatch->fileCnt++;
+  threadPool_submit(&pBatch->group, repairDexFileTask, pTask);
+  return true;
+}
+
+// Standalone Dex repair mode. Each discovered Dex file is a worker task, so a batch of small files
+// is spread over the pool without any of the Vdex pipeline stages.
+static bool repairDexFiles(const infiles_t *pFiles, runArgs_t *pRunArgs, u4 jobs, bool useIoUring) {
+  pRunArgs->inputDir = pFiles->inputFile;
+  if (!threadPool_init(jobs)) {
+    LOGMSG(l_ERROR, "Failed to initialize worker threads");
+    return false;
+  }
+  ioEngine_init(useIoUring);
+
+  repairBatch_t batch = {
+    .pRunArgs = pRunArgs,
+    .group = { .pending = 0 },
+    .fileCnt = 0,
+  };
+  atomic_init(&batch.repairedCnt, 0);
+  atomic_init(&batch.validCnt, 0);
+  struct timespec batchTimer;
+  utils_startTimer(&batchTimer);
+  ssize_t walkRet = utils_walkInputs(pFiles->inputFile, pFiles->recursive, kDexMagic,
+                                     sizeof(kDexMagic), submitRepairFile, &batch);
+  threadPool_wait(&batch.group);
+  long batchNanos = utils_endTimer(&batchTimer);
+  ioEngine_destroy();
+  threadPool_destroy();
+  if (walkRet < 0) {
+    LOGMSG(l_ERROR, "Couldn't load input files");
+    return false;
+  }
+
+  DISPLAY(l_INFO, "%zu out of %zu Dex files have been repaired",
+          atomic_load(&batch.repairedCnt), batch.fileCnt);
+  DISPLAY(l_INFO, "%zu out of %zu Dex files were already valid", atomic_load(&batch.validCnt),
+          batch.fileCnt);
+  if (pRunArgs->outputDir) {
+    DISPLAY(l_INFO, "Repaired Dex files are available in '%s'", pRunArgs->outputDir);
+  }
+  stats_dump(batchNanos, jobs);
   return true;
 }
 
@@ -83,6 +422,10 @@ int main(int argc, char **argv) {
   int c;
   int logLevel = l_INFO;
   const char *logFile = NULL;
+  u4 jobs = 1;
+  bool largestFirst = false;
+  bool useIoUring = false;
+  bool repairDex = false;
   runArgs_t pRunArgs = {
     .outputDir = NULL,
     .fileOverride = false,
@@ -90,30 +433,53 @@ int main(int argc, char **argv) {
     .enableDisassembler = false,
     .dumpDeps = false,
     .newCrcFile = NULL,
+    .splitDex = false,
+    .inputDir = NULL,
+    .patchList = false,
+    .digests = false,
+    .repairSignature = false,
+    .classQuery = NULL,
+    .methodQuery = NULL,
+    .methodSignature = NULL,
   };
   infiles_t pFiles = {
-    .inputFile = NULL, .files = NULL, .fileCnt = 0,
+    .inputFile = NULL, .files = NULL, .fileCnt = 0, .recursive = false,
   };
 
   if (argc < 1) usage(true);
 
   struct option longopts[] = { { "input", required_argument, 0, 'i' },
+                               { "recursive", no_argument, 0, 'r' },
                                { "output", required_argument, 0, 'o' },
                                { "file-override", no_argument, 0, 'f' },
                                { "no-unquicken", no_argument, 0, 0x101 },
                                { "dis", no_argument, 0, 0x102 },
                                { "deps", no_argument, 0, 0x103 },
                                { "new-crc", required_argument, 0, 0x104 },
+                               { "split-dex", no_argument, 0, 0x105 },
+                               { "largest-first", no_argument, 0, 0x106 },
+                               { "stats", no_argument, 0, 0x107 },
+                               { "io-uring", no_argument, 0, 0x108 },
+                               { "patch-list", no_argument, 0, 0x109 },
+                               { "digests", no_argument, 0, 0x10a },
+                               { "repair-sig", no_argument, 0, 0x10b },
+                               { "repair-dex", no_argument, 0, 0x10c },
+                               { "class", required_argument, 0, 0x10d },
+                               { "method", required_argument, 0, 0x10e },
                                { "debug", required_argument, 0, 'v' },
                                { "log-file", required_argument, 0, 'l' },
+                               { "jobs", required_argument, 0, 'j' },
                                { "help", no_argument, 0, 'h' },
                                { 0, 0, 0, 0 } };
 
-  while ((c = getopt_long(argc, argv, "i:o:fv:l:h?", longopts, NULL)) != -1) {
+  while ((c = getopt_long(argc, argv, "i:ro:fv:l:j:h?", longopts, NULL)) != -1) {
     switch (c) {
       case 'i':
         pFiles.inputFile = optarg;
         break;
+      case 'r':
+        pFiles.recursive = true;
+        break;
       case 'o':
         pRunArgs.outputDir = optarg;
         break;
@@ -132,12 +498,59 @@ int main(int argc, char **argv) {
       case 0x104:
         pRunArgs.newCrcFile = optarg;
         break;
+      case 0x105:
+        pRunArgs.splitDex = true;
+        break;
+      case 0x106:
+        largestFirst = true;
+        break;
+      case 0x107:
+        stats_setEnabled(true);
+        break;
+      case 0x108:
+        useIoUring = true;
+        break;
+      case 0x109:
+        pRunArgs.patchList = true;
+        break;
+      case 0x10a:
+        pRunArgs.digests = true;
+        break;
+      case 0x10b:
+        pRunArgs.digests = true;
+        pRunArgs.repairSignature = true;
+        break;
+      case 0x10c:
+        repairDex = true;
+        break;
+      case 0x10d:
+        free(pRunArgs.classQuery);
+        pRunArgs.classQuery = toClassDescriptor(optarg);
+        break;
+      case 0x10e:
+        if (!parseMethodReference(optarg, &pRunArgs)) {
+          LOGMSG(l_FATAL, "Invalid method reference '%s' (expected '<class>-><name>(<sig>)<ret>')",
+                 optarg);
+        }
+        break;
       case 'v':
         logLevel = atoi(optarg);
         break;
       case 'l':
         logFile = optarg;
         break;
+      case 'j':
+        if (strcmp(optarg, "auto") == 0) {
+          jobs = utils_getCpuCount();
+        } else {
+          char *end;
+          long n = strtol(optarg, &end, 10);
+          if (*end != '\0' || n < 1 || n > 1024) {
+            LOGMSG(l_FATAL, "Invalid number of jobs '%s'", optarg);
+          }
+          jobs = (u4)n;
+        }
+        break;
       case '?':
       case 'h':
         usage(true);
@@ -160,16 +573,17 @@ int main(int argc, char **argv) {
     exitWrapper(EXIT_FAILURE);
   }
 
-  // Initialize input files
-  if (!utils_init(&pFiles)) {
-    LOGMSG(l_FATAL, "Couldn't load input files");
-    exitWrapper(EXIT_FAILURE);
+  if (!pFiles.inputFile) {
+    LOGMSG(l_FATAL, "No input file/dir specified");
   }
 
   int mainRet = EXIT_FAILURE;
 
   // Parse input file with checksums (expects one per line) and update location checksum
   if (pRunArgs.newCrcFile) {
+    if (!utils_init(&pFiles, kVdexMagic, sizeof(kVdexMagic))) {
+      LOGMSG(l_FATAL, "Couldn't load input files");
+    }
     if (pFiles.fileCnt != 1) {
       LOGMSG(l_ERROR, "Exactly one input Vdex file is expected when updating location checksums");
       goto complete;
@@ -195,92 +609,98 @@ int main(int argc, char **argv) {
     goto complete;
   }
 
-  size_t processedVdexCnt = 0, processedDexCnt = 0;
-  DISPLAY(l_INFO, "Processing %zu file(s) from %s", pFiles.fileCnt, pFiles.inputFile);
-
-  for (size_t f = 0; f < pFiles.fileCnt; f++) {
-    off_t fileSz = 0;
-    int srcfd = -1;
-    u1 *buf = NULL;
-
-    LOGMSG(l_DEBUG, "Processing '%s'", pFiles.files[f]);
+  DISPLAY(l_INFO, "Processing files from %s", pFiles.inputFile);
 
-    // mmap file
-    buf = utils_mapFileToRead(pFiles.files[f], &fileSz, &srcfd);
-    if (buf == NULL) {
-      LOGMSG(l_ERROR, "Open & map failed - skipping '%s'", pFiles.files[f]);
-      continue;
-    }
-
-    // Quick size checks for minimum valid file
-    if ((size_t)fileSz < (sizeof(vdexHeader) + sizeof(dexHeader))) {
-      LOGMSG(l_WARN, "Invalid input file - skipping '%s'", pFiles.files[f]);
-      munmap(buf, fileSz);
-      close(srcfd);
-      continue;
+  if (repairDex) {
+    if (repairDexFiles(&pFiles, &pRunArgs, jobs, useIoUring)) {
+      mainRet = EXIT_SUCCESS;
     }
+    goto complete;
+  }
 
-    // Validate Vdex magic header
-    if (!vdex_isValidVdex(buf)) {
-      LOGMSG(l_WARN, "Invalid Vdex header - skipping '%s'", pFiles.files[f]);
-      munmap(buf, fileSz);
-      close(srcfd);
-      continue;
-    }
-    vdex_dumpHeaderInfo(buf);
+  // Class queries disassemble the queried class in place of writing the Dex files out
+  if (pRunArgs.classQuery) {
+    pRunArgs.enableDisassembler = true;
+  }
 
-    if (!selectVdexBackend(buf)) {
-      LOGMSG(l_WARN, "Failed to initialize Vdex backend - skipping '%s'", pFiles.files[f]);
-      munmap(buf, fileSz);
-      close(srcfd);
-      continue;
-    }
+  // Bytecode disassembler status is shared by all workers
+  dex_setDisassemblerStatus(pRunArgs.enableDisassembler);
 
-    // Dump Vdex verified dependencies info
-    if (pRunArgs.dumpDeps) {
-      log_setDisStatus(true);
-      void *pDepsData = vdex_initDepsInfo(buf);
-      if (pDepsData == NULL) {
-        LOGMSG(l_WARN, "Empty verified dependency data")
-      } else {
-        // TODO: Migrate this to vdex_process to avoid iterating Dex files twice. For now it's not
-        // a priority since the two flags offer different functionalities thus no point using them
-        // at the same time.
-        vdex_dumpDepsInfo(buf, pDepsData);
-        vdex_destroyDepsInfo(pDepsData);
-      }
-      log_setDisStatus(false);
-    }
-
-    if (pRunArgs.enableDisassembler) {
-      log_setDisStatus(true);
-    }
+  // Duplicate code items are only visited once when patching, which would hide them from the
+  // disassembler output
+  if (pRunArgs.enableDisassembler) {
+    pRunArgs.patchList = false;
+  }
 
-    // Unquicken Dex bytecode or simply walk optimized Dex files
-    int ret = vdex_process(pFiles.files[f], buf, &pRunArgs);
-    if (ret == -1) {
-      LOGMSG(l_ERROR, "Failed to process Dex files - skipping '%s'", pFiles.files[f]);
-      munmap(buf, fileSz);
-      close(srcfd);
-      continue;
-    }
+  // Sub-directories of the input dir are mirrored under the output dir
+  pRunArgs.inputDir = pFiles.inputFile;
 
-    processedDexCnt += ret;
-    processedVdexCnt++;
+  if (!threadPool_init(jobs)) {
+    LOGMSG(l_ERROR, "Failed to initialize worker threads");
+    goto complete;
+  }
+  LOGMSG(l_DEBUG, "Using %" PRIu32 " worker thread(s)", jobs);
+
+  // Checksum & write stages run on their own threads when processing in parallel, with a couple
+  // of files per worker in flight so that workers don't starve while output is being written
+  ioEngine_init(useIoUring);
+  if (!pipeline_init(jobs * 2, jobs > 1)) {
+    LOGMSG(l_ERROR, "Failed to initialize pipeline stages");
+    ioEngine_destroy();
+    threadPool_destroy();
+    goto complete;
+  }
 
-    // Clean-up
-    munmap(buf, fileSz);
-    buf = NULL;
-    close(srcfd);
+  // Files are processed as soon as the walker finds them
+  batch_t batch = {
+    .pRunArgs = &pRunArgs,
+    .captureDis = jobs > 1 && (pRunArgs.dumpDeps || pRunArgs.enableDisassembler),
+    .group = { .pending = 0 },
+    .fileCnt = 0,
+    .largestFirst = largestFirst,
+    .deferred = NULL,
+  };
+  atomic_init(&batch.processedVdexCnt, 0);
+  atomic_init(&batch.processedDexCnt, 0);
+  struct timespec batchTimer;
+  utils_startTimer(&batchTimer);
+  ssize_t walkRet = utils_walkInputs(pFiles.inputFile, pFiles.recursive, kVdexMagic,
+                                     sizeof(kVdexMagic), submitVdexFile, &batch);
+  if (largestFirst) submitDeferredFiles(&batch);
+  threadPool_wait(&batch.group);
+  pipeline_destroy();
+  ioEngine_destroy();
+  long batchNanos = utils_endTimer(&batchTimer);
+  threadPool_destroy();
+  if (walkRet < 0) {
+    LOGMSG(l_ERROR, "Couldn't load input files");
+    goto complete;
   }
 
-  DISPLAY(l_INFO, "%u out of %u Vdex files have been processed", processedVdexCnt, pFiles.fileCnt);
-  DISPLAY(l_INFO, "%u Dex files have been extracted in total", processedDexCnt);
-  DISPLAY(l_INFO, "Extracted Dex files are available in '%s'",
-          pRunArgs.outputDir ? pRunArgs.outputDir : dirname(pFiles.inputFile));
+  DISPLAY(l_INFO, "%zu out of %zu Vdex files have been processed",
+          atomic_load(&batch.processedVdexCnt), batch.fileCnt);
+  if (pRunArgs.methodQuery) {
+    DISPLAY(l_INFO, "Method '%s->%s%s' is defined in %zu Dex files", pRunArgs.classQuery,
+            pRunArgs.methodQuery, pRunArgs.methodSignature, atomic_load(&batch.processedDexCnt));
+  } else if (pRunArgs.classQuery) {
+    DISPLAY(l_INFO, "Class '%s' is defined in %zu Dex files", pRunArgs.classQuery,
+            atomic_load(&batch.processedDexCnt));
+  } else {
+    DISPLAY(l_INFO, "%zu Dex files have been extracted in total",
+            atomic_load(&batch.processedDexCnt));
+    DISPLAY(l_INFO, "Extracted Dex files are available in '%s'",
+            pRunArgs.outputDir ? pRunArgs.outputDir : dirname(pFiles.inputFile));
+  }
+  stats_dump(batchNanos, jobs);
   mainRet = EXIT_SUCCESS;
 
 complete:
+  for (size_t f = 0; f < pFiles.fileCnt; f++) {
+    free(pFiles.files[f]);
+  }
   free(pFiles.files);
+  free(pRunArgs.classQuery);
+  free(pRunArgs.methodQuery);
+  free(pRunArgs.methodSignature);
   exitWrapper(mainRet);
 }
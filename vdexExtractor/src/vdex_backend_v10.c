@@ -20,42 +20,115 @@
 
 */
 
+#include <stdatomic.h>
 #include <sys/mman.h>
 
 #include "dex_decompiler_v10.h"
-#include "out_writer.h"
+#include "dex_index.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "thread_pool.h"
 #include "utils.h"
 #include "vdex_backend_v10.h"
 
-static const u1 *quickening_info_ptr;
-static const unaligned_u4 *current_code_item_ptr;
-static const unaligned_u4 *current_code_item_end;
-
-static void QuickeningInfoItInit(u4 dex_file_idx,
-                                 u4 numberOfDexFiles,
-                                 const u1 *quicken_ptr,
-                                 u4 quicken_size) {
-  quickening_info_ptr = quicken_ptr;
-  const unaligned_u4 *dex_file_indices =
-      (unaligned_u4 *)(quicken_ptr + quicken_size - numberOfDexFiles * sizeof(u4));
-  current_code_item_end = (dex_file_idx == numberOfDexFiles - 1)
-                              ? dex_file_indices
-                              : (unaligned_u4 *)(quicken_ptr + dex_file_indices[dex_file_idx + 1]);
-  current_code_item_ptr = (unaligned_u4 *)(quicken_ptr + dex_file_indices[dex_file_idx]);
+// Quickening info table entry of a code item
+typedef struct {
+  u4 codeItemOff;
+  u4 dataOff;
+} quickeningIndexEntry;
+
+// Index of the (code item offset, quickening data offset) pairs of one Dex file sorted by code
+// item offset, so that methods can be paired with their quickening data in any visiting order.
+typedef struct {
+  const u1 *quickening_info_ptr;
+  quickeningIndexEntry *entries;
+  u1 *consumed;
+  u4 numEntries;
+} quickeningIndex;
+
+static int quickeningIndexEntryCmp(const void *a, const void *b) {
+  const quickeningIndexEntry *pA = (const quickeningIndexEntry *)a;
+  const quickeningIndexEntry *pB = (const quickeningIndexEntry *)b;
+  if (pA->codeItemOff != pB->codeItemOff) return pA->codeItemOff < pB->codeItemOff ? -1 : 1;
+  // Keep table order for duplicate offsets, only the first entry is reachable as in the iterator
+  return pA->dataOff < pB->dataOff ? -1 : (pA->dataOff > pB->dataOff);
 }
 
-static bool QuickeningInfoItDone() { return current_code_item_ptr == current_code_item_end; }
+// Table bounds have been validated by vdex_open(), a Vdex file without quickening info has none
+static void QuickeningIndexInit(quickeningIndex *index, const vdexFile *pVdex, u4 dex_file_idx) {
+  const u1 *quicken_ptr = pVdex->quickeningInfo;
+  const unaligned_u4 *dex_file_indices = pVdex->quickeningTable;
+  const unaligned_u4 *code_item_ptr = NULL;
+  const unaligned_u4 *code_item_end = NULL;
+  if (dex_file_indices != NULL) {
+    code_item_ptr = (const unaligned_u4 *)(quicken_ptr + dex_file_indices[dex_file_idx]);
+    code_item_end =
+        (dex_file_idx == pVdex->numberOfDexFiles - 1)
+            ? dex_file_indices
+            : (const unaligned_u4 *)(quicken_ptr + dex_file_indices[dex_file_idx + 1]);
+  }
+
+  index->quickening_info_ptr = quicken_ptr;
+  index->numEntries = (code_item_end - code_item_ptr) / 2;
+  index->entries = utils_malloc((index->numEntries + 1) * sizeof(quickeningIndexEntry));
+  index->consumed = utils_calloc(index->numEntries + 1);
+
+  // Tables are emitted in class def order, which in practice is mostly sorted by code item offset
+  bool isSorted = true;
+  for (u4 i = 0; i < index->numEntries; ++i) {
+    index->entries[i].codeItemOff = code_item_ptr[i * 2];
+    index->entries[i].dataOff = code_item_ptr[i * 2 + 1];
+    if (i > 0 && index->entries[i].codeItemOff <= index->entries[i - 1].codeItemOff) {
+      isSorted = false;
+    }
+  }
+  if (!isSorted) {
+    qsort(index->entries, index->numEntries, sizeof(quickeningIndexEntry),
+          quickeningIndexEntryCmp);
+  }
+}
 
-static void QuickeningInfoItAdvance() { current_code_item_ptr += 2; }
+static void QuickeningIndexDestroy(quickeningIndex *index) {
+  free(index->entries);
+  free(index->consumed);
+}
 
-static u4 QuickeningInfoItGetCurrentCodeItemOffset() { return current_code_item_ptr[0]; }
+// Looks up the quickening data of a code item. Data is handed out once, later visits of a
+// deduplicated code item get no data since the code has already been unquickened.
+static bool QuickeningIndexFind(quickeningIndex *index,
+                                u4 codeItemOff,
+                                const u1 **quickening_ptr,
+                                u4 *quickening_size) {
+  u4 lo = 0, hi = index->numEntries;
+  while (lo < hi) {
+    u4 mid = lo + (hi - lo) / 2;
+    if (index->entries[mid].codeItemOff < codeItemOff) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == index->numEntries || index->entries[lo].codeItemOff != codeItemOff ||
+      index->consumed[lo]) {
+    return false;
+  }
 
-static const u1 *QuickeningInfoItGetCurrentPtr() {
-  return quickening_info_ptr + current_code_item_ptr[1] + sizeof(u4);
+  index->consumed[lo] = 1;
+  const u1 *data = index->quickening_info_ptr + index->entries[lo].dataOff;
+  *quickening_size = *(unaligned_u4 *)data;
+  *quickening_ptr = data + sizeof(u4);
+  return true;
 }
 
-static u4 QuickeningInfoItGetCurrentSize() {
-  return *(unaligned_u4 *)(quickening_info_ptr + current_code_item_ptr[1]);
+// All QuickeningInfo data should have been consumed once every method has been visited
+static bool QuickeningIndexAllConsumed(const quickeningIndex *index) {
+  for (u4 i = 0; i < index->numEntries; ++i) {
+    if (!index->consumed[i] &&
+        (i == 0 || index->entries[i].codeItemOff != index->entries[i - 1].codeItemOff)) {
+      return false;
+    }
+  }
+  return true;
 }
 
 static inline u4 decodeUint32WithOverflowCheck(const u1 **in, const u1 *end) {
@@ -152,8 +225,8 @@ static const char *getStringFromId(const vdexDepData_v10 *pVdexDepData,
   }
 }
 
-void *vdex_initDepsInfo_v10(const u1 *vdexFileBuf) {
-  if (vdex_GetVerifierDepsDataSize(vdexFileBuf) == 0) {
+void *vdex_initDepsInfo_v10(const vdexFile *pVdex) {
+  if (pVdex->verifierDepsSize == 0) {
     // Return eagerly, as the first thing we expect from VerifierDeps data is
     // the number of created strings, even if there is no dependency.
     return NULL;
@@ -161,19 +234,14 @@ void *vdex_initDepsInfo_v10(const u1 *vdexFileBuf) {
 
   vdexDeps_v10 *pVdexDeps = utils_malloc(sizeof(vdexDeps_v10));
 
-  const vdexHeader *pVdexHeader = (const vdexHeader *)vdexFileBuf;
-  pVdexDeps->numberOfDexFiles = pVdexHeader->numberOfDexFiles;
+  pVdexDeps->numberOfDexFiles = pVdex->numberOfDexFiles;
   pVdexDeps->pVdexDepData = utils_malloc(sizeof(vdexDepData_v10) * pVdexDeps->numberOfDexFiles);
 
-  const u1 *dexFileBuf = NULL;
-  u4 offset = 0;
-
-  const u1 *depsDataStart = vdex_GetVerifierDepsData(vdexFileBuf);
-  const u1 *depsDataEnd = depsDataStart + vdex_GetVerifierDepsDataSize(vdexFileBuf);
+  const u1 *depsDataStart = pVdex->verifierDeps;
+  const u1 *depsDataEnd = depsDataStart + pVdex->verifierDepsSize;
 
   for (u4 i = 0; i < pVdexDeps->numberOfDexFiles; ++i) {
-    dexFileBuf = vdex_GetNextDexFileData(vdexFileBuf, &offset);
-    if (dexFileBuf == NULL) {
+    if (vdex_getDexFile(pVdex, i) == NULL) {
       LOGMSG(l_FATAL, "Failed to extract Dex file buffer from loaded Vdex");
     }
 
@@ -216,16 +284,14 @@ void vdex_destroyDepsInfo_v10(const void *dataPtr) {
   free((void *)pVdexDeps);
 }
 
-void vdex_dumpDepsInfo_v10(const u1 *vdexFileBuf, const void *dataPtr) {
+void vdex_dumpDepsInfo_v10(const vdexFile *pVdex, const void *dataPtr) {
   const vdexDeps_v10 *pVdexDeps = (const vdexDeps_v10 *)dataPtr;
   log_dis("------- Vdex Deps Info -------\n");
 
-  const u1 *dexFileBuf = NULL;
-  u4 offset = 0;
   for (u4 i = 0; i < pVdexDeps->numberOfDexFiles; ++i) {
     const vdexDepData_v10 *pVdexDepData = &pVdexDeps->pVdexDepData[i];
     log_dis("dex file #%" PRIu32 "\n", i);
-    dexFileBuf = vdex_GetNextDexFileData(vdexFileBuf, &offset);
+    const u1 *dexFileBuf = vdex_getDexFile(pVdex, i);
     if (dexFileBuf == NULL) {
       LOGMSG(l_FATAL, "Failed to extract Dex file buffer from loaded Vdex");
     }
@@ -289,7 +355,6 @@ void vdex_dumpDepsInfo_v10(const u1 *vdexFileBuf, const void *dataPtr) {
       log_dis("  %04" PRIu32 ": '%s'->'%s':'%s' is expected to be ", i,
               dex_getMethodDeclaringClassDescriptor(dexFileBuf, pDexMethodId),
               dex_getMethodName(dexFileBuf, pDexMethodId), methodSig);
-      free((void *)methodSig);
       if (accessFlags == kUnresolvedMarker) {
         log_dis("unresolved\n");
       } else {
@@ -312,155 +377,342 @@ void vdex_dumpDepsInfo_v10(const u1 *vdexFileBuf, const void *dataPtr) {
   log_dis("----- EOF Vdex Deps Info -----\n");
 }
 
-int vdex_process_v10(const char *VdexFileName, const u1 *cursor, const runArgs_t *pRunArgs) {
-  // Update Dex disassembler engine status
-  dex_setDisassemblerStatus(pRunArgs->enableDisassembler);
+// Smallest number of class defs worth scheduling as a separate task
+#define kMinClassDefsPerChunk 256
+
+// A range of class defs processed by a single task
+typedef struct {
+  const u1 *dexFileBuf;
+  u4 classDefFrom;
+  u4 classDefTo;
+  u4 methodIdx;  // Only method processed when querying one, kDexNoIndex otherwise
+  quickeningIndex *pQuickIndex;
+  atomic_uint *claimedCodeItems;
+  const runArgs_t *pRunArgs;
+  dexPatchList patches;
+  u4 dupCodeItems;
+  bool success;
+} classChunk_t;
+
+// A code item shared by several methods is claimed by the first visitor, so that it's walked &
+// patched exactly once, and never at the same time when chunks run concurrently.
+static bool claimCodeItem(atomic_uint *claimedCodeItems, u4 codeOff) {
+  u4 idx = codeOff / sizeof(u4);
+  unsigned int mask = 1U << (idx % 32);
+  return (atomic_fetch_or_explicit(&claimedCodeItems[idx / 32], mask, memory_order_relaxed) &
+          mask) == 0;
+}
 
-  const vdexHeader *pVdexHeader = (const vdexHeader *)cursor;
-  const u1 *dexFileBuf = NULL;
-  u4 offset = 0;
+static bool processMethod(dexDecompilerCtx_v10 *ctx,
+                          const u1 *dexFileBuf,
+                          dexMethod *pDexMethod,
+                          quickeningIndex *pQuickIndex,
+                          const runArgs_t *pRunArgs) {
+  if (pRunArgs->unquicken) {
+    const u1 *quickening_ptr = NULL;
+    u4 quickening_size = 0;
+    QuickeningIndexFind(pQuickIndex, pDexMethod->codeOff, &quickening_ptr, &quickening_size);
+    if (!dexDecompilerV10_decompile(ctx, dexFileBuf, pDexMethod, quickening_ptr, quickening_size,
+                                    true)) {
+      LOGMSG(l_ERROR, "Failed to decompile Dex file");
+      return false;
+    }
+  } else {
+    dexDecompilerV10_walk(ctx, dexFileBuf, pDexMethod);
+  }
+  return true;
+}
 
-  // For each Dex file
-  for (size_t dex_file_idx = 0; dex_file_idx < pVdexHeader->numberOfDexFiles; ++dex_file_idx) {
-    QuickeningInfoItInit(dex_file_idx, pVdexHeader->numberOfDexFiles,
-                         vdex_GetQuickeningInfo(cursor), vdex_GetQuickeningInfoSize(cursor));
+static bool unquickenClassDefs(classChunk_t *pChunk, dexDecompilerCtx_v10 *pCtx) {
+  const u1 *dexFileBuf = pChunk->dexFileBuf;
 
-    dexFileBuf = vdex_GetNextDexFileData(cursor, &offset);
-    if (dexFileBuf == NULL) {
-      LOGMSG(l_ERROR, "Failed to extract 'classes%zu.dex' - skipping", dex_file_idx);
+  for (u4 i = pChunk->classDefFrom; i < pChunk->classDefTo; ++i) {
+    const dexClassDef *pDexClassDef = dex_getClassDefUnchecked(dexFileBuf, i);
+    dex_dumpClassInfo(dexFileBuf, i);
+
+    // Cursor for currently processed class data item
+    const u1 *curClassDataCursor;
+    if (pDexClassDef->classDataOff == 0) {
       continue;
+    } else {
+      curClassDataCursor = dexFileBuf + pDexClassDef->classDataOff;
     }
 
-    const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+    dexClassDataHeader pDexClassDataHeader;
+    memset(&pDexClassDataHeader, 0, sizeof(dexClassDataHeader));
+    dex_readClassDataHeader(&curClassDataCursor, &pDexClassDataHeader);
 
-    // Check if valid Dex file
-    dex_dumpHeaderInfo(pDexHeader);
-    if (!dex_isValidDexMagic(pDexHeader)) {
-      LOGMSG(l_ERROR, "'classes%zu.dex' is an invalid Dex file - skipping", dex_file_idx);
-      continue;
+    // Skip static & instance fields
+    for (u4 j = 0;
+         j < pDexClassDataHeader.staticFieldsSize + pDexClassDataHeader.instanceFieldsSize; ++j) {
+      dexField pDexField;
+      memset(&pDexField, 0, sizeof(dexField));
+      dex_readClassDataField(&curClassDataCursor, &pDexField);
     }
 
-    // For each class
-    log_dis("file #%zu: classDefsSize=%" PRIu32 "\n", dex_file_idx, pDexHeader->classDefsSize);
-    for (u4 i = 0; i < pDexHeader->classDefsSize; ++i) {
-      const dexClassDef *pDexClassDef = dex_getClassDef(dexFileBuf, i);
-      dex_dumpClassInfo(dexFileBuf, i);
-
-      // Cursor for currently processed class data item
-      const u1 *curClassDataCursor;
-      if (pDexClassDef->classDataOff == 0) {
+    // For each direct & virtual method
+    u4 methodsSize = pDexClassDataHeader.directMethodsSize + pDexClassDataHeader.virtualMethodsSize;
+    u4 methodIdx = 0;
+    for (u4 j = 0; j < methodsSize; ++j) {
+      bool isDirect = j < pDexClassDataHeader.directMethodsSize;
+      dexMethod curDexMethod;
+      memset(&curDexMethod, 0, sizeof(dexMethod));
+      dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
+
+      // Method ids are delta encoded, starting over with the virtual methods
+      if (j == pDexClassDataHeader.directMethodsSize) methodIdx = 0;
+      methodIdx += curDexMethod.methodIdx;
+      if (pChunk->methodIdx != kDexNoIndex && methodIdx != pChunk->methodIdx) {
         continue;
-      } else {
-        curClassDataCursor = dexFileBuf + pDexClassDef->classDataOff;
       }
+      dex_dumpMethodInfo(dexFileBuf, &curDexMethod,
+                         isDirect ? j : j - pDexClassDataHeader.directMethodsSize,
+                         isDirect ? "direct" : "virtual");
 
-      dexClassDataHeader pDexClassDataHeader;
-      memset(&pDexClassDataHeader, 0, sizeof(dexClassDataHeader));
-      dex_readClassDataHeader(&curClassDataCursor, &pDexClassDataHeader);
-
-      // Skip static fields
-      for (u4 j = 0; j < pDexClassDataHeader.staticFieldsSize; ++j) {
-        dexField pDexField;
-        memset(&pDexField, 0, sizeof(dexField));
-        dex_readClassDataField(&curClassDataCursor, &pDexField);
+      // Skip empty, native or abstract methods
+      if (curDexMethod.codeOff == 0) {
+        continue;
       }
 
-      // Skip instance fields
-      for (u4 j = 0; j < pDexClassDataHeader.instanceFieldsSize; ++j) {
-        dexField pDexField;
-        memset(&pDexField, 0, sizeof(dexField));
-        dex_readClassDataField(&curClassDataCursor, &pDexField);
+      if (pChunk->claimedCodeItems &&
+          !claimCodeItem(pChunk->claimedCodeItems, curDexMethod.codeOff)) {
+        pChunk->dupCodeItems++;
+        continue;
       }
 
-      // For each direct method
-      for (u4 j = 0; j < pDexClassDataHeader.directMethodsSize; ++j) {
-        dexMethod curDexMethod;
-        memset(&curDexMethod, 0, sizeof(dexMethod));
-        dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
-        dex_dumpMethodInfo(dexFileBuf, &curDexMethod, j, "direct");
-
-        // Skip empty methods
-        if (curDexMethod.codeOff == 0) {
-          continue;
-        }
-
-        if (pRunArgs->unquicken) {
-          const u1 *quickening_ptr = QuickeningInfoItGetCurrentPtr();
-          u4 quickening_size = QuickeningInfoItGetCurrentSize();
-          if (!QuickeningInfoItDone() &&
-              curDexMethod.codeOff == QuickeningInfoItGetCurrentCodeItemOffset()) {
-            QuickeningInfoItAdvance();
-          } else {
-            quickening_ptr = NULL;
-            quickening_size = 0;
-          }
-          if (!dexDecompilerV10_decompile(dexFileBuf, &curDexMethod, quickening_ptr,
-                                          quickening_size, true)) {
-            LOGMSG(l_ERROR, "Failed to decompile Dex file");
-            return -1;
-          }
-        } else {
-          dexDecompilerV10_walk(dexFileBuf, &curDexMethod);
-        }
+      if (!processMethod(pCtx, dexFileBuf, &curDexMethod, pChunk->pQuickIndex, pChunk->pRunArgs)) {
+        return false;
       }
+    }
+  }
+  return true;
+}
 
-      // For each virtual method
-      for (u4 j = 0; j < pDexClassDataHeader.virtualMethodsSize; ++j) {
-        dexMethod curDexMethod;
-        memset(&curDexMethod, 0, sizeof(dexMethod));
-        dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
-        dex_dumpMethodInfo(dexFileBuf, &curDexMethod, j, "virtual");
-
-        // Skip native or abstract methods
-        if (curDexMethod.codeOff == 0) {
-          continue;
-        }
-
-        if (pRunArgs->unquicken) {
-          const u1 *quickening_ptr = QuickeningInfoItGetCurrentPtr();
-          u4 quickening_size = QuickeningInfoItGetCurrentSize();
-          if (!QuickeningInfoItDone() &&
-              curDexMethod.codeOff == QuickeningInfoItGetCurrentCodeItemOffset()) {
-            QuickeningInfoItAdvance();
-          } else {
-            quickening_ptr = NULL;
-            quickening_size = 0;
-          }
-          if (!dexDecompilerV10_decompile(dexFileBuf, &curDexMethod, quickening_ptr,
-                                          quickening_size, true)) {
-            LOGMSG(l_ERROR, "Failed to decompile Dex file");
-            return -1;
-          }
-        } else {
-          dexDecompilerV10_walk(dexFileBuf, &curDexMethod);
-        }
-      }
+// Unquickens a chunk of class defs, accounting the bytecode throughput when collecting stats
+static bool processClassDefs(classChunk_t *pChunk) {
+  dexDecompilerCtx_v10 ctx;
+  dexUnquicken_initIter(&ctx.iter, pChunk->pRunArgs->patchList ? &pChunk->patches : NULL);
+
+  struct timespec timer;
+  utils_startTimer(&timer);
+  bool ret = unquickenClassDefs(pChunk, &ctx);
+  stats_addBytecode(ctx.iter.instructions, ctx.iter.skippedMethods, pChunk->dupCodeItems,
+                    utils_endTimer(&timer));
+  dexUnquicken_destroyIter(&ctx.iter);
+  return ret;
+}
+
+static void processClassDefsTask(void *arg) {
+  classChunk_t *pChunk = (classChunk_t *)arg;
+  pChunk->success = processClassDefs(pChunk);
+}
+
+// Splits the class defs of a Dex file into chunks that are unquickened concurrently
+static bool processClassDefsParallel(const u1 *dexFileBuf,
+                                     u4 nChunks,
+                                     quickeningIndex *pQuickIndex,
+                                     atomic_uint *claimedCodeItems,
+                                     dexPatchList *pPatches,
+                                     const runArgs_t *pRunArgs) {
+  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+  u4 classDefsSize = pDexHeader->classDefsSize;
+  u4 classDefsPerChunk = (classDefsSize + nChunks - 1) / nChunks;
+  nChunks = (classDefsSize + classDefsPerChunk - 1) / classDefsPerChunk;
+
+  classChunk_t *chunks = utils_calloc(nChunks * sizeof(classChunk_t));
+
+  threadPool_group_t group = { .pending = 0 };
+  for (u4 i = 0; i < nChunks; ++i) {
+    classChunk_t *pChunk = &chunks[i];
+    pChunk->dexFileBuf = dexFileBuf;
+    pChunk->classDefFrom = i * classDefsPerChunk;
+    pChunk->classDefTo = pChunk->classDefFrom + classDefsPerChunk;
+    if (pChunk->classDefTo > classDefsSize) pChunk->classDefTo = classDefsSize;
+    pChunk->methodIdx = kDexNoIndex;
+    pChunk->pQuickIndex = pQuickIndex;
+    pChunk->claimedCodeItems = claimedCodeItems;
+    pChunk->pRunArgs = pRunArgs;
+    dexPatch_init(&pChunk->patches);
+    threadPool_submit(&group, processClassDefsTask, pChunk);
+  }
+  threadPool_wait(&group);
+
+  bool success = true;
+  for (u4 i = 0; i < nChunks; ++i) {
+    success &= chunks[i].success;
+    if (pPatches) dexPatch_merge(pPatches, &chunks[i].patches);
+  }
+
+  free(chunks);
+  return success;
+}
+
+// Unquickens (or walks) a single Dex file and hands it to the output stages. Returns false if the
+// file failed to process, which in turn fails the whole Vdex file.
+static bool processDexFile(pipeline_file_t *pFile,
+                           const vdexFile *pVdex,
+                           u4 dex_file_idx,
+                           const u1 *dexFileBuf,
+                           const runArgs_t *pRunArgs) {
+  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+
+  // Class queries only unquicken & disassemble the queried class def of the Dex files defining it
+  u4 classDefFrom = 0;
+  u4 classDefTo = pDexHeader->classDefsSize;
+  u4 methodIdx = kDexNoIndex;
+  if (pRunArgs->classQuery) {
+    const dexClassLookup *pLookup = vdex_getClassLookup(pVdex, dex_file_idx);
+    s4 classDefIdx =
+        pLookup ? dexIndex_findClass(pLookup, dexFileBuf, pRunArgs->classQuery) : -1;
+    if (classDefIdx < 0) return true;
+    classDefFrom = (u4)classDefIdx;
+    classDefTo = classDefFrom + 1;
+
+    if (pRunArgs->methodQuery) {
+      methodIdx = vdex_findMethod(pVdex, dex_file_idx, pRunArgs->classQuery,
+                                  pRunArgs->methodQuery, pRunArgs->methodSignature);
+      if (methodIdx == kDexNoIndex) return true;
     }
+  }
 
-    if (pRunArgs->unquicken) {
-      // All QuickeningInfo data should have been consumed
-      if (!QuickeningInfoItDone()) {
-        LOGMSG(l_ERROR, "Failed to use all quickening info");
-        return -1;
-      }
-      // If unquicken was successful original checksum should verify
-      u4 curChecksum = dex_computeDexCRC(dexFileBuf, pDexHeader->fileSize);
-      if (curChecksum != pDexHeader->checksum) {
-        LOGMSG(l_ERROR,
-               "Unexpected checksum (%" PRIx32 " vs %" PRIx32 ") - failed to unquicken Dex file",
-               curChecksum, pDexHeader->checksum);
-        return -1;
-      }
-    } else {
-      // Repair CRC if not decompiling so we can still run Dex parsing tools against output
-      dex_repairDexCRC(dexFileBuf, pDexHeader->fileSize);
+  // Check if valid Dex file
+  dex_dumpHeaderInfo(pDexHeader);
+  if (!dex_isValidDexMagic(pDexHeader)) {
+    LOGMSG(l_ERROR, "'classes%" PRIu32 ".dex' is an invalid Dex file - skipping", dex_file_idx);
+    return true;
+  }
+
+  quickeningIndex quickIndex;
+  QuickeningIndexInit(&quickIndex, pVdex, dex_file_idx);
+
+  // Large Dex files are split in class def chunks when running in parallel
+  u4 nChunks = 1;
+  if (pRunArgs->splitDex && !pRunArgs->enableDisassembler && pRunArgs->unquicken &&
+      threadPool_getThreadsNum() > 1) {
+    nChunks = pDexHeader->classDefsSize / kMinClassDefsPerChunk;
+    if (nChunks > threadPool_getThreadsNum() * 4) nChunks = threadPool_getThreadsNum() * 4;
+  }
+
+  // For each class
+  log_dis("file #%" PRIu32 ": classDefsSize=%" PRIu32 "\n", dex_file_idx,
+          pDexHeader->classDefsSize);
+  dexPatchList *pPatches = NULL;
+  if (pRunArgs->patchList) {
+    pPatches = utils_malloc(sizeof(dexPatchList));
+    dexPatch_init(pPatches);
+  }
+
+  // Code items are deduplicated by ART, so several methods may share one. Bitmap of the code item
+  // offsets already processed, unless disassembling where every method is listed.
+  atomic_uint *claimedCodeItems = NULL;
+  if (!pRunArgs->enableDisassembler) {
+    claimedCodeItems =
+        utils_calloc((pDexHeader->fileSize / sizeof(u4) / 32 + 1) * sizeof(atomic_uint));
+  }
+
+  bool success;
+  if (nChunks > 1) {
+    LOGMSG(l_DEBUG, "Splitting 'classes%" PRIu32 ".dex' into %" PRIu32 " class chunks",
+           dex_file_idx, nChunks);
+    success = processClassDefsParallel(dexFileBuf, nChunks, &quickIndex, claimedCodeItems,
+                                       pPatches, pRunArgs);
+  } else {
+    classChunk_t whole = {
+      .dexFileBuf = dexFileBuf,
+      .classDefFrom = classDefFrom,
+      .classDefTo = classDefTo,
+      .methodIdx = methodIdx,
+      .pQuickIndex = &quickIndex,
+      .claimedCodeItems = claimedCodeItems,
+      .pRunArgs = pRunArgs,
+    };
+    dexPatch_init(&whole.patches);
+    success = processClassDefs(&whole);
+    if (pPatches) dexPatch_merge(pPatches, &whole.patches);
+  }
+  free(claimedCodeItems);
+
+  // All QuickeningInfo data should have been consumed, unless only a class was queried
+  if (success && pRunArgs->unquicken && !pRunArgs->classQuery &&
+      !QuickeningIndexAllConsumed(&quickIndex)) {
+    LOGMSG(l_ERROR, "Failed to use all quickening info");
+    success = false;
+  }
+  QuickeningIndexDestroy(&quickIndex);
+  if (!success) {
+    if (pPatches) {
+      dexPatch_destroy(pPatches);
+      free(pPatches);
     }
+    return false;
+  }
+  if (pRunArgs->classQuery) return true;
+
+  // Checksum verification (or repair if not decompiling) & writing are left to the later stages
+  pipeline_emitDexFile(pFile, pRunArgs, dex_file_idx, (u1 *)dexFileBuf, pDexHeader->fileSize,
+                       pRunArgs->unquicken, pPatches);
+  return true;
+}
+
+typedef struct {
+  pipeline_file_t *pFile;
+  const vdexFile *pVdex;
+  u4 dex_file_idx;
+  const u1 *dexFileBuf;
+  const runArgs_t *pRunArgs;
+  bool success;
+} dexFileTask_t;
+
+static void processDexFileTask(void *arg) {
+  dexFileTask_t *pTask = (dexFileTask_t *)arg;
+  pTask->success = processDexFile(pTask->pFile, pTask->pVdex, pTask->dex_file_idx,
+                                  pTask->dexFileBuf, pTask->pRunArgs);
+}
+
+int vdex_process_v10(pipeline_file_t *pFile, const vdexFile *pVdex, const runArgs_t *pRunArgs) {
+  // Dex files are located through the container index, then handed to the worker pool when
+  // splitting is enabled. Disassembler output is order sensitive thus it always runs serially.
+  bool splitDex = pRunArgs->splitDex && !pRunArgs->enableDisassembler &&
+                  threadPool_getThreadsNum() > 1 && pVdex->numberOfDexFiles > 1;
+  dexFileTask_t *tasks = NULL;
+  threadPool_group_t group = { .pending = 0 };
+  if (splitDex) {
+    // Slots of skipped Dex files are never submitted & must not fail the Vdex file, as when serial
+    tasks = utils_calloc(pVdex->numberOfDexFiles * sizeof(dexFileTask_t));
+    for (u4 i = 0; i < pVdex->numberOfDexFiles; ++i) {
+      tasks[i].success = true;
+    }
+  }
+
+  bool success = true;
+  for (u4 dex_file_idx = 0; dex_file_idx < pVdex->numberOfDexFiles; ++dex_file_idx) {
+    const u1 *dexFileBuf = vdex_getDexFile(pVdex, dex_file_idx);
+    if (dexFileBuf == NULL) {
+      LOGMSG(l_ERROR, "Failed to extract 'classes%" PRIu32 ".dex' - skipping", dex_file_idx);
+      continue;
+    }
+
+    if (splitDex) {
+      dexFileTask_t *pTask = &tasks[dex_file_idx];
+      pTask->pFile = pFile;
+      pTask->pVdex = pVdex;
+      pTask->dex_file_idx = dex_file_idx;
+      pTask->dexFileBuf = dexFileBuf;
+      pTask->pRunArgs = pRunArgs;
+      threadPool_submit(&group, processDexFileTask, pTask);
+    } else if (!processDexFile(pFile, pVdex, dex_file_idx, dexFileBuf, pRunArgs)) {
+      success = false;
+      break;
+    }
+  }
 
-    if (!outWriter_DexFile(pRunArgs, VdexFileName, dex_file_idx, dexFileBuf,
-                           pDexHeader->fileSize)) {
-      return -1;
+  if (splitDex) {
+    threadPool_wait(&group);
+    for (u4 i = 0; i < pVdex->numberOfDexFiles; ++i) {
+      success &= tasks[i].success;
     }
+    free(tasks);
   }
 
-  return pVdexHeader->numberOfDexFiles;
+  return success ? (int)pVdex->numberOfDexFiles : -1;
 }
@@ -42,10 +42,10 @@ typedef struct __attribute__((packed)) {
   vdexDepData_v10 *pVdexDepData;
 } vdexDeps_v10;
 
-void *vdex_initDepsInfo_v10(const u1 *);
+void *vdex_initDepsInfo_v10(const vdexFile *);
 void vdex_destroyDepsInfo_v10(const void *);
-void vdex_dumpDepsInfo_v10(const u1 *, const void *);
+void vdex_dumpDepsInfo_v10(const vdexFile *, const void *);
 
-int vdex_process_v10(const char *, const u1 *, const runArgs_t *);
+int vdex_process_v10(pipeline_file_t *, const vdexFile *, const runArgs_t *);
 
 #endif
@@ -23,7 +23,10 @@
 #include <sys/mman.h>
 
 #include "dex_decompiler_v6.h"
-#include "out_writer.h"
+#include "dex_index.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "thread_pool.h"
 #include "utils.h"
 #include "vdex_backend_v6.h"
 
@@ -135,7 +138,6 @@ static void dumpDepsMethodInfo(const u1 *dexFileBuf,
     log_dis("  %04" PRIu32 ": '%s'->'%s':'%s' is expected to be ", i,
             dex_getMethodDeclaringClassDescriptor(dexFileBuf, pDexMethodId),
             dex_getMethodName(dexFileBuf, pDexMethodId), methodSig);
-    free((void *)methodSig);
     if (accessFlags == kUnresolvedMarker) {
       log_dis("unresolved\n");
     } else {
@@ -147,8 +149,8 @@ static void dumpDepsMethodInfo(const u1 *dexFileBuf,
   }
 }
 
-void *vdex_initDepsInfo_v6(const u1 *vdexFileBuf) {
-  if (vdex_GetVerifierDepsDataSize(vdexFileBuf) == 0) {
+void *vdex_initDepsInfo_v6(const vdexFile *pVdex) {
+  if (pVdex->verifierDepsSize == 0) {
     // Return eagerly, as the first thing we expect from VerifierDeps data is
     // the number of created strings, even if there is no dependency.
     return NULL;
@@ -156,19 +158,14 @@ void *vdex_initDepsInfo_v6(const u1 *vdexFileBuf) {
 
   vdexDeps_v6 *pVdexDeps = utils_malloc(sizeof(vdexDeps_v6));
 
-  const vdexHeader *pVdexHeader = (const vdexHeader *)vdexFileBuf;
-  pVdexDeps->numberOfDexFiles = pVdexHeader->numberOfDexFiles;
+  pVdexDeps->numberOfDexFiles = pVdex->numberOfDexFiles;
   pVdexDeps->pVdexDepData = utils_malloc(sizeof(vdexDepData_v6) * pVdexDeps->numberOfDexFiles);
 
-  const u1 *dexFileBuf = NULL;
-  u4 offset = 0;
-
-  const u1 *depsDataStart = vdex_GetVerifierDepsData(vdexFileBuf);
-  const u1 *depsDataEnd = depsDataStart + vdex_GetVerifierDepsDataSize(vdexFileBuf);
+  const u1 *depsDataStart = pVdex->verifierDeps;
+  const u1 *depsDataEnd = depsDataStart + pVdex->verifierDepsSize;
 
   for (u4 i = 0; i < pVdexDeps->numberOfDexFiles; ++i) {
-    dexFileBuf = vdex_GetNextDexFileData(vdexFileBuf, &offset);
-    if (dexFileBuf == NULL) {
+    if (vdex_getDexFile(pVdex, i) == NULL) {
       LOGMSG(l_FATAL, "Failed to extract Dex file buffer from loaded Vdex");
     }
 
@@ -220,16 +217,14 @@ void vdex_destroyDepsInfo_v6(const void *dataPtr) {
   free((void *)pVdexDeps);
 }
 
-void vdex_dumpDepsInfo_v6(const u1 *vdexFileBuf, const void *dataPtr) {
+void vdex_dumpDepsInfo_v6(const vdexFile *pVdex, const void *dataPtr) {
   const vdexDeps_v6 *pVdexDeps = (const vdexDeps_v6 *)dataPtr;
   log_dis("------- Vdex Deps Info -------\n");
 
-  const u1 *dexFileBuf = NULL;
-  u4 offset = 0;
   for (u4 i = 0; i < pVdexDeps->numberOfDexFiles; ++i) {
     const vdexDepData_v6 *pVdexDepData = &pVdexDeps->pVdexDepData[i];
     log_dis("dex file #%" PRIu32 "\n", i);
-    dexFileBuf = vdex_GetNextDexFileData(vdexFileBuf, &offset);
+    const u1 *dexFileBuf = vdex_getDexFile(pVdex, i);
     if (dexFileBuf == NULL) {
       LOGMSG(l_FATAL, "Failed to extract Dex file buffer from loaded Vdex");
     }
@@ -298,154 +293,455 @@ void vdex_dumpDepsInfo_v6(const u1 *vdexFileBuf, const void *dataPtr) {
   log_dis("----- EOF Vdex Deps Info -----\n");
 }
 
-int vdex_process_v6(const char *VdexFileName, const u1 *cursor, const runArgs_t *pRunArgs) {
-  // Update Dex disassembler engine status
-  dex_setDisassemblerStatus(pRunArgs->enableDisassembler);
-
-  // Measure time spend to process all Dex files of a Vdex file
-  struct timespec timer;
-  utils_startTimer(&timer);
+// Smallest number of class defs worth scheduling as a separate task
+#define kMinClassDefsPerChunk 256
+
+// Quickening blob boundaries of a Dex file located by the skim pass. The blob offset (relative to
+// the quickening info section) and the ordinal of the first method with code are recorded for
+// each class def, so that classes can be unquickened in any order.
+typedef struct {
+  const u1 *dexFileBuf;
+  u4 dex_file_idx;
+  u4 *classBlobOffs;
+  u4 *classMethodOrdinals;
+  u1 *dupMethods;
+  u4 *ownerBlobOffs;  // Blob of the first method sharing each method's code item, for queries
+  u4 classDefFrom;  // Class defs to process, only the queried one for class queries
+  u4 classDefTo;
+  u4 methodIdx;  // Only method processed for method queries, kDexNoIndex otherwise
+} quickeningSegment;
+
+// A range of class defs processed by a single task
+typedef struct {
+  const quickeningSegment *pSegment;
+  const u1 *quickening_info;
+  bool hasQuickeningInfo;
+  u4 classDefFrom;
+  u4 classDefTo;
+  bool skipDupMethods;
+  const runArgs_t *pRunArgs;
+  dexPatchList patches;
+  u4 dupCodeItems;
+  bool success;
+} classChunk_t;
+
+static inline bool testBit(const u1 *bitmap, u4 idx) { return bitmap[idx / 8] & (1 << (idx % 8)); }
+
+static inline void setBit(u1 *bitmap, u4 idx) { bitmap[idx / 8] |= (u1)(1 << (idx % 8)); }
+
+// Parses the class data header and skips the fields of a class def. Returns NULL if the class
+// has no data.
+static const u1 *readClassDataHeader(const u1 *dexFileBuf,
+                                     u4 classIdx,
+                                     dexClassDataHeader *pDexClassDataHeader) {
+  const dexClassDef *pDexClassDef = dex_getClassDefUnchecked(dexFileBuf, classIdx);
+  if (pDexClassDef->classDataOff == 0) {
+    return NULL;
+  }
 
-  const vdexHeader *pVdexHeader = (const vdexHeader *)cursor;
-  const u1 *quickening_info_ptr = vdex_GetQuickeningInfo(cursor);
-  const u1 *const quickening_info_end =
-      vdex_GetQuickeningInfo(cursor) + vdex_GetQuickeningInfoSize(cursor);
+  const u1 *curClassDataCursor = dexFileBuf + pDexClassDef->classDataOff;
+  memset(pDexClassDataHeader, 0, sizeof(dexClassDataHeader));
+  dex_readClassDataHeader(&curClassDataCursor, pDexClassDataHeader);
 
-  const u1 *dexFileBuf = NULL;
-  u4 offset = 0;
+  // Skip static & instance fields
+  for (u4 j = 0;
+       j < pDexClassDataHeader->staticFieldsSize + pDexClassDataHeader->instanceFieldsSize; ++j) {
+    dexField pDexField;
+    memset(&pDexField, 0, sizeof(dexField));
+    dex_readClassDataField(&curClassDataCursor, &pDexField);
+  }
+  return curClassDataCursor;
+}
 
-  // For each Dex file
-  for (size_t dex_file_idx = 0; dex_file_idx < pVdexHeader->numberOfDexFiles; ++dex_file_idx) {
-    dexFileBuf = vdex_GetNextDexFileData(cursor, &offset);
-    if (dexFileBuf == NULL) {
-      LOGMSG(l_ERROR, "Failed to extract 'classes%zu.dex' - skipping", dex_file_idx);
-      continue;
-    }
+// Walks the class data of a Dex file without decompiling to record the blob boundaries of each
+// class. Methods sharing an already visited code item are marked, so that each code item is walked
+// & patched exactly once (their blob is empty anyway). Queries may skip that first method, thus
+// the blob owning the code item of each method is also recorded for them.
+static bool skimDexFile(quickeningSegment *pSegment,
+                        const u1 *quickening_info,
+                        const u1 **quickening_info_ptr,
+                        const u1 *quickening_info_end,
+                        bool hasQuickeningInfo,
+                        bool trackOwners) {
+  const u1 *dexFileBuf = pSegment->dexFileBuf;
+  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+  u4 classDefsSize = pDexHeader->classDefsSize;
+  u4 maxMethods = pDexHeader->methodIdsSize;
+
+  pSegment->classBlobOffs = utils_malloc((classDefsSize + 1) * sizeof(u4));
+  pSegment->classMethodOrdinals = utils_malloc((classDefsSize + 1) * sizeof(u4));
+  pSegment->dupMethods = utils_calloc(maxMethods / 8 + 1);
+  u1 *seenCodeItems = utils_calloc(pDexHeader->fileSize / sizeof(u4) / 8 + 1);
+  u4 *codeItemOwners = NULL;
+  if (trackOwners) {
+    pSegment->ownerBlobOffs = utils_malloc(maxMethods * sizeof(u4));
+    codeItemOwners = utils_calloc((pDexHeader->fileSize / sizeof(u4) + 1) * sizeof(u4));
+  }
 
-    const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+  bool ret = true;
+  u4 methodOrdinal = 0;
+  for (u4 i = 0; i < classDefsSize && ret; ++i) {
+    pSegment->classBlobOffs[i] = *quickening_info_ptr - quickening_info;
+    pSegment->classMethodOrdinals[i] = methodOrdinal;
 
-    // Check if valid Dex file
-    dex_dumpHeaderInfo(pDexHeader);
-    if (!dex_isValidDexMagic(pDexHeader)) {
-      LOGMSG(l_ERROR, "'classes%zu.dex' is an invalid Dex file - skipping", dex_file_idx);
+    dexClassDataHeader pDexClassDataHeader;
+    const u1 *curClassDataCursor = readClassDataHeader(dexFileBuf, i, &pDexClassDataHeader);
+    if (curClassDataCursor == NULL) {
       continue;
     }
 
-    // For each class
-    log_dis("file #%zu: classDefsSize=%" PRIu32 "\n", dex_file_idx, pDexHeader->classDefsSize);
-    for (u4 i = 0; i < pDexHeader->classDefsSize; ++i) {
-      const dexClassDef *pDexClassDef = dex_getClassDef(dexFileBuf, i);
-      dex_dumpClassInfo(dexFileBuf, i);
-
-      // Cursor for currently processed class data item
-      const u1 *curClassDataCursor;
-      if (pDexClassDef->classDataOff == 0) {
+    u4 methodsSize = pDexClassDataHeader.directMethodsSize + pDexClassDataHeader.virtualMethodsSize;
+    for (u4 j = 0; j < methodsSize; ++j) {
+      dexMethod curDexMethod;
+      memset(&curDexMethod, 0, sizeof(dexMethod));
+      dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
+      if (curDexMethod.codeOff == 0) {
         continue;
+      }
+
+      CHECK_LT(methodOrdinal, maxMethods);
+      u4 codeItemIdx = curDexMethod.codeOff / sizeof(u4);
+      if (testBit(seenCodeItems, codeItemIdx)) {
+        setBit(pSegment->dupMethods, methodOrdinal);
       } else {
-        curClassDataCursor = dexFileBuf + pDexClassDef->classDataOff;
+        setBit(seenCodeItems, codeItemIdx);
+      }
+      if (codeItemOwners) {
+        if (codeItemOwners[codeItemIdx] == 0) {
+          codeItemOwners[codeItemIdx] = methodOrdinal + 1;
+          pSegment->ownerBlobOffs[methodOrdinal] = *quickening_info_ptr - quickening_info;
+        } else {
+          pSegment->ownerBlobOffs[methodOrdinal] =
+              pSegment->ownerBlobOffs[codeItemOwners[codeItemIdx] - 1];
+        }
       }
+      methodOrdinal++;
+
+      if (hasQuickeningInfo) {
+        // For quickening info blob the first 4bytes are the inner blobs size
+        if ((size_t)(quickening_info_end - *quickening_info_ptr) < sizeof(u4) ||
+            *(const unaligned_u4 *)*quickening_info_ptr >
+                (size_t)(quickening_info_end - *quickening_info_ptr) - sizeof(u4)) {
+          LOGMSG(l_ERROR, "Truncated quickening info data");
+          ret = false;
+          break;
+        }
+        *quickening_info_ptr += sizeof(u4) + *(const unaligned_u4 *)*quickening_info_ptr;
+      }
+    }
+  }
+  pSegment->classBlobOffs[classDefsSize] = *quickening_info_ptr - quickening_info;
+  pSegment->classMethodOrdinals[classDefsSize] = methodOrdinal;
 
-      dexClassDataHeader pDexClassDataHeader;
-      memset(&pDexClassDataHeader, 0, sizeof(dexClassDataHeader));
-      dex_readClassDataHeader(&curClassDataCursor, &pDexClassDataHeader);
+  free(seenCodeItems);
+  free(codeItemOwners);
+  return ret;
+}
 
-      // Skip static fields
-      for (u4 j = 0; j < pDexClassDataHeader.staticFieldsSize; ++j) {
-        dexField pDexField;
-        memset(&pDexField, 0, sizeof(dexField));
-        dex_readClassDataField(&curClassDataCursor, &pDexField);
-      }
+static void destroySegment(quickeningSegment *pSegment) {
+  free(pSegment->classBlobOffs);
+  free(pSegment->classMethodOrdinals);
+  free(pSegment->dupMethods);
+  free(pSegment->ownerBlobOffs);
+}
 
-      // Skip instance fields
-      for (u4 j = 0; j < pDexClassDataHeader.instanceFieldsSize; ++j) {
-        dexField pDexField;
-        memset(&pDexField, 0, sizeof(dexField));
-        dex_readClassDataField(&curClassDataCursor, &pDexField);
-      }
+static bool unquickenClassDefs(classChunk_t *pChunk, dexDecompilerCtx_v6 *pCtx) {
+  const quickeningSegment *pSegment = pChunk->pSegment;
+  const u1 *dexFileBuf = pSegment->dexFileBuf;
+  const u1 *quickening_info_ptr =
+      pChunk->quickening_info + pSegment->classBlobOffs[pChunk->classDefFrom];
+  u4 methodOrdinal = pSegment->classMethodOrdinals[pChunk->classDefFrom];
 
-      // For each direct method
-      for (u4 j = 0; j < pDexClassDataHeader.directMethodsSize; ++j) {
-        dexMethod curDexMethod;
-        memset(&curDexMethod, 0, sizeof(dexMethod));
-        dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
-        dex_dumpMethodInfo(dexFileBuf, &curDexMethod, j, "direct");
+  for (u4 i = pChunk->classDefFrom; i < pChunk->classDefTo; ++i) {
+    dex_dumpClassInfo(dexFileBuf, i);
 
-        // Skip empty methods
-        if (curDexMethod.codeOff == 0) {
-          continue;
-        }
+    dexClassDataHeader pDexClassDataHeader;
+    const u1 *curClassDataCursor = readClassDataHeader(dexFileBuf, i, &pDexClassDataHeader);
+    if (curClassDataCursor == NULL) {
+      continue;
+    }
 
-        if (pRunArgs->unquicken && vdex_GetQuickeningInfoSize(cursor) != 0) {
-          // For quickening info blob the first 4bytes are the inner blobs size
-          u4 quickening_size = *(u4 *)quickening_info_ptr;
-          quickening_info_ptr += sizeof(u4);
-          if (!dexDecompilerV6_decompile(dexFileBuf, &curDexMethod, quickening_info_ptr,
-                                         quickening_size, true)) {
-            LOGMSG(l_ERROR, "Failed to decompile Dex file");
-            return -1;
-          }
-          quickening_info_ptr += quickening_size;
-        } else {
-          dexDecompilerV6_walk(dexFileBuf, &curDexMethod);
-        }
+    // For each direct & virtual method
+    u4 methodsSize = pDexClassDataHeader.directMethodsSize + pDexClassDataHeader.virtualMethodsSize;
+    u4 methodIdx = 0;
+    for (u4 j = 0; j < methodsSize; ++j) {
+      bool isDirect = j < pDexClassDataHeader.directMethodsSize;
+      dexMethod curDexMethod;
+      memset(&curDexMethod, 0, sizeof(dexMethod));
+      dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
+
+      // Method ids are delta encoded, starting over with the virtual methods. Methods other than
+      // the queried one are not dumped, yet their quickening blobs still have to be stepped over.
+      if (j == pDexClassDataHeader.directMethodsSize) methodIdx = 0;
+      methodIdx += curDexMethod.methodIdx;
+      bool isSkipped = pSegment->methodIdx != kDexNoIndex && methodIdx != pSegment->methodIdx;
+      if (!isSkipped) {
+        dex_dumpMethodInfo(dexFileBuf, &curDexMethod,
+                           isDirect ? j : j - pDexClassDataHeader.directMethodsSize,
+                           isDirect ? "direct" : "virtual");
       }
 
-      // For each virtual method
-      for (u4 j = 0; j < pDexClassDataHeader.virtualMethodsSize; ++j) {
-        dexMethod curDexMethod;
-        memset(&curDexMethod, 0, sizeof(dexMethod));
-        dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
-        dex_dumpMethodInfo(dexFileBuf, &curDexMethod, j, "virtual");
+      // Skip empty, native or abstract methods
+      if (curDexMethod.codeOff == 0) {
+        continue;
+      }
 
-        // Skip native or abstract methods
-        if (curDexMethod.codeOff == 0) {
-          continue;
+      bool isDup = pChunk->skipDupMethods && testBit(pSegment->dupMethods, methodOrdinal);
+      const u1 *ownerBlob = NULL;
+      if (pSegment->ownerBlobOffs) {
+        u4 ownerBlobOff = pSegment->ownerBlobOffs[methodOrdinal];
+        // The code item is still quickened if the method first sharing it has not been processed,
+        // which is the case when it precedes the queried class or when querying a single method
+        if (pSegment->methodIdx != kDexNoIndex ||
+            ownerBlobOff < pSegment->classBlobOffs[pChunk->classDefFrom]) {
+          ownerBlob = pChunk->quickening_info + ownerBlobOff;
         }
-
-        if (pRunArgs->unquicken && vdex_GetQuickeningInfoSize(cursor) != 0) {
-          // For quickening info blob the first 4bytes are the inner blobs size
-          u4 quickening_size = *(u4 *)quickening_info_ptr;
-          quickening_info_ptr += sizeof(u4);
-          if (!dexDecompilerV6_decompile(dexFileBuf, &curDexMethod, quickening_info_ptr,
-                                         quickening_size, true)) {
-            LOGMSG(l_ERROR, "Failed to decompile Dex file");
-            return -1;
-          }
-          quickening_info_ptr += quickening_size;
-        } else {
-          dexDecompilerV6_walk(dexFileBuf, &curDexMethod);
+      }
+      methodOrdinal++;
+      if (isDup && !isSkipped) pChunk->dupCodeItems++;
+      isSkipped |= isDup;
+
+      if (pChunk->hasQuickeningInfo) {
+        const u1 *blob = ownerBlob ? ownerBlob : quickening_info_ptr;
+        // For quickening info blob the first 4bytes are the inner blobs size
+        u4 quickening_size = *(const unaligned_u4 *)quickening_info_ptr;
+        quickening_info_ptr += sizeof(u4);
+        if (!isSkipped &&
+            !dexDecompilerV6_decompile(pCtx, dexFileBuf, &curDexMethod, blob + sizeof(u4),
+                                       *(const unaligned_u4 *)blob, true)) {
+          LOGMSG(l_ERROR, "Failed to decompile Dex file");
+          return false;
         }
+        quickening_info_ptr += quickening_size;
+      } else if (!isSkipped) {
+        dexDecompilerV6_walk(pCtx, dexFileBuf, &curDexMethod);
       }
     }
+  }
+  return true;
+}
 
-    if (pRunArgs->unquicken) {
-      // If unquicken was successful original checksum should verify
-      u4 curChecksum = dex_computeDexCRC(dexFileBuf, pDexHeader->fileSize);
-      if (curChecksum != pDexHeader->checksum) {
-        LOGMSG(l_ERROR,
-               "Unexpected checksum (%" PRIx32 " vs %" PRIx32 ") - failed to unquicken Dex file",
-               curChecksum, pDexHeader->checksum);
-        return -1;
-      }
-    } else {
-      // Repair CRC if not decompiling so we can still run Dex parsing tools against output
-      dex_repairDexCRC(dexFileBuf, pDexHeader->fileSize);
+// Unquickens a chunk of class defs, accounting the bytecode throughput when collecting stats
+static bool processClassDefs(classChunk_t *pChunk) {
+  dexDecompilerCtx_v6 ctx;
+  dexUnquicken_initIter(&ctx.iter, pChunk->pRunArgs->patchList ? &pChunk->patches : NULL);
+
+  struct timespec timer;
+  utils_startTimer(&timer);
+  bool ret = unquickenClassDefs(pChunk, &ctx);
+  stats_addBytecode(ctx.iter.instructions, ctx.iter.skippedMethods, pChunk->dupCodeItems,
+                    utils_endTimer(&timer));
+  dexUnquicken_destroyIter(&ctx.iter);
+  return ret;
+}
+
+static void processClassDefsTask(void *arg) {
+  classChunk_t *pChunk = (classChunk_t *)arg;
+  pChunk->success = processClassDefs(pChunk);
+}
+
+// Unquickens (or walks) a single Dex file and hands it to the output stages. Large Dex files are
+// split in class def chunks when running in parallel. In patch list mode the Dex file is left
+// untouched and the output stages apply the patches recorded by the chunks.
+static bool processDexFile(pipeline_file_t *pFile,
+                           const quickeningSegment *pSegment,
+                           const u1 *quickening_info,
+                           bool hasQuickeningInfo,
+                           const runArgs_t *pRunArgs) {
+  const u1 *dexFileBuf = pSegment->dexFileBuf;
+  const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+  u4 classDefsSize = pDexHeader->classDefsSize;
+  if (pRunArgs->classQuery && pSegment->classDefFrom == pSegment->classDefTo) {
+    return true;
+  }
+  dex_dumpHeaderInfo(pDexHeader);
+
+  u4 nChunks = 1;
+  if (pRunArgs->splitDex && !pRunArgs->enableDisassembler && pRunArgs->unquicken &&
+      threadPool_getThreadsNum() > 1) {
+    nChunks = classDefsSize / kMinClassDefsPerChunk;
+    if (nChunks > threadPool_getThreadsNum() * 4) nChunks = threadPool_getThreadsNum() * 4;
+  }
+  if (nChunks == 0) nChunks = 1;
+  u4 classDefsPerChunk = (classDefsSize + nChunks - 1) / nChunks;
+  if (classDefsPerChunk != 0) nChunks = (classDefsSize + classDefsPerChunk - 1) / classDefsPerChunk;
+
+  // For each class
+  log_dis("file #%" PRIu32 ": classDefsSize=%" PRIu32 "\n", pSegment->dex_file_idx, classDefsSize);
+  // Methods sharing a code item are skipped after the first one, unless disassembling where every
+  // method is listed
+  bool skipDupMethods = !pRunArgs->enableDisassembler;
+  dexPatchList *pPatches = NULL;
+  if (pRunArgs->patchList) {
+    pPatches = utils_malloc(sizeof(dexPatchList));
+    dexPatch_init(pPatches);
+  }
+
+  bool success = true;
+  if (nChunks > 1) {
+    LOGMSG(l_DEBUG, "Splitting 'classes%" PRIu32 ".dex' into %" PRIu32 " class chunks",
+           pSegment->dex_file_idx, nChunks);
+    classChunk_t *chunks = utils_calloc(nChunks * sizeof(classChunk_t));
+    threadPool_group_t group = { .pending = 0 };
+    for (u4 i = 0; i < nChunks; ++i) {
+      classChunk_t *pChunk = &chunks[i];
+      pChunk->pSegment = pSegment;
+      pChunk->quickening_info = quickening_info;
+      pChunk->hasQuickeningInfo = hasQuickeningInfo;
+      pChunk->classDefFrom = i * classDefsPerChunk;
+      pChunk->classDefTo = pChunk->classDefFrom + classDefsPerChunk;
+      if (pChunk->classDefTo > classDefsSize) pChunk->classDefTo = classDefsSize;
+      pChunk->skipDupMethods = skipDupMethods;
+      pChunk->pRunArgs = pRunArgs;
+      dexPatch_init(&pChunk->patches);
+      threadPool_submit(&group, processClassDefsTask, pChunk);
+    }
+    threadPool_wait(&group);
+    for (u4 i = 0; i < nChunks; ++i) {
+      success &= chunks[i].success;
+      if (pPatches) dexPatch_merge(pPatches, &chunks[i].patches);
+    }
+    free(chunks);
+  } else {
+    classChunk_t whole = {
+      .pSegment = pSegment,
+      .quickening_info = quickening_info,
+      .hasQuickeningInfo = hasQuickeningInfo,
+      .classDefFrom = pSegment->classDefFrom,
+      .classDefTo = pSegment->classDefTo,
+      .skipDupMethods = skipDupMethods,
+      .pRunArgs = pRunArgs,
+    };
+    dexPatch_init(&whole.patches);
+    success = processClassDefs(&whole);
+    if (pPatches) dexPatch_merge(pPatches, &whole.patches);
+  }
+  if (!success) {
+    if (pPatches) {
+      dexPatch_destroy(pPatches);
+      free(pPatches);
     }
+    return false;
+  }
+  if (pRunArgs->classQuery) return true;
 
-    if (!outWriter_DexFile(pRunArgs, VdexFileName, dex_file_idx, dexFileBuf,
-                           pDexHeader->fileSize)) {
-      return -1;
+  // Checksum verification (or repair if not decompiling) & writing are left to the later stages
+  pipeline_emitDexFile(pFile, pRunArgs, pSegment->dex_file_idx, (u1 *)dexFileBuf,
+                       pDexHeader->fileSize, pRunArgs->unquicken, pPatches);
+  return true;
+}
+
+typedef struct {
+  pipeline_file_t *pFile;
+  const quickeningSegment *pSegment;
+  const u1 *quickening_info;
+  bool hasQuickeningInfo;
+  const runArgs_t *pRunArgs;
+  bool success;
+} dexFileTask_t;
+
+static void processDexFileTask(void *arg) {
+  dexFileTask_t *pTask = (dexFileTask_t *)arg;
+  pTask->success = processDexFile(pTask->pFile, pTask->pSegment, pTask->quickening_info,
+                                  pTask->hasQuickeningInfo, pTask->pRunArgs);
+}
+
+int vdex_process_v6(pipeline_file_t *pFile, const vdexFile *pVdex, const runArgs_t *pRunArgs) {
+  const u1 *quickening_info = pVdex->quickeningInfo;
+  const u1 *quickening_info_ptr = quickening_info;
+  const u1 *const quickening_info_end = quickening_info + pVdex->quickeningInfoSize;
+  bool hasQuickeningInfo = pRunArgs->unquicken && pVdex->quickeningInfoSize != 0;
+  int ret = -1;
+
+  // Quickening info is a single stream of blobs, so blob boundaries of all Dex files are first
+  // located serially in order for Dex files & classes to be processed independently
+  quickeningSegment *segments =
+      utils_calloc(pVdex->numberOfDexFiles * sizeof(quickeningSegment));
+  u4 nSegments = 0;
+  for (u4 dex_file_idx = 0; dex_file_idx < pVdex->numberOfDexFiles; ++dex_file_idx) {
+    const u1 *dexFileBuf = vdex_getDexFile(pVdex, dex_file_idx);
+    if (dexFileBuf == NULL) {
+      LOGMSG(l_ERROR, "Failed to extract 'classes%" PRIu32 ".dex' - skipping", dex_file_idx);
+      continue;
+    }
+
+    const dexHeader *pDexHeader = (const dexHeader *)dexFileBuf;
+
+    // Check if valid Dex file
+    if (!dex_isValidDexMagic(pDexHeader)) {
+      dex_dumpHeaderInfo(pDexHeader);
+      LOGMSG(l_ERROR, "'classes%" PRIu32 ".dex' is an invalid Dex file - skipping", dex_file_idx);
+      continue;
+    }
+
+    quickeningSegment *pSegment = &segments[nSegments++];
+    pSegment->dexFileBuf = dexFileBuf;
+    pSegment->dex_file_idx = dex_file_idx;
+    if (!skimDexFile(pSegment, quickening_info, &quickening_info_ptr, quickening_info_end,
+                     hasQuickeningInfo, pRunArgs->classQuery != NULL)) {
+      goto cleanup;
+    }
+
+    // Class queries only unquicken & disassemble the queried class def of the Dex files defining
+    // it, the blobs of all Dex files still have to be located as they form a single stream
+    pSegment->classDefFrom = 0;
+    pSegment->classDefTo = pDexHeader->classDefsSize;
+    pSegment->methodIdx = kDexNoIndex;
+    if (pRunArgs->classQuery) {
+      const dexClassLookup *pLookup = vdex_getClassLookup(pVdex, dex_file_idx);
+      s4 classDefIdx = dexIndex_findClass(pLookup, dexFileBuf, pRunArgs->classQuery);
+      if (classDefIdx >= 0 && pRunArgs->methodQuery) {
+        pSegment->methodIdx = vdex_findMethod(pVdex, dex_file_idx, pRunArgs->classQuery,
+                                              pRunArgs->methodQuery, pRunArgs->methodSignature);
+        if (pSegment->methodIdx == kDexNoIndex) classDefIdx = -1;
+      }
+      pSegment->classDefFrom = classDefIdx < 0 ? 0 : (u4)classDefIdx;
+      pSegment->classDefTo = classDefIdx < 0 ? 0 : (u4)classDefIdx + 1;
     }
   }
 
   if (pRunArgs->unquicken && (quickening_info_ptr != quickening_info_end)) {
     LOGMSG(l_ERROR, "Failed to process all quickening info data");
-    return -1;
+    goto cleanup;
   }
 
-  // Get elapsed time in ns
-  long timeSpend = utils_endTimer(&timer);
-  LOGMSG(l_DEBUG, "Took %ld ms to process Vdex file", timeSpend / 1000000);
+  bool splitDex = pRunArgs->splitDex && !pRunArgs->enableDisassembler &&
+                  threadPool_getThreadsNum() > 1 && nSegments > 1;
+  if (splitDex) {
+    dexFileTask_t *tasks = utils_calloc(nSegments * sizeof(dexFileTask_t));
+    threadPool_group_t group = { .pending = 0 };
+    for (u4 i = 0; i < nSegments; ++i) {
+      tasks[i].pFile = pFile;
+      tasks[i].pSegment = &segments[i];
+      tasks[i].quickening_info = quickening_info;
+      tasks[i].hasQuickeningInfo = hasQuickeningInfo;
+      tasks[i].pRunArgs = pRunArgs;
+      threadPool_submit(&group, processDexFileTask, &tasks[i]);
+    }
+    threadPool_wait(&group);
 
-  return pVdexHeader->numberOfDexFiles;
+    bool success = true;
+    for (u4 i = 0; i < nSegments; ++i) {
+      success &= tasks[i].success;
+    }
+    free(tasks);
+    if (!success) {
+      goto cleanup;
+    }
+  } else {
+    for (u4 i = 0; i < nSegments; ++i) {
+      if (!processDexFile(pFile, &segments[i], quickening_info, hasQuickeningInfo,
+                          pRunArgs)) {
+        goto cleanup;
+      }
+    }
+  }
+  ret = pVdex->numberOfDexFiles;
+
+cleanup:
+  for (u4 i = 0; i < nSegments; ++i) {
+    destroySegment(&segments[i]);
+  }
+  free(segments);
+  return ret;
 }
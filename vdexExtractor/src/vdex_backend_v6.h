@@ -44,10 +44,10 @@ typedef struct __attribute__((packed)) {
   vdexDepData_v6 *pVdexDepData;
 } vdexDeps_v6;
 
-void *vdex_initDepsInfo_v6(const u1 *);
+void *vdex_initDepsInfo_v6(const vdexFile *);
 void vdex_destroyDepsInfo_v6(const void *);
-void vdex_dumpDepsInfo_v6(const u1 *, const void *);
+void vdex_dumpDepsInfo_v6(const vdexFile *, const void *);
 
-int vdex_process_v6(const char *, const u1 *, const runArgs_t *);
+int vdex_process_v6(pipeline_file_t *, const vdexFile *, const runArgs_t *);
 
 #endif